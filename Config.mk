@@ -102,6 +102,12 @@
         UPREEMPT=0 # userland preemption
              MTP=0 # multiple kernel threads per process
            PIPES=0 # pipe(2) functionality
+            ZRAM=0 # compressed in-memory swap
+             KSM=0 # merge identical anonymous pages in the background
+
+# Page replacement policy used by the page cache: lru, clock or 2q. This can
+# also be changed at run time with the "pframe policy" kshell command.
+        PFRAME_POLICY=lru
 
 # Set the number of terminals that we should be launching.
         NTERMS=3
@@ -109,6 +115,11 @@
 # Set the number of disks that we should be launching with
         NDISKS=1
 
+# Size in pages of the swap space on the last disk. Swap is only used when
+# there is a disk besides the one holding the root file system (NDISKS=2
+# or more), and that disk must be at least this big.
+        SWAP_BLOCKS=4096
+
 # terminal binary to use when opening a second terminal for gdb
         GDB_TERM=xterm
         GDB_PORT=1234
@@ -125,6 +136,6 @@
 
 # Boolean options specified in this specified in this file that should be
 # included as definitions at compile time
-        COMPILE_CONFIG_BOOLS=" DRIVERS VFS S5FS VM FI DYNAMIC MOUNTING MTP SHADOWD GETCWD UPREEMPT PIPES "
+        COMPILE_CONFIG_BOOLS=" DRIVERS VFS S5FS VM FI DYNAMIC MOUNTING MTP SHADOWD GETCWD UPREEMPT PIPES ZRAM KSM "
 # As above, but not booleans
-        COMPILE_CONFIG_DEFS=" NTERMS NDISKS DBG DISK_SIZE "
+        COMPILE_CONFIG_DEFS=" NTERMS NDISKS DBG DISK_SIZE PFRAME_POLICY SWAP_BLOCKS "
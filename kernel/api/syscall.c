@@ -20,6 +20,7 @@
 #include "mm/kmalloc.h"
 
 #include "fs/vfs_syscall.h"
+#include "fs/fsync.h"
 #include "fs/vnode.h"
 
 #include "test/kshell/kshell.h"
@@ -27,8 +28,13 @@
 #include "vm/brk.h"
 #include "vm/mmap.h"
 #include "vm/vmmap.h"
+#include "vm/populate.h"
+#include "vm/madvise.h"
+#include "vm/mlock.h"
+#include "vm/msync.h"
 
 #include "api/syscall.h"
+#include "api/syscall_ext.h"
 #include "api/utsname.h"
 #include "api/access.h"
 #include "api/exec.h"
@@ -489,6 +495,73 @@ static int sys_munmap(munmap_args_t *args)
         return 0;
 }
 
+static int sys_madvise(madvise_args_t *args)
+{
+        madvise_args_t          kargs;
+        int                     err;
+
+        if (copy_from_user(&kargs, args, sizeof(madvise_args_t))) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
+
+        err = do_madvise(kargs.addr, kargs.len, kargs.advice);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        return 0;
+}
+
+static int sys_mlock(mlock_args_t *args, int lock)
+{
+        mlock_args_t            kargs;
+        int                     err;
+
+        if (copy_from_user(&kargs, args, sizeof(mlock_args_t))) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
+
+        if (lock)
+                err = do_mlock(kargs.addr, kargs.len);
+        else
+                err = do_munlock(kargs.addr, kargs.len);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        return 0;
+}
+
+static int sys_mlockall(int flags)
+{
+        int err = do_mlockall(flags);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        return 0;
+}
+
+static int sys_msync(msync_args_t *args)
+{
+        msync_args_t            kargs;
+        int                     err;
+
+        if (copy_from_user(&kargs, args, sizeof(msync_args_t))) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
+
+        err = do_msync(kargs.addr, kargs.len, kargs.flags);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        return 0;
+}
+
 static void *sys_mmap(mmap_args_t *arg)
 {
         mmap_args_t             kargs;
@@ -546,11 +619,44 @@ static void *sys_brk(void *addr)
         }
 }
 
+static void *sys_brk_populate(void *addr)
+{
+        void *ret;
+        int err;
+
+        if (0 == (err = do_brk_populate(addr, &ret))) {
+                return ret;
+        } else {
+                curthr->kt_errno = -err;
+                return (void *) - 1;
+        }
+}
+
 static void sys_sync(void)
 {
         pframe_clean_all();
 }
 
+static int sys_fsync(int fd)
+{
+        int err;
+
+        if ((err = do_fsync(fd, 0)) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        } else return err;
+}
+
+static int sys_fdatasync(int fd)
+{
+        int err;
+
+        if ((err = do_fsync(fd, 1)) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        } else return err;
+}
+
 static void sys_halt(void)
 {
         proc_kill_all();
@@ -812,6 +918,12 @@ static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
                         sys_sync();
                         return 0;
 
+                case SYS_fsync:
+                        return sys_fsync((int)args);
+
+                case SYS_fdatasync:
+                        return sys_fdatasync((int)args);
+
 #ifdef __MOUNTING__
                 case SYS_mount:
                         return sys_mount((mount_args_t *) args);
@@ -868,6 +980,27 @@ static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
                 case SYS_brk:
                         return (int) sys_brk((void *)args);
 
+                case SYS_brk_populate:
+                        return (int) sys_brk_populate((void *)args);
+
+                case SYS_madvise:
+                        return sys_madvise((madvise_args_t *)args);
+
+                case SYS_mlock:
+                        return sys_mlock((mlock_args_t *)args, 1);
+
+                case SYS_munlock:
+                        return sys_mlock((mlock_args_t *)args, 0);
+
+                case SYS_mlockall:
+                        return sys_mlockall((int)args);
+
+                case SYS_munlockall:
+                        return do_munlockall();
+
+                case SYS_msync:
+                        return sys_msync((msync_args_t *)args);
+
                 case SYS_lseek:
                         return sys_lseek((lseek_args_t *)args);
 
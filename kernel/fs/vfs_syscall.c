@@ -8,11 +8,18 @@
 #include "fs/open.h"
 #include "fs/fcntl.h"
 #include "fs/lseek.h"
+#include "fs/fsync.h"
 #include "mm/kmalloc.h"
 #include "util/string.h"
 #include "util/printf.h"
+#include "util/parse.h"
 #include "fs/stat.h"
 #include "util/debug.h"
+#include "mm/mmobj.h"
+#include "mm/readahead.h"
+#include "mm/pframe_ext.h"
+#include "drivers/dev.h"
+#include "drivers/blockdev.h"
 
 /*
  * Syscalls for vfs. Refer to comments or man pages for implementation.
@@ -59,6 +66,18 @@ do_read(int fd, void *buf, size_t nbytes)
                         fput(file_to_read);
                         return -EISDIR;
                 }
+
+                /* let sequential readers of regular files read ahead */
+                if (S_ISREG(file_to_read->f_vnode->vn_mode) && 0 < nbytes
+                    && file_to_read->f_pos < file_to_read->f_vnode->vn_len) {
+                        readahead_access(file_to_read, &file_to_read->f_vnode->vn_mmobj,
+                                         ADDR_TO_PN(file_to_read->f_pos),
+                                         ADDR_TO_PN(file_to_read->f_pos + nbytes - 1)
+                                         - ADDR_TO_PN(file_to_read->f_pos) + 1,
+                                         ADDR_TO_PN(PAGE_ALIGN_UP(file_to_read->f_vnode->vn_len)),
+                                         NULL != pframe_hash_find(&file_to_read->f_vnode->vn_mmobj,
+                                                                  ADDR_TO_PN(file_to_read->f_pos)));
+                }
                 
                 int res = file_to_read->f_vnode->vn_ops->read(file_to_read->f_vnode,file_to_read->f_pos,buf,nbytes);
                 if(res > 0){
@@ -132,6 +151,55 @@ do_write(int fd, const void *buf, size_t nbytes)
         panic("Should never get here!\n");
 }
 
+/*
+ * The block device object that holds the metadata (superblock, inodes,
+ * indirect blocks) of the given file system, or NULL if the file system
+ * is not disk backed. Disk backed file systems name their device
+ * "disk<N>" in fs_dev.
+ */
+static mmobj_t *
+fsync_metadata_obj(fs_t *fs)
+{
+        blockdev_t *bd;
+        uint32_t num;
+
+        if (0 != strncmp(fs->fs_dev, "disk", 4) || parse_uint(fs->fs_dev + 4, &num))
+                return NULL;
+        if (NULL == (bd = blockdev_lookup(MKDEVID(DISK_MAJOR, num))))
+                return NULL;
+        return &bd->bd_mmobj;
+}
+
+/*
+ * Write the dirty cached pages of the file referred to by fd back to
+ * disk, and wait for them; pages that mlock(2) keeps pinned are written
+ * too. If datasync is zero (fsync(2)), the dirty metadata blocks of the
+ * file system the file lives on are written as well; fdatasync(2)
+ * writes only the file's own pages.
+ *
+ * Error cases you must handle for this function at the VFS level:
+ *      o EBADF
+ *        fd isn't a valid open file descriptor.
+ */
+int
+do_fsync(int fd, int datasync)
+{
+        file_t *file;
+        mmobj_t *meta;
+        int err;
+
+        if (NULL == (file = fget(fd)))
+                return -EBADF;
+
+        err = pframe_clean_obj(&file->f_vnode->vn_mmobj);
+        if (0 == err && !datasync
+            && NULL != (meta = fsync_metadata_obj(file->f_vnode->vn_fs)))
+                err = pframe_clean_obj(meta);
+
+        fput(file);
+        return err;
+}
+
 /*
  * Zero curproc->p_files[fd], and fput() the file. Return 0 on success
  *
@@ -0,0 +1,58 @@
+#pragma once
+
+/*
+ * System calls added on top of api/syscall.h: their numbers, argument
+ * structures and flags. Like api/syscall.h and mm/mman.h this file is
+ * shared with userland (as weenix/syscall_ext.h), so it includes nothing
+ * and uses no kernel types; size_t must already be defined.
+ */
+
+#define SYS_fsync               49
+#define SYS_fdatasync           50
+#define SYS_brk_populate        51
+#define SYS_madvise             52
+#define SYS_mlock               53
+#define SYS_munlock             54
+#define SYS_mlockall            55
+#define SYS_munlockall          56
+#define SYS_msync               57
+
+/* mmap(2) flags: place an anonymous mapping on a 4 MB boundary, so that
+ * it can be backed by large pages; fault in the whole mapping before
+ * returning */
+#define MAP_HUGE                0x40
+#define MAP_POPULATE            0x80
+
+/* madvise(2) advice */
+#define MADV_NORMAL             0
+#define MADV_RANDOM             1
+#define MADV_SEQUENTIAL         2
+#define MADV_WILLNEED           3
+#define MADV_DONTNEED           4
+#define MADV_FREE               8
+
+/* mlockall(2) flags */
+#define MCL_CURRENT             1
+#define MCL_FUTURE              2
+
+/* msync(2) flags */
+#define MS_ASYNC                1
+#define MS_INVALIDATE           2
+#define MS_SYNC                 4
+
+typedef struct madvise_args {
+        void    *addr;
+        size_t  len;
+        int     advice;
+} madvise_args_t;
+
+typedef struct mlock_args {
+        void    *addr;
+        size_t  len;
+} mlock_args_t;
+
+typedef struct msync_args {
+        void    *addr;
+        size_t  len;
+        int     flags;
+} msync_args_t;
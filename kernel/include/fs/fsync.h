@@ -0,0 +1,9 @@
+#pragma once
+
+/*
+ * fsync(2) and fdatasync(2): write the cached pages of an open file back
+ * to disk, and wait for them. fsync(2) also writes the dirty metadata
+ * blocks of the file system the file lives on.
+ */
+
+int do_fsync(int fd, int datasync);
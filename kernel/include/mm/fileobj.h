@@ -0,0 +1,20 @@
+#pragma once
+
+#include "types.h"
+
+struct mmobj;
+struct vnode;
+
+/*
+ * The files behind memory objects.
+ *
+ * The bottom object of a file mapping is the vnode's own mmobj, but the
+ * bottom object of a mapping may as well be anonymous memory or whatever
+ * object a device's mmap operation handed out. Every vnode's mmobj has
+ * the same operations, so that is what tells them apart; anon_is_anon()
+ * (in vm/anon.c) tells anonymous objects apart the same way.
+ */
+
+struct vnode *mmobj_vnode(struct mmobj *o);
+uint32_t mmobj_file_npages(struct mmobj *o);
+int      anon_is_anon(struct mmobj *o);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "types.h"
+
+struct mmobj;
+struct pframe;
+struct vmmap;
+
+/*
+ * Page cache functions added on top of mm/pframe.h, all defined in
+ * mm/pframe.c.
+ */
+
+/* Lookups */
+struct pframe *pframe_hash_find(struct mmobj *o, uint32_t pagenum);
+uint32_t pframe_gang_lookup(struct mmobj *o, uint32_t first, uint32_t last,
+                            struct pframe **pfs, uint32_t max);
+int      pframe_get_async(struct mmobj *o, uint32_t pagenum, struct pframe **result);
+struct pframe *pframe_next_frame(uint32_t *pfn);
+
+/* Freeing, zeroing and write-back */
+void     pframe_zero(struct pframe *pf);
+void     pframe_zero_refill(uint32_t max);
+void     pframe_lazyfree(struct pframe *pf);
+int      pframe_adopt_run(struct mmobj *o, uint32_t pagenum, uint32_t npages, void *addr);
+int      pframe_is_adopted(struct pframe *pf);
+void     pframe_unadopt(struct pframe *pf);
+void     pframe_wait_busy(struct pframe *pf);
+int      pframe_clean_obj(struct mmobj *o);
+int      pframe_sync_range(struct mmobj *o, uint32_t first, uint32_t last, int async);
+void     pframe_idle(void);
+
+/* Mappings: unmap one page everywhere, or harvest the dirty bits of
+ * [lopage, hipage) of map before those pages are unmapped from it */
+void     pframe_unmap_page(struct mmobj *o, uint32_t pagenum);
+void     pframe_harvest_unmap(struct vmmap *map, uint32_t lopage, uint32_t hipage);
+
+/* Per-process accounting */
+int      pframe_reclaim_owner(pid_t pid, int target);
+uint32_t pframe_owner_pinned(pid_t pid);
+void     pframe_disown(pid_t pid);
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "types.h"
+#include "util/list.h"
+
+#include "mm/pframe.h"
+
+struct mmobj;
+
+/*
+ * Page cache internals shared by mm/pframe.c and the replacement
+ * policies in mm/pfpolicy.c. Nothing else should include this.
+ */
+
+/*
+ * Every pframe_t handed out by pframe_alloc() is embedded in a
+ * pframe_desc_t, which carries the bookkeeping that only mm/pframe.c
+ * and the replacement policies need to see. Descriptors are not
+ * allocated per page; see pframe_chunks in mm/pframe.c.
+ */
+typedef struct pframe_desc {
+        pframe_t        pd_pframe;
+        pid_t           pd_owner;       /* process the frame is charged to, or -1 */
+        list_link_t     pd_plink;       /* replacement policy queue */
+        uint8_t         pd_ref;         /* CLOCK reference bit */
+        uint8_t         pd_queue;       /* 2Q queue, kept while pinned */
+        list_link_t     pd_dlink;       /* on dirty_list while dirty and unpinned */
+        list_link_t     pd_odlink;      /* on po_dirty, under the same conditions */
+        list_link_t     pd_pdlink;      /* on pinned_dirty_list while dirty and pinned */
+        uint32_t        pd_dirtied;     /* tsc_ticks() when it was first dirtied */
+        struct pframe_obj *pd_pobj;     /* record of pf_obj */
+        list_link_t     pd_fillq;       /* on pfill_queue while waiting to be filled */
+        uint8_t         pd_zeroed;      /* frame came from zero_pool, not yet filled */
+        uint8_t         pd_adopted;     /* holds the pin of pframe_adopt_run() */
+        list_link_t     pd_lflink;      /* on lazyfree_list while lazily freed */
+        list_link_t     pd_wmlink;      /* on wmapped_list while clean but mapped writable */
+} pframe_desc_t;
+
+#define pframe_desc(pf) CONTAINER_OF((pf), pframe_desc_t, pd_pframe)
+#define pframe_plink_desc(link) list_item((link), pframe_desc_t, pd_plink)
+
+/* Hash of a page's identity, for the pframe hash and the 2Q ghost table */
+static inline uint32_t
+pframe_key(struct mmobj *obj, uint32_t pagenum)
+{
+        uint32_t h = (uint32_t) obj ^ (pagenum * 0x9e3779b1);
+
+        /* murmur3 finalizer */
+        h ^= h >> 16;
+        h *= 0x85ebca6b;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35;
+        h ^= h >> 16;
+
+        return h;
+}
+
+/*
+ * Page replacement policy. Every allocated (reclaimable) page is handed
+ * to the policy, which orders the pages on pd_plink and tells pageoutd
+ * which one to reclaim next. Pinned pages are never on a policy queue.
+ *
+ * The policy is chosen at build time with PFRAME_POLICY in Config.mk and
+ * may be changed while running with the 'pframe policy' kshell command.
+ * pp_init() is given the number of frames that were free at boot.
+ */
+typedef struct pframe_policy {
+        const char     *pp_name;
+        void          (*pp_init)(uint32_t npages);
+        void          (*pp_fini)(void);
+        /* pf became reclaimable; isnew if it was just allocated */
+        void          (*pp_insert)(pframe_t *pf, int isnew);
+        /* pf is being pinned or freed */
+        void          (*pp_remove)(pframe_t *pf);
+        /* reclaimable pf was requested again */
+        void          (*pp_touch)(pframe_t *pf);
+        /* pf is about to be reclaimed by the pager (optional) */
+        void          (*pp_evict)(pframe_t *pf);
+        /* next page to reclaim, or NULL if there are none */
+        pframe_t     *(*pp_victim)(void);
+
+        /* pframe_get() statistics since the policy was selected */
+        uint32_t        pp_hits;
+        uint32_t        pp_misses;
+} pframe_policy_t;
+
+/* The policies, in mm/pfpolicy.c */
+extern pframe_policy_t pframe_policies[];
+extern const uint32_t pframe_npolicies;
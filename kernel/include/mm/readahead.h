@@ -0,0 +1,26 @@
+#pragma once
+
+#include "types.h"
+
+struct mmobj;
+
+/*
+ * Sequential read-ahead.
+ *
+ * A read-ahead stream is identified by an opaque key: the file_t of a
+ * read(2) caller or the vmarea of a faulting mapping. Callers report
+ * every access with readahead_access(): read(2) before it looks the
+ * pages up, a fault once the page it wanted is mapped; either says
+ * whether the first page was resident before it was looked up, so that
+ * pages read ahead are counted as hits only if they were there in time.
+ * Once a stream is
+ * seen to be sequential the pages following the access are brought into
+ * the page cache in a window that doubles on every sequential step, up
+ * to readahead_max pages.
+ */
+
+void readahead_access(const void *key, struct mmobj *obj, uint32_t pagenum,
+                      uint32_t npages, uint32_t limit, int resident);
+void readahead_forget(const void *key);
+void readahead_range(struct mmobj *obj, uint32_t start, uint32_t end);
+void readahead_sequential(struct mmobj *obj, uint32_t pagenum, uint32_t limit);
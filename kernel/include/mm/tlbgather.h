@@ -0,0 +1,38 @@
+#pragma once
+
+#include "types.h"
+
+struct pagedir;
+
+/*
+ * Batched TLB invalidation.
+ *
+ * An operation that unmaps or remaps user pages records each range it
+ * changed in a tlb_gather_t and calls tlb_gather_finish() once it is
+ * done. Only ranges of the page directory that is loaded at the time
+ * count: any other address space gets a fresh TLB when %cr3 is next
+ * loaded with it. If the ranges add up to a few pages they are
+ * invalidated one page at a time with invlpg; past TLB_GATHER_MAX_PAGES
+ * pages, or too many separate ranges, the whole TLB is flushed instead,
+ * which is cheaper than invalidating that many entries one by one.
+ */
+
+#define TLB_GATHER_NRANGES      8
+#define TLB_GATHER_MAX_PAGES    32
+
+typedef struct tlb_gather {
+        uint32_t        tg_npages;      /* pages in tg_ranges */
+        uint32_t        tg_nranges;
+        int             tg_all;         /* flush the whole TLB */
+        struct {
+                uintptr_t       tr_low;
+                uintptr_t       tr_high;
+        } tg_ranges[TLB_GATHER_NRANGES];
+} tlb_gather_t;
+
+void tlb_gather_init(tlb_gather_t *tg);
+void tlb_gather_range(tlb_gather_t *tg, struct pagedir *pd, uintptr_t vlow, uintptr_t vhigh);
+void tlb_gather_finish(tlb_gather_t *tg);
+
+#define tlb_gather_page(tg, pd, vaddr) \
+        tlb_gather_range((tg), (pd), (vaddr), (uintptr_t)(vaddr) + PAGE_SIZE)
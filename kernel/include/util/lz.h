@@ -0,0 +1,19 @@
+#pragma once
+
+#include "types.h"
+
+/*
+ * A small LZ77 compressor in the format of LZF: a stream of literal runs
+ * (control byte 0-31, followed by that many plus one bytes) and back
+ * references (top 3 bits of the control byte the length minus 2, 7
+ * meaning an extra length byte follows, and 13 bits of offset minus 1).
+ * It trades ratio for speed: one hash probe per input position, no lazy
+ * matching. Inputs must be shorter than 64 KB.
+ *
+ * Both functions return the number of bytes written to out, or 0 if the
+ * result does not fit in outlen bytes (or, for lz_decompress(), if in is
+ * not a valid stream).
+ */
+
+uint32_t lz_compress(const void *in, uint32_t inlen, void *out, uint32_t outlen);
+uint32_t lz_decompress(const void *in, uint32_t inlen, void *out, uint32_t outlen);
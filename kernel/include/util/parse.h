@@ -0,0 +1,13 @@
+#pragma once
+
+#include "types.h"
+
+/*
+ * Parses an unsigned number, decimal or hexadecimal with a leading "0x",
+ * as typed at the kernel shell. The whole string must be digits of the
+ * base. On success the number is stored in *val and 0 is returned;
+ * otherwise *val is left alone and -EINVAL is returned, or -ERANGE if
+ * the number does not fit in 32 bits.
+ */
+
+int parse_uint(const char *str, uint32_t *val);
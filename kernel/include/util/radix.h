@@ -0,0 +1,44 @@
+#pragma once
+
+#include "types.h"
+
+/*
+ * Radix tree mapping 32-bit indices to pointers.
+ *
+ * Every interior node has RADIX_SLOTS children, so a tree of height h
+ * covers indices [0, RADIX_SLOTS^h); the tree grows taller as larger
+ * indices are inserted. Each entry can carry up to RADIX_NTAGS tag bits.
+ * Interior nodes keep, per tag, a bitmap of the children below which
+ * some entry has that tag, so that tagged lookups skip untagged subtrees.
+ *
+ * The tree does no locking; callers serialize access.
+ */
+
+#define RADIX_SHIFT     6
+#define RADIX_SLOTS     (1 << RADIX_SHIFT)
+#define RADIX_NTAGS     2
+
+struct radix_node;
+
+typedef struct radix_tree {
+        struct radix_node *rt_root;
+        uint32_t           rt_height;   /* 0 if the tree is empty */
+} radix_tree_t;
+
+void  radix_init(void);
+
+void  radix_tree_init(radix_tree_t *rt);
+int   radix_insert(radix_tree_t *rt, uint32_t index, void *item);
+void *radix_lookup(radix_tree_t *rt, uint32_t index);
+void *radix_delete(radix_tree_t *rt, uint32_t index);
+
+void  radix_tag_set(radix_tree_t *rt, uint32_t index, int tag);
+void  radix_tag_clear(radix_tree_t *rt, uint32_t index, int tag);
+int   radix_tag_get(radix_tree_t *rt, uint32_t index, int tag);
+
+uint32_t radix_gang_lookup(radix_tree_t *rt, uint32_t first, uint32_t last,
+                           void **results, uint32_t max);
+uint32_t radix_gang_lookup_index(radix_tree_t *rt, uint32_t first, uint32_t last,
+                                 void **results, uint32_t *indices, uint32_t max);
+uint32_t radix_gang_lookup_tag(radix_tree_t *rt, uint32_t first, uint32_t last,
+                               void **results, uint32_t max, int tag);
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "types.h"
+
+/*
+ * The time stamp counter. There is no timer callout in the kernel, so
+ * this is the clock for anything that measures time: tsc_read() counts
+ * cycles, for benchmarks; tsc_ticks() counts ticks of 2^20 cycles
+ * (roughly a millisecond on current hardware), for ages and intervals
+ * that fit in 32 bits.
+ */
+
+static inline uint64_t
+tsc_read(void)
+{
+        uint32_t lo, hi;
+        __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+        return ((uint64_t) hi << 32) | lo;
+}
+
+static inline uint32_t
+tsc_ticks(void)
+{
+        return (uint32_t)(tsc_read() >> 20);
+}
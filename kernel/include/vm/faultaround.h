@@ -0,0 +1,26 @@
+#pragma once
+
+#include "types.h"
+
+struct vmarea;
+
+/*
+ * Fault-around.
+ *
+ * After a read fault has been resolved, the neighbours of the faulting
+ * page in a window around it are mapped too, as long as they are already
+ * resident and not busy, so that touching them later costs no fault.
+ * This is what makes a process that runs shared program text, whose
+ * pages other processes keep in the page cache, start up with a handful
+ * of faults instead of one per page. Neighbours are always mapped
+ * read-only: a write faults as before, which keeps copy-on-write and
+ * dirty tracking working.
+ *
+ * The window is faultaround_window pages by default and can be set for
+ * each vmarea; a window of 0 turns fault-around off.
+ */
+
+#define FAULTAROUND_MAX_WINDOW  64
+
+void faultaround(struct vmarea *vma, uintptr_t vaddr);
+int  faultaround_set_window(struct vmarea *vma, uint32_t npages);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "types.h"
+
+struct vmarea;
+struct vmmap;
+struct pagedir;
+
+/*
+ * 4 MB (PSE) mappings of anonymous memory.
+ *
+ * A fault anywhere in a 4 MB-aligned stretch of an anonymous vmarea that
+ * covers the whole stretch is served by backing the stretch with one
+ * physically contiguous run of page frames and mapping it with a single
+ * page directory entry. Every frame of the run is still an ordinary
+ * pinned pframe of the mapping's object, so the rest of the VM system
+ * does not know about large pages; it only has to get rid of the large
+ * mapping (hugepage_unmap_range()) before it unmaps any part of it. The
+ * pages are then faulted back in one at a time, or as a large page again
+ * if the whole run is still resident and the stretch still eligible.
+ */
+
+#define HUGEPAGE_SHIFT          22
+#define HUGEPAGE_SIZE           (1 << HUGEPAGE_SHIFT)
+#define HUGEPAGE_NPAGES         (HUGEPAGE_SIZE >> PAGE_SHIFT)
+
+/* hugepage_is_mapped() results */
+#define HUGEPAGE_MAPPED_SMALL   1
+#define HUGEPAGE_MAPPED_LARGE   2
+
+int  hugepage_fault(struct vmarea *vma, uintptr_t vaddr);
+void hugepage_unmap_range(struct pagedir *pd, uintptr_t vlow, uintptr_t vhigh);
+int  hugepage_align_range(struct vmmap *map, uint32_t npages);
+int  hugepage_is_mapped(struct pagedir *pd, uintptr_t vaddr);
+uint32_t *hugepage_pte(struct pagedir *pd, uintptr_t vaddr);
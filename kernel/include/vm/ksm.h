@@ -0,0 +1,33 @@
+#pragma once
+
+#include "types.h"
+#include "util/list.h"
+
+/*
+ * Same-page merging.
+ *
+ * ksmd walks physical memory a little at a time while the system is
+ * idle, looking at the pages of anon and shadow objects that nobody is
+ * using at the moment. Pages with identical contents are merged: one
+ * read-only frame is kept, each page is recorded in its object's swap
+ * index (see vm/swap.h) as a copy of that frame, and the pages
+ * themselves are freed. Read faults map the shared frame; a write
+ * faults in a private copy through the usual copy-on-write path. Pages
+ * of zeros are merged into the shared zero page.
+ *
+ * ksmd is off unless KSM is set in Config.mk or it is turned on with the
+ * 'ksm' kshell command.
+ */
+
+typedef struct ksm_page {
+        void            *kp_addr;       /* the shared frame */
+        uint32_t        kp_sum;         /* checksum of its contents */
+        uint32_t        kp_refcount;    /* pages merged into it */
+        list_link_t     kp_hlink;       /* on the stable table, by checksum */
+} ksm_page_t;
+
+void ksm_get(ksm_page_t *kp);
+void ksm_put(ksm_page_t *kp);
+
+void ksm_idle(void);
+void ksm_shutdown(void);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "types.h"
+
+#include "api/syscall_ext.h"
+
+struct vmarea;
+
+/*
+ * madvise(2): hints about how a range of memory will be used.
+ *
+ * MADV_NORMAL, MADV_RANDOM and MADV_SEQUENTIAL describe the access
+ * pattern and are remembered for every vmarea the range touches (for the
+ * whole area; areas are not split, and the areas fork() or munmap() make
+ * start out normal): faults on a random area neither read ahead nor map
+ * neighbouring pages, faults on a sequential one always read ahead the
+ * largest window.
+ *
+ * The others act at once on the range:
+ *  - MADV_WILLNEED starts the fills of the file pages it covers.
+ *  - MADV_DONTNEED unmaps it and drops the pages that private mappings
+ *    hold in it, resident or swapped out. The next access sees what the
+ *    mapping showed before those pages were written: the file, or for
+ *    anonymous memory, zeros, also where it was inherited from a parent
+ *    (such pages get a zero-filled copy of their own at once).
+ *  - MADV_FREE is the lazy MADV_DONTNEED of private anonymous memory: the
+ *    pages are unmapped and marked clean but stay resident, to be
+ *    reclaimed first when memory runs short. A write to a page before
+ *    then keeps it, with whatever contents it had. Pages inherited from
+ *    a parent are dropped and zero-filled at once, as by MADV_DONTNEED.
+ * Both fail with EINVAL on memory locked with mlock(2).
+ */
+
+int  do_madvise(void *addr, size_t len, int advice);
+int  madvise_advice(struct vmarea *vma);
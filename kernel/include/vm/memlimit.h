@@ -0,0 +1,42 @@
+#pragma once
+
+#include "types.h"
+
+struct proc;
+struct vmmap;
+
+/*
+ * Per-process memory limits.
+ *
+ * Every process carries a resident limit (page frames charged to it by
+ * pframe_alloc()), an address-space limit (pages covered by its
+ * vmareas) and a locked-memory limit (frames it keeps pinned with
+ * mlock(2)). A limit of 0 means "unlimited". Children inherit the limits
+ * of their parent.
+ */
+
+/* Locked-memory limit of processes that inherit none, in pages */
+#define MEMLIMIT_DEFAULT_LOCKED 64
+
+void memlimit_init(void);
+
+void memlimit_proc_init(struct proc *p);
+void memlimit_proc_exit(struct proc *p);
+
+void memlimit_charge(pid_t pid);
+void memlimit_uncharge(pid_t pid);
+void memlimit_reclaimed(pid_t pid, uint32_t npages);
+
+int  memlimit_rss_exceeded(pid_t pid);
+int  memlimit_rss_unpinned_exceeded(pid_t pid, uint32_t npinned);
+int  memlimit_rss_room(pid_t pid, uint32_t npages);
+int  memlimit_vsize_check(struct proc *p, uint32_t npages);
+uint32_t memlimit_vsize(struct vmmap *map);
+
+int  memlimit_locked_charge(pid_t pid, uint32_t npages);
+void memlimit_locked_uncharge(pid_t pid, uint32_t npages);
+int  memlimit_lockall(pid_t pid);
+void memlimit_set_lockall(pid_t pid, int flags);
+
+int  memlimit_set(pid_t pid, uint32_t rss_max, uint32_t vsize_max, uint32_t locked_max);
+void memlimit_info(const struct proc *p, char **buf, size_t *size);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "types.h"
+
+#include "api/syscall_ext.h"
+
+struct vmarea;
+struct vmmap;
+struct pframe;
+
+/*
+ * mlock(2), munlock(2), mlockall(2) and munlockall(2): memory that stays
+ * resident.
+ *
+ * Locking a range faults in every page of it (for writing if the area is
+ * writable, so that a private mapping gets its own copies right away)
+ * and pins the frames with pframe_pin(), so that neither pageoutd nor
+ * the resident limit can take them back. The pins are remembered per
+ * vmarea: when a later fault replaces a locked page, as a write to a
+ * copy-on-write page does, the new frame is pinned instead of the old
+ * one. An area locked as a whole (by mlockall(MCL_CURRENT), or by an
+ * mlock() covering all of it) also pins the pages it grows by or that
+ * are faulted in later.
+ *
+ * mlockall(MCL_FUTURE) locks the areas mmap(2) and brk(2) make from then
+ * on. Locks are neither inherited by fork() nor kept by munmap().
+ *
+ * Every locked page counts against the locked-memory limit of the
+ * process (see vm/memlimit.h), and all processes together may lock no
+ * more than a quarter of memory, so that pageoutd always has frames it
+ * can reclaim. A page that would go over either is faulted in, but not
+ * locked.
+ */
+
+int  do_mlock(void *addr, size_t len);
+int  do_munlock(void *addr, size_t len);
+int  do_mlockall(int flags);
+int  do_munlockall(void);
+
+int  mlock_future(struct vmarea *vma);
+int  mlock_is_locked(struct vmarea *vma, uint32_t vfn, uint32_t end);
+void mlock_fault(struct vmarea *vma, uint32_t pagenum, struct pframe *pf);
+void mlock_unmap(struct vmmap *map, uint32_t lopage, uint32_t npages);
+void mlock_split(struct vmarea *vma, struct vmarea *newvma);
+void mlock_forget(struct vmarea *vma);
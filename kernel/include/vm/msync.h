@@ -0,0 +1,20 @@
+#pragma once
+
+#include "types.h"
+
+#include "api/syscall_ext.h"
+
+/*
+ * msync(2): write back what a process wrote through its shared file
+ * mappings.
+ *
+ * Only the dirty pages of the range are written, so that syncing a
+ * record costs as many page writes as the record spans, not a sync(2)
+ * of the whole cache. With MS_SYNC the call returns once they are on
+ * disk; with MS_ASYNC pflushd is told to write them next. Private
+ * mappings never write to their file, so there is nothing to do for
+ * them. MS_INVALIDATE is accepted, but all shared mappings of a file
+ * map its cached pages themselves, so they never hold stale copies.
+ */
+
+int do_msync(void *addr, size_t len, int flags);
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "types.h"
+
+#include "api/syscall_ext.h"
+
+/*
+ * Eager population of mappings.
+ *
+ * A mapping made with MAP_POPULATE, or heap grown with brk_populate(2),
+ * has all of its pages brought in and mapped before the system call
+ * returns, so that the process pays for the faults up front rather than
+ * whenever it first touches each page. File pages are all queued to the
+ * page fill workers before the first one is waited for. Writable
+ * private mappings are populated for writing, so that they get their own
+ * copies right away; everything else is mapped for reading, as a shared
+ * mapping that nothing was written through must not dirty its pages (or
+ * make the file system allocate blocks for its holes). Read-only
+ * anonymous memory is mapped to the zero page.
+ * Population stops quietly at the process's resident limit or when memory
+ * runs out: the rest of the range is faulted in as usual.
+ */
+
+int populate_range(uint32_t lopage, uint32_t npages);
+int do_brk_populate(void *addr, void **ret);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "types.h"
+
+struct vmarea;
+struct mmobj;
+
+/*
+ * Reverse map: which vmareas map a given page of an object.
+ *
+ * Every vmarea on its bottom object's mmo_vmas list is also entered in an
+ * interval tree kept for that bottom object, keyed by the range of object
+ * pages [vma_off, vma_off + npages) the area maps. Finding the mappers of
+ * one page then costs O(log n + k) for n areas on the object of which k
+ * cover the page, instead of a walk of the whole list. The tree lives
+ * beside the list, so whoever links an area to or unlinks it from its
+ * object, or moves its range while it is linked, must tell the rmap too.
+ * The memory for an area's entry is allocated with the area by
+ * vmarea_alloc(), so indexing it never fails.
+ */
+
+typedef void (*rmap_func_t)(struct vmarea *vma, uint32_t pagenum, void *arg);
+
+int      rmap_prepare(struct vmarea *vma);
+void     rmap_release(struct vmarea *vma);
+void     rmap_add(struct vmarea *vma);
+void     rmap_update(struct vmarea *vma);
+void     rmap_remove(struct vmarea *vma);
+uint32_t rmap_foreach(struct mmobj *o, uint32_t pagenum, rmap_func_t func, void *arg);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "types.h"
+
+struct mmobj;
+struct pframe;
+struct ksm_page;
+
+/*
+ * Swap space for anonymous and shadow objects.
+ *
+ * When pageoutd cleans a dirty page of an anon or shadow object, the page
+ * is compressed into zram (see vm/zram.h) or, if it does not compress or
+ * zram is full, written to a page-sized slot of the swap disk, which is
+ * the last disk when there is more than one. Either way the copy is
+ * remembered under the page's (object, page number), and the next fill
+ * of the page reads it back. A page read back keeps its copy until it is
+ * dirtied again, so a clean page can be dropped without another write.
+ *
+ * ksmd (see vm/ksm.h) uses the same index to record that a page was
+ * merged into a frame shared by identical pages: the page is "swapped
+ * in" by copying that frame, and read faults map the frame itself.
+ *
+ * With neither zram nor a swap disk these pages stay pinned from fill
+ * time on, as they always have been.
+ */
+
+int  swap_enabled(void);
+int  swap_fill_pins(void);
+
+int  swap_out(struct mmobj *o, struct pframe *pf);
+int  swap_in(struct mmobj *o, struct pframe *pf);
+int  swap_has(struct mmobj *o, uint32_t pagenum);
+int  swap_has_range(struct mmobj *o, uint32_t first, uint32_t last);
+int  swap_merge(struct mmobj *o, uint32_t pagenum, struct ksm_page *kp);
+void *swap_merged_page(struct mmobj *o, uint32_t pagenum);
+void swap_discard(struct mmobj *o, uint32_t pagenum);
+void swap_release_obj(struct mmobj *o);
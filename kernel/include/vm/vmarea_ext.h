@@ -0,0 +1,39 @@
+#pragma once
+
+#include "types.h"
+
+#include "util/list.h"
+#include "util/radix.h"
+
+struct vmarea;
+
+/*
+ * What the VM keeps about a vmarea beyond the vmarea_t itself: the
+ * access pattern given with madvise(2) (vm/madvise.h), the fault-around
+ * window (vm/faultaround.h) and the pages locked with mlock(2)
+ * (vm/mlock.h). vmarea_alloc() makes the record of an area, so every
+ * area has one, and vmarea_free() unlocks its pages and drops it.
+ */
+
+/* vx_fa_window of an area that uses the default window */
+#define VMAREA_FA_DEFAULT       ((uint32_t) -1)
+
+typedef struct vmarea_ext {
+        const struct vmarea *vx_vma;
+        list_link_t     vx_hlink;
+
+        int             vx_advice;      /* MADV_NORMAL, MADV_RANDOM or MADV_SEQUENTIAL */
+        uint32_t        vx_fa_window;   /* pages, or VMAREA_FA_DEFAULT */
+
+        /* Locked pages are keyed by their page number in the area's
+         * object, which unlike their address stays the same when the
+         * area is trimmed. */
+        pid_t           vx_lock_pid;    /* process the pins are charged to */
+        int             vx_lock_all;    /* pages faulted in later are locked too */
+        uint32_t        vx_nlocked;     /* frames pinned */
+        radix_tree_t    vx_locked;      /* object page number -> pinned frame */
+} vmarea_ext_t;
+
+int           vmarea_ext_create(struct vmarea *vma);
+vmarea_ext_t *vmarea_ext(const struct vmarea *vma);
+void          vmarea_ext_destroy(struct vmarea *vma);
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "types.h"
+
+struct vmarea;
+
+/*
+ * The shared zero page.
+ *
+ * A read fault on anonymous memory that has never been written (no page
+ * anywhere down the mapping's shadow chain, nor in swap) maps one global
+ * page of zeros read-only instead of allocating and zeroing a frame. The
+ * first write faults again and gets a page of its own the usual way.
+ * Whoever makes an anonymous page resident calls pframe_remove_from_pts()
+ * on it, so that processes sharing the object stop seeing the zero page.
+ *
+ * Pages that ksmd merged into a shared frame (vm/ksm.h) are mapped the
+ * same way: a read fault maps the shared frame read-only.
+ */
+
+void *zeropage_page(void);
+int   zeropage_fault(struct vmarea *vma, uintptr_t vaddr);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "types.h"
+
+/*
+ * Compressed in-memory store for swapped-out anonymous pages.
+ *
+ * swap_out() offers every page to zram first; a page that compresses
+ * well enough is kept here, in slab objects of a few size classes,
+ * instead of going to the swap disk. zram works without a swap disk, in
+ * which case pages that do not compress stay pinned.
+ *
+ * zram is off unless ZRAM is set in Config.mk or it is turned on with the
+ * 'zram' kshell command, since it makes swap_enabled() true and with it
+ * changes how all anonymous memory is treated.
+ */
+
+typedef struct zram_entry {
+        uint32_t        ze_pagenum;     /* page number of the owner's page */
+        uint16_t        ze_len;         /* compressed length */
+        uint16_t        ze_class;       /* size class of this object */
+        uint8_t         ze_data[0];
+} zram_entry_t;
+
+int  zram_enabled(void);
+
+zram_entry_t *zram_store(const void *page, uint32_t pagenum);
+int  zram_load(zram_entry_t *ze, void *page);
+void zram_free(zram_entry_t *ze);
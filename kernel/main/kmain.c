@@ -13,6 +13,7 @@
 #include "mm/page.h"
 #include "mm/pagetable.h"
 #include "mm/pframe.h"
+#include "mm/pframe_ext.h"
 
 #include "vm/vmmap.h"
 #include "vm/shadowd.h"
@@ -150,6 +151,9 @@ idleproc_run(int arg1, void *arg2)
          * are enabled AFTER all drivers are initialized) */
         intr_enable();
 
+        /* Have zeroed pages ready for init's first faults */
+        pframe_zero_refill((uint32_t) -1);
+
         /* Run initproc */
         sched_make_runnable(initthr);
         /* Now wait for it */
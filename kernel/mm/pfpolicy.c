@@ -0,0 +1,298 @@
+#include "kernel.h"
+#include "globals.h"
+
+#include "util/debug.h"
+#include "util/list.h"
+
+#include "mm/mmobj.h"
+#include "mm/page.h"
+#include "mm/slab.h"
+#include "mm/pframe.h"
+#include "mm/pframe_int.h"
+
+/*
+ * Page replacement policies: LRU, CLOCK and 2Q. mm/pframe.c hands them
+ * the reclaimable pages through the pframe_policy_t interface (see
+ * mm/pframe_int.h) and asks the current one for pageoutd's victims.
+ */
+
+/*
+ * LRU: pages are kept in least-recently-requested order and every
+ * request moves the page to the back of the queue.
+ */
+static list_t lru_list;
+
+static void
+lru_init(uint32_t npages)
+{
+        list_init(&lru_list);
+}
+
+static void
+lru_insert(pframe_t *pf, int isnew)
+{
+        list_insert_tail(&lru_list, &pframe_desc(pf)->pd_plink);
+}
+
+static void
+lru_remove(pframe_t *pf)
+{
+        list_remove(&pframe_desc(pf)->pd_plink);
+}
+
+static void
+lru_touch(pframe_t *pf)
+{
+        list_remove(&pframe_desc(pf)->pd_plink);
+        list_insert_tail(&lru_list, &pframe_desc(pf)->pd_plink);
+}
+
+static pframe_t *
+lru_victim(void)
+{
+        if (list_empty(&lru_list))
+                return NULL;
+        return &list_head(&lru_list, pframe_desc_t, pd_plink)->pd_pframe;
+}
+
+/*
+ * CLOCK: pages sit on a ring swept by a hand. A request only sets the
+ * page's reference bit, so hits never touch the queue; the hand clears
+ * reference bits as it passes and stops at the first page without one.
+ */
+static list_t clock_list;
+static list_link_t *clock_hand;         /* next page to look at */
+
+static void
+clock_init(uint32_t npages)
+{
+        list_init(&clock_list);
+        clock_hand = &clock_list;
+}
+
+static void
+clock_insert(pframe_t *pf, int isnew)
+{
+        /* just behind the hand, so it is looked at last */
+        pframe_desc(pf)->pd_ref = 1;
+        list_insert_before(clock_hand, &pframe_desc(pf)->pd_plink);
+}
+
+static void
+clock_remove(pframe_t *pf)
+{
+        list_link_t *link = &pframe_desc(pf)->pd_plink;
+        if (clock_hand == link)
+                clock_hand = link->l_next;
+        list_remove(link);
+}
+
+static void
+clock_touch(pframe_t *pf)
+{
+        pframe_desc(pf)->pd_ref = 1;
+}
+
+static pframe_t *
+clock_victim(void)
+{
+        pframe_desc_t *pd;
+
+        if (list_empty(&clock_list))
+                return NULL;
+        /* terminates within two sweeps of the ring */
+        while (1) {
+                if (clock_hand == &clock_list)
+                        clock_hand = clock_hand->l_next;
+                pd = pframe_plink_desc(clock_hand);
+                if (!pd->pd_ref)
+                        return &pd->pd_pframe;
+                pd->pd_ref = 0;
+                clock_hand = clock_hand->l_next;
+        }
+}
+
+/*
+ * 2Q (Johnson and Shasha, "2Q: A Low Overhead High Performance Buffer
+ * Management Replacement Algorithm"). New pages enter the A1in FIFO. When
+ * a page is reclaimed from A1in its identity is remembered on the A1out
+ * ghost queue; if it is faulted in again while still remembered, it goes
+ * straight to Am, an LRU queue of pages that have proven to be reused.
+ * Pages that are only ever touched once (a sequential scan) therefore
+ * cannot push the working set out of Am.
+ */
+#define TWOQ_A1IN       0
+#define TWOQ_AM         1
+
+#define TWOQ_GHOST_LOAD 2               /* target ghosts per bucket */
+
+typedef struct twoq_ghost {
+        mmobj_t        *g_obj;          /* identity only, never dereferenced */
+        uint32_t        g_pagenum;
+        list_link_t     g_link;         /* on twoq_a1out */
+        list_link_t     g_hlink;        /* on a twoq_ghosts chain */
+} twoq_ghost_t;
+
+static list_t twoq_a1in;
+static list_t twoq_am;
+static list_t twoq_a1out;
+static uint32_t twoq_na1in;
+static uint32_t twoq_na1out;
+static uint32_t twoq_kin;               /* target size of A1in */
+static uint32_t twoq_kout;              /* maximum size of A1out */
+
+static list_t *twoq_ghosts = NULL;
+static uint32_t twoq_ghosts_size;
+static slab_allocator_t *twoq_ghost_allocator = NULL;
+
+#define twoq_ghost_chain(obj, pagenum) \
+        (&twoq_ghosts[pframe_key((obj), (pagenum)) & (twoq_ghosts_size - 1)])
+
+static void
+twoq_init(uint32_t npages)
+{
+        uint32_t i;
+
+        list_init(&twoq_a1in);
+        list_init(&twoq_am);
+        list_init(&twoq_a1out);
+        twoq_na1in = 0;
+        twoq_na1out = 0;
+        twoq_kin = npages / 4;
+        twoq_kout = npages / 2;
+
+        if (NULL == twoq_ghost_allocator) {
+                twoq_ghost_allocator = slab_allocator_create("2q_ghost", sizeof(twoq_ghost_t));
+                KASSERT(NULL != twoq_ghost_allocator);
+        }
+        if (NULL == twoq_ghosts) {
+                for (twoq_ghosts_size = 1; twoq_ghosts_size < twoq_kout / TWOQ_GHOST_LOAD;
+                     twoq_ghosts_size <<= 1)
+                        ;
+                twoq_ghosts = page_alloc_n((twoq_ghosts_size * sizeof(list_t) + PAGE_SIZE - 1)
+                                           >> PAGE_SHIFT);
+                if (NULL == twoq_ghosts) {
+                        /* work without a ghost queue; this degrades to FIFO + LRU */
+                        dbg(DBG_PFRAME, "WARNING: no memory for the 2Q ghost table\n");
+                        twoq_kout = 0;
+                        return;
+                }
+        }
+        for (i = 0; i < twoq_ghosts_size; ++i)
+                list_init(&twoq_ghosts[i]);
+}
+
+static void
+twoq_ghost_free(twoq_ghost_t *g)
+{
+        list_remove(&g->g_link);
+        list_remove(&g->g_hlink);
+        twoq_na1out--;
+        slab_obj_free(twoq_ghost_allocator, g);
+}
+
+static void
+twoq_fini(void)
+{
+        while (!list_empty(&twoq_a1out))
+                twoq_ghost_free(list_head(&twoq_a1out, twoq_ghost_t, g_link));
+}
+
+static twoq_ghost_t *
+twoq_ghost_lookup(mmobj_t *obj, uint32_t pagenum)
+{
+        twoq_ghost_t *g;
+
+        if (0 == twoq_kout)
+                return NULL;
+        list_iterate_begin(twoq_ghost_chain(obj, pagenum), g, twoq_ghost_t, g_hlink) {
+                if (g->g_obj == obj && g->g_pagenum == pagenum)
+                        return g;
+        } list_iterate_end();
+        return NULL;
+}
+
+static void
+twoq_insert(pframe_t *pf, int isnew)
+{
+        pframe_desc_t *pd = pframe_desc(pf);
+        twoq_ghost_t *g;
+
+        if (isnew) {
+                pd->pd_queue = TWOQ_A1IN;
+                if (NULL != (g = twoq_ghost_lookup(pf->pf_obj, pf->pf_pagenum))) {
+                        twoq_ghost_free(g);
+                        pd->pd_queue = TWOQ_AM;
+                }
+        }
+
+        if (TWOQ_AM == pd->pd_queue) {
+                list_insert_tail(&twoq_am, &pd->pd_plink);
+        } else {
+                list_insert_tail(&twoq_a1in, &pd->pd_plink);
+                twoq_na1in++;
+        }
+}
+
+static void
+twoq_remove(pframe_t *pf)
+{
+        pframe_desc_t *pd = pframe_desc(pf);
+
+        list_remove(&pd->pd_plink);
+        if (TWOQ_A1IN == pd->pd_queue)
+                twoq_na1in--;
+}
+
+static void
+twoq_touch(pframe_t *pf)
+{
+        pframe_desc_t *pd = pframe_desc(pf);
+
+        /* a hit in A1in is deliberately ignored: it is most likely the
+         * same burst of accesses that brought the page in */
+        if (TWOQ_AM == pd->pd_queue) {
+                list_remove(&pd->pd_plink);
+                list_insert_tail(&twoq_am, &pd->pd_plink);
+        }
+}
+
+static void
+twoq_evict(pframe_t *pf)
+{
+        twoq_ghost_t *g;
+
+        if (TWOQ_A1IN != pframe_desc(pf)->pd_queue || 0 == twoq_kout)
+                return;
+        if (twoq_na1out >= twoq_kout)
+                twoq_ghost_free(list_head(&twoq_a1out, twoq_ghost_t, g_link));
+        if (NULL == (g = slab_obj_alloc(twoq_ghost_allocator)))
+                return;
+
+        g->g_obj = pf->pf_obj;
+        g->g_pagenum = pf->pf_pagenum;
+        list_insert_tail(&twoq_a1out, &g->g_link);
+        list_insert_head(twoq_ghost_chain(g->g_obj, g->g_pagenum), &g->g_hlink);
+        twoq_na1out++;
+}
+
+static pframe_t *
+twoq_victim(void)
+{
+        list_t *q;
+
+        if ((twoq_na1in > twoq_kin && !list_empty(&twoq_a1in)) || list_empty(&twoq_am))
+                q = &twoq_a1in;
+        else
+                q = &twoq_am;
+        if (list_empty(q))
+                return NULL;
+        return &list_head(q, pframe_desc_t, pd_plink)->pd_pframe;
+}
+
+pframe_policy_t pframe_policies[] = {
+        { "lru", lru_init, NULL, lru_insert, lru_remove, lru_touch, NULL, lru_victim, 0, 0 },
+        { "clock", clock_init, NULL, clock_insert, clock_remove, clock_touch, NULL, clock_victim, 0, 0 },
+        { "2q", twoq_init, twoq_fini, twoq_insert, twoq_remove, twoq_touch, twoq_evict, twoq_victim, 0, 0 },
+};
+const uint32_t pframe_npolicies = sizeof(pframe_policies) / sizeof(pframe_policies[0]);
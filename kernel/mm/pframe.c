@@ -1,3 +1,4 @@
+#include "kernel.h"
 #include "globals.h"
 #include "config.h"
 #include "errno.h"
@@ -6,16 +7,34 @@
 
 #include "util/debug.h"
 #include "util/string.h"
+#include "util/printf.h"
+#include "util/init.h"
+#include "util/radix.h"
+#include "util/parse.h"
+#include "util/tsc.h"
 
+#include "mm/mman.h"
 #include "mm/mmobj.h"
 #include "mm/page.h"
 #include "mm/slab.h"
 #include "mm/kmalloc.h"
 #include "mm/pframe.h"
+#include "mm/pframe_ext.h"
+#include "mm/pframe_int.h"
 #include "mm/tlb.h"
+#include "mm/tlbgather.h"
 #include "mm/pagetable.h"
+#include "mm/fileobj.h"
 
 #include "vm/vmmap.h"
+#include "vm/memlimit.h"
+#include "vm/hugepage.h"
+#include "vm/ksm.h"
+#include "vm/rmap.h"
+#include "vm/swap.h"
+
+#include "test/kshell/kshell.h"
+#include "test/kshell/io.h"
 
 /*
  * In this file, physical pages (as represented by pframes) will be
@@ -29,10 +48,9 @@
  *     - (3) pinned
  *
  * (1) Free pages do not contain identifiable data and are readily
- *     available for use. They are not pre-zeroed (at the moment, at least
- *     (but often times, OSs will have their equivalent of Weenix's
- *     idleproc (or another thread/process dedicated to this purpose) zero
- *     unzeroed pages on the free list when the system is otherwise idle)).
+ *     available for use. They are not pre-zeroed, but the idle loop keeps
+ *     a small pool of zeroed free pages aside for anonymous memory (see
+ *     "PRE-ZEROED PAGES" below).
  *
  * (2) Allocated pages contain identifiable data.
  *
@@ -52,14 +70,14 @@
  * When a page is allocated or pinned:
  *     - pf_link links the page into allocated_list or pinned_list,
  *       respectively
- *     - pf_hlink links the page into the appropriate hash chain of the
- *       resident page hashtable
+ *     - the page is entered in its mmobj's resident page index (see
+ *       pframe_obj_t below) under its page number
  *     - pf_olink links the page into the appropriate mmobj's list of
  *       resident pages
  *
  * When a page is free:
  *     - pf_link links the page into free_list
- *     - pf_hlink does not link the page into any list
+ *     - the page is not in any resident page index
  *     - pf_olink does not link the page into any list
  */
 
@@ -75,21 +93,226 @@ static int npinned;
 static list_t pinned_list;
 
 /*     The ALLOCATED list: */
-/*       Pages on this list contain useful/actual/real data. This list is
- *       maintained in least-recently-requested (via pframe_get or
- *       pframe_get_resident) (and thus, *roughly/approximately* LRU) order.
+/*       Pages on this list contain useful/actual/real data. The list itself
+ *       is kept in the order in which pages became reclaimable; the order in
+ *       which they are reclaimed is up to the replacement policy (see
+ *       mm/pfpolicy.c), which threads the same pages onto its own queues.
  */
 static int nallocated;
 static list_t alloc_list;
 
-static slab_allocator_t *pframe_allocator;
+/*
+ * Every physical frame has its descriptor at a fixed place, found from
+ * the frame number, so caching a page allocates nothing but the frame
+ * and the descriptors of neighbouring frames are neighbours in memory.
+ * The table is kept in chunks of PFRAME_CHUNK_PAGES pages, so that it
+ * needs no large contiguous allocation and frames that are never handed
+ * out cost no descriptors. pframe_init() sets up the chunk of every frame
+ * that is free at the time; a chunk is only allocated later for a frame
+ * that was in other use until then.
+ */
+#define PFRAME_CHUNK_PAGES      4
+#define PFRAME_CHUNK_NDESCS     ((PFRAME_CHUNK_PAGES * PAGE_SIZE) / sizeof(pframe_desc_t))
+#define PFRAME_MAX_PFN          (1 << (32 - PAGE_SHIFT))
+#define PFRAME_NCHUNKS          ((PFRAME_MAX_PFN + PFRAME_CHUNK_NDESCS - 1) / PFRAME_CHUNK_NDESCS)
+#define PFRAME_CHUNK_WANTED     ((pframe_desc_t *) 1)   /* only during pframe_init() */
+
+static pframe_desc_t *pframe_chunks[PFRAME_NCHUNKS];
+static uint32_t pframe_nchunks;
+
+#define pframe_pfn(addr)        (pt_virt_to_phys((uintptr_t)(addr)) >> PAGE_SHIFT)
+
+/*
+ * Threads waiting for a busy page sleep on one of a small table of wait
+ * queues, hashed by descriptor, rather than on pf_waitq: almost no page
+ * ever has a waiter. Pages that share a queue wake each other's
+ * waiters, so everyone who sleeps here re-checks their page on wakeup.
+ */
+#define PF_NWAITQS              64
+static ktqueue_t pframe_waitqs[PF_NWAITQS];
+
+#define pframe_waitq(pf) \
+        (&pframe_waitqs[((uintptr_t) pframe_desc(pf) / sizeof(pframe_desc_t)) % PF_NWAITQS])
+
+#ifdef __PFRAME_POLICY__
+#define PFRAME_POLICY_STR_(p)   #p
+#define PFRAME_POLICY_STR(p)    PFRAME_POLICY_STR_(p)
+#define PFRAME_POLICY_DEFAULT   PFRAME_POLICY_STR(__PFRAME_POLICY__)
+#else
+#define PFRAME_POLICY_DEFAULT   "lru"
+#endif
+
+static pframe_policy_t *pframe_policy = NULL;
+static int pframe_policy_select(const char *name);
+
+/* number of page frames that were free at pframe_init() */
+static uint32_t pframe_npages;
+
+/*
+ * The DIRTY list: every dirty page that is not pinned (and could thus be
+ * written back right now), oldest first. pflushd works from its head.
+ */
+static uint32_t ndirty;
+static list_t dirty_list;
+
+/*
+ * The PINNED DIRTY list: dirty file pages that are pinned, by mlock(2)
+ * mostly, oldest first. pageout cannot take them, but sync(2), fsync(2)
+ * and pflushd write them back all the same (see pframe_clean_pinned()).
+ */
+static uint32_t npinned_dirty;
+static list_t pinned_dirty_list;
+
+/*
+ * The LAZYFREE list: clean, unpinned pages whose owner said it no longer
+ * needs their contents (madvise(MADV_FREE)) but that were left in place
+ * in case memory never runs short. They are the first pages pageoutd
+ * reclaims, and pframe_get() takes them itself rather than wait for
+ * pageoutd. Dirtying or pinning such a page takes it off the list.
+ */
+static uint32_t nlazyfree;
+static list_t lazyfree_list;
+
+/*
+ * The WMAPPED list: clean file pages that some process still maps
+ * writable. Writing back a file page does not unmap it; the dirty bits
+ * of its mappings are cleared instead, and the MMU sets them again on
+ * the next write, without a fault. Such writes are only seen when the
+ * dirty bits are harvested: from the idle loop every dirty_expire / 2
+ * ticks, and before the page is written back by sync(2), fsync(2) or
+ * msync(2), reclaimed or unmapped. A page found written is dirtied and
+ * leaves the list, as does one found mapped writable nowhere.
+ */
+static uint32_t nwmapped;
+static list_t wmapped_list;
+static uint32_t wmapped_scanned;        /* tsc_ticks() of the last full harvest */
+static uint32_t wmapped_nharvested;     /* writes found by harvesting */
+
+/*
+ * Per-object page cache state that the mmobj itself has no room for. A
+ * record exists for as long as its object has resident pages; records
+ * are hashed by object address in pframe_hash.
+ *
+ * po_pages indexes the object's resident pages by page number. Entries
+ * are tagged PF_TAG_DIRTY while the page is dirty and PF_TAG_BUSY while
+ * it is busy, so that range operations can find just those pages.
+ */
+typedef struct pframe_obj {
+        mmobj_t        *po_obj;
+        uint32_t        po_npages;      /* resident pages of po_obj */
+        list_t          po_dirty;       /* po_obj's part of dirty_list, oldest first */
+        uint32_t        po_ndirty;
+        radix_tree_t    po_pages;       /* pagenum --> pframe */
+        list_link_t     po_hlink;
+} pframe_obj_t;
+
+#define PF_TAG_DIRTY    0
+#define PF_TAG_BUSY     1
+
+static slab_allocator_t *pframe_obj_allocator;
+
+/* Used to quickly look up pframes. EVERY mmobj with resident pages has
+ * its record in this hash, and the record's radix tree holds the pages:
+ * object --> list of records, then pagenum --> pframe
+ *
+ * The table is sized from the number of physical pages at pframe_init()
+ * (always a power of two) and may be resized with pframe_hash_resize().
+ * mmobjs come out of slab allocators, so their addresses share their low
+ * bits; the key is therefore run through a full 32-bit mixing function
+ * (pframe_key(), in mm/pframe_int.h) before it is masked down to a
+ * bucket index. */
+#define PF_HASH_LOAD     2      /* target entries per bucket */
+#define PF_OBJ_PAGES     16     /* resident pages per object, for sizing */
+#define PF_HASH_MIN      64     /* buckets of the fallback table */
+#define PF_HASH_MAX      65536  /* most buckets of a resized table */
+static list_t *pframe_hash;
+static uint32_t pframe_hash_size;
+
+/* used if no table can be allocated at boot */
+static list_t pframe_hash_min[PF_HASH_MIN];
+
+/* lookup statistics, reported by pframe_info() */
+static uint32_t pframe_hash_lookups;
+static uint32_t pframe_hash_probes;
+static uint32_t pframe_hash_maxprobes;
+
+#define hash_obj(obj) (pframe_key((obj), 0) & (pframe_hash_size - 1))
+
+#define pframe_hash_chain(obj) (&pframe_hash[hash_obj(obj)])
+
+static void pframe_dirty_link(pframe_t *pf);
+static void pframe_dirty_unlink(pframe_t *pf);
+static void pframe_unmap_gather(pframe_t *pf, tlb_gather_t *tg);
+static void pframe_clean_mappings(pframe_t *pf, tlb_gather_t *tg);
+static void pframe_harvest_page(pframe_t *pf);
+static void pframe_harvest_list(mmobj_t *o);
+static void pframe_reclaim(pframe_t *pf);
+
+static pframe_obj_t *
+pframe_obj_lookup(mmobj_t *o)
+{
+        pframe_obj_t *po;
+        uint32_t nprobes = 0;
+
+        pframe_hash_lookups++;
+        list_iterate_begin(pframe_hash_chain(o), po, pframe_obj_t, po_hlink) {
+                nprobes++;
+                if (po->po_obj == o)
+                        goto done;
+        } list_iterate_end();
+        po = NULL;
+done:
+        pframe_hash_probes += nprobes;
+        if (nprobes > pframe_hash_maxprobes)
+                pframe_hash_maxprobes = nprobes;
+        return po;
+}
+
+/* Returns the record of o, creating it if need be, or NULL if out of memory. */
+static pframe_obj_t *
+pframe_obj_get(mmobj_t *o)
+{
+        pframe_obj_t *po;
+
+        if (NULL != (po = pframe_obj_lookup(o)))
+                return po;
+        if (NULL == (po = slab_obj_alloc(pframe_obj_allocator)))
+                return NULL;
+        po->po_obj = o;
+        po->po_npages = 0;
+        list_init(&po->po_dirty);
+        po->po_ndirty = 0;
+        radix_tree_init(&po->po_pages);
+        list_insert_head(pframe_hash_chain(o), &po->po_hlink);
+        return po;
+}
+
+/* Frees the record once its object has no resident pages left. */
+static void
+pframe_obj_release(pframe_obj_t *po)
+{
+        if (0 != po->po_npages)
+                return;
+        KASSERT(list_empty(&po->po_dirty) && 0 == po->po_ndirty);
+        KASSERT(0 == po->po_pages.rt_height);
+        list_remove(&po->po_hlink);
+        slab_obj_free(pframe_obj_allocator, po);
+}
+
+/* Set or clear the busy bit of a page along with its index tag. */
+static inline void
+pframe_busy(pframe_t *pf)
+{
+        pframe_set_busy(pf);
+        radix_tag_set(&pframe_desc(pf)->pd_pobj->po_pages, pf->pf_pagenum, PF_TAG_BUSY);
+}
 
-/* Used to quickly look up pframes. ALL pages "owned by" some
- * mmobj should be in this hash
- * (object, pagenum) --> list of pframes */
-#define hash_page(obj, pagenum)  ((((uint32_t)(obj)) + (pagenum)) \
-                                  % PF_HASH_SIZE)
-static list_t pframe_hash[PF_HASH_SIZE];
+static inline void
+pframe_unbusy(pframe_t *pf)
+{
+        pframe_clear_busy(pf);
+        radix_tag_clear(&pframe_desc(pf)->pd_pobj->po_pages, pf->pf_pagenum, PF_TAG_BUSY);
+}
 
 /* Related to the Pageout daemon: */
 
@@ -107,41 +330,387 @@ static ktqueue_t alloc_waitq;
 /* Pageout daemon functions */
 static void *pageoutd_run(int arg1, void *arg2);
 static void pageoutd_exit(void);
+static int pageoutd_clean_cluster(pframe_t *pf);
 #define pageoutd_wakeup()        (sched_broadcast_on(&pageoutd_waitq))
 #define pageoutd_needed()        \
         ((page_free_count() <= nfreepages_min) && (!list_empty(&alloc_list)))
 #define pageoutd_target_met()    (page_free_count() >= nfreepages_target)
 
+/* How far into alloc_list pageoutd looks for a page charged to a process
+ * that is over its resident limit before settling for the head */
+#define PAGEOUTD_OWNER_SCAN 32
+
+/* Related to the dirty page flusher: */
+
+/*   pflushd sleeps on this queue */
+static proc_t *pflushd = NULL;
+static kthread_t *pflushd_thr = NULL;
+static ktqueue_t pflushd_waitq;
+
+/* writers throttled in pframe_dirty() sleep on this queue */
+static ktqueue_t dirty_waitq;
+
+/* Dirty pages are written back once they are older than dirty_expire
+ * ticks, or while more than dirty_background_ratio percent of memory is
+ * dirty. Threads dirtying pages while more than dirty_ratio percent of
+ * memory is dirty wait for pflushd to catch up. */
+static uint32_t dirty_expire = 3000;
+static uint32_t dirty_background_ratio = 10;
+static uint32_t dirty_ratio = 20;
+
+/* flusher statistics, reported by pframe_info() */
+static uint32_t pflushd_nwritten;
+static uint32_t pflushd_progress;       /* bumped after every flushed run */
+static uint32_t dirty_nthrottled;
+
+static void *pflushd_run(int arg1, void *arg2);
+static void pflushd_exit(void);
+#define pflushd_wakeup()        (sched_broadcast_on(&pflushd_waitq))
+#define dirty_over(ratio)       (ndirty * 100 > (ratio) * pframe_npages)
+#define dirty_expired()         \
+        (!list_empty(&dirty_list) \
+         && tsc_ticks() - list_head(&dirty_list, pframe_desc_t, pd_dlink)->pd_dirtied \
+            >= dirty_expire)
+#define pflushd_needed()        (dirty_over(dirty_background_ratio) || dirty_expired())
+#define pinned_dirty_expired()  \
+        (!list_empty(&pinned_dirty_list) \
+         && tsc_ticks() - list_head(&pinned_dirty_list, pframe_desc_t, pd_pdlink)->pd_dirtied \
+            >= dirty_expire)
+
+/* Related to the page fill workers: */
+
+/* Pages handed out by pframe_get_async() are filled by a pool of
+ * pfilld processes, so that several fills can be in flight at once. */
+#define PFILL_NWORKERS 4
+static proc_t *pfilld[PFILL_NWORKERS];
+static kthread_t *pfilld_thr[PFILL_NWORKERS];
+static ktqueue_t pfilld_waitq;
+static list_t pfill_queue;
+
+/* fill statistics, reported by pframe_info() */
+static uint32_t pfill_nqueued;
+static uint32_t pfill_npending;
+static uint32_t pfill_nerrors;
+static uint32_t pfill_inflight;
+static uint32_t pfill_maxinflight;
+
+static void *pfilld_run(int arg1, void *arg2);
+static void pfilld_exit(void);
+
+/* Related to the pre-zeroed page pool: */
+
+/* Free frames zeroed ahead of time by the idle loop, handed to anonymous
+ * objects by pframe_alloc() so that anon_fillpage() need not zero them.
+ * The pool is only filled while free memory is above pageoutd's target,
+ * and pageoutd gives it back before reclaiming anything. */
+#define ZERO_POOL_MAX   256
+#define ZERO_POOL_BATCH 8               /* pages zeroed per idle pass */
+static void *zero_pool[ZERO_POOL_MAX];
+static uint32_t zero_pool_count;
+static uint32_t zero_pool_target = 64;
+
+/* pool statistics, reported by pframe_info() */
+static uint32_t zero_pool_hits;
+static uint32_t zero_pool_misses;
+static uint32_t zero_pool_nzeroed;
+
+static void pframe_zero_drain(void);
+
+/* When pageoutd has to clean a page it also writes back up to
+ * pageout_cluster - 1 dirty neighbours of the page in the same object,
+ * in ascending page order, so that they reach the disk together instead
+ * of one reclaim pass at a time. */
+#define PAGEOUT_CLUSTER_MAX 64
+static uint32_t pageout_cluster = 16;
+
+/* write-back statistics, reported by pframe_info() */
+static uint32_t pageout_nclusters;
+static uint32_t pageout_nclustered;
+
+/*
+ * Run-time tunables, listed and set with the 'pframe tune' kshell
+ * command.
+ */
+typedef struct pframe_tunable {
+        const char     *pt_name;
+        uint32_t       *pt_val;
+        uint32_t        pt_min;
+        uint32_t        pt_max;
+} pframe_tunable_t;
+
+static pframe_tunable_t pframe_tunables[] = {
+        { "pageout_cluster", &pageout_cluster, 1, PAGEOUT_CLUSTER_MAX },
+        { "dirty_expire", &dirty_expire, 0, 1 << 20 },
+        { "dirty_background_ratio", &dirty_background_ratio, 1, 100 },
+        { "dirty_ratio", &dirty_ratio, 1, 100 },
+        { "zero_pool_target", &zero_pool_target, 0, ZERO_POOL_MAX },
+};
+#define PFRAME_NTUNABLES (sizeof(pframe_tunables) / sizeof(pframe_tunables[0]))
+
+
+/*
+ * Rebuild the resident page hash with (at least) the given number of
+ * buckets, rounded up to a power of two and at most PF_HASH_MAX. Every
+ * object record is rehashed into the new table. Returns 0 on success or
+ * -ENOMEM, in which case the old table is kept.
+ */
+int
+pframe_hash_resize(uint32_t nbuckets)
+{
+        list_t *newhash;
+        uint32_t size, npages, i;
+        pframe_obj_t *po;
+
+        nbuckets = MIN(nbuckets, PF_HASH_MAX);
+        for (size = 1; size < nbuckets; size <<= 1)
+                ;
+        npages = (size * sizeof(list_t) + PAGE_SIZE - 1) >> PAGE_SHIFT;
+        if (NULL == (newhash = page_alloc_n(npages))) {
+                dbg(DBG_PFRAME, "WARNING: no memory for a %u-bucket pframe hash\n", size);
+                return -ENOMEM;
+        }
+        for (i = 0; i < size; ++i)
+                list_init(&newhash[i]);
+
+        list_t *oldhash = pframe_hash;
+        uint32_t oldsize = pframe_hash_size;
+        pframe_hash = newhash;
+        pframe_hash_size = size;
+
+        for (i = 0; i < oldsize; ++i) {
+                list_iterate_begin(&oldhash[i], po, pframe_obj_t, po_hlink) {
+                        list_remove(&po->po_hlink);
+                        list_insert_head(pframe_hash_chain(po->po_obj), &po->po_hlink);
+                } list_iterate_end();
+        }
+
+        if (NULL != oldhash && pframe_hash_min != oldhash)
+                page_free_n(oldhash, (oldsize * sizeof(list_t) + PAGE_SIZE - 1) >> PAGE_SHIFT);
+
+        pframe_hash_lookups = 0;
+        pframe_hash_probes = 0;
+        pframe_hash_maxprobes = 0;
+        return 0;
+}
+
+/*
+ * Dumps page cache statistics. Suitable for dbginfo() and used by the
+ * 'pframe' kshell command.
+ */
+size_t
+pframe_info(const void *arg, char *buf, size_t osize)
+{
+        size_t size = osize;
+        uint32_t i, nused = 0, nentries = 0, maxchain = 0;
+        pframe_obj_t *po;
+
+        KASSERT(NULL != buf);
+
+        for (i = 0; i < pframe_hash_size; ++i) {
+                uint32_t len = 0;
+                list_iterate_begin(&pframe_hash[i], po, pframe_obj_t, po_hlink) {
+                        len++;
+                } list_iterate_end();
+                if (len > 0)
+                        nused++;
+                if (len > maxchain)
+                        maxchain = len;
+                nentries += len;
+        }
+
+        iprintf(&buf, &size, "free pages:       %u\n", page_free_count());
+        iprintf(&buf, &size, "allocated pages:  %d\n", nallocated);
+        iprintf(&buf, &size, "pinned pages:     %d\n", npinned);
+        iprintf(&buf, &size, "frame descs:      %u chunks of %u\n",
+                pframe_nchunks, (uint32_t) PFRAME_CHUNK_NDESCS);
+        iprintf(&buf, &size, "cached objects:   %u\n", nentries);
+        iprintf(&buf, &size, "hash buckets:     %u (%u in use)\n", pframe_hash_size, nused);
+        iprintf(&buf, &size, "hash chain max:   %u\n", maxchain);
+        iprintf(&buf, &size, "hash chain avg:   %u.%02u\n",
+                nused ? nentries / nused : 0,
+                nused ? (nentries * 100 / nused) % 100 : 0);
+        iprintf(&buf, &size, "hash lookups:     %u\n", pframe_hash_lookups);
+        iprintf(&buf, &size, "hash probes/lkup: %u.%02u (max %u)\n",
+                pframe_hash_lookups ? pframe_hash_probes / pframe_hash_lookups : 0,
+                pframe_hash_lookups ? (pframe_hash_probes * 100 / pframe_hash_lookups) % 100 : 0,
+                pframe_hash_maxprobes);
+        iprintf(&buf, &size, "replacement:      %s\n", pframe_policy->pp_name);
+        iprintf(&buf, &size, "cache hits:       %u\n", pframe_policy->pp_hits);
+        iprintf(&buf, &size, "cache misses:     %u\n", pframe_policy->pp_misses);
+        if (pframe_policy->pp_hits + pframe_policy->pp_misses > 0)
+                iprintf(&buf, &size, "cache hit rate:   %u%%\n",
+                        pframe_policy->pp_hits * 100
+                        / (pframe_policy->pp_hits + pframe_policy->pp_misses));
+        iprintf(&buf, &size, "pageout clusters: %u (%u pages)\n",
+                pageout_nclusters, pageout_nclustered);
+        iprintf(&buf, &size, "dirty pages:      %u (%u more pinned)\n", ndirty, npinned_dirty);
+        iprintf(&buf, &size, "lazily freed:     %u\n", nlazyfree);
+        iprintf(&buf, &size, "write-mapped:     %u (%u writes harvested)\n",
+                nwmapped, wmapped_nharvested);
+        iprintf(&buf, &size, "flushed pages:    %u\n", pflushd_nwritten);
+        iprintf(&buf, &size, "writer throttles: %u\n", dirty_nthrottled);
+        iprintf(&buf, &size, "async fills:      %u (%u failed, %u queued, %u in flight, max %u)\n",
+                pfill_nqueued, pfill_nerrors, pfill_npending,
+                pfill_inflight, pfill_maxinflight);
+        iprintf(&buf, &size, "zeroed pool:      %u/%u (%u zeroed while idle)\n",
+                zero_pool_count, zero_pool_target, zero_pool_nzeroed);
+        iprintf(&buf, &size, "zeroed hits:      %u (%u misses)\n",
+                zero_pool_hits, zero_pool_misses);
+
+        return size;
+}
+
+/*
+ * Find every frame the page allocator can hand out and set up the
+ * descriptor chunks that cover them: take all free pages (chaining them
+ * through their first word), note their chunks, give them back and only
+ * then allocate the chunks.
+ */
+static void
+pframe_chunks_init(void)
+{
+        void *page, *chain = NULL;
+        uint32_t i;
+
+        while (NULL != (page = page_alloc())) {
+                *(void **) page = chain;
+                chain = page;
+                pframe_chunks[pframe_pfn(page) / PFRAME_CHUNK_NDESCS] = PFRAME_CHUNK_WANTED;
+        }
+        while (NULL != chain) {
+                page = chain;
+                chain = *(void **) page;
+                page_free(page);
+        }
+
+        for (i = 0; i < PFRAME_NCHUNKS; ++i) {
+                if (PFRAME_CHUNK_WANTED != pframe_chunks[i])
+                        continue;
+                if (NULL != (pframe_chunks[i] = page_alloc_n(PFRAME_CHUNK_PAGES))) {
+                        memset(pframe_chunks[i], 0, PFRAME_CHUNK_PAGES * PAGE_SIZE);
+                        pframe_nchunks++;
+                }
+        }
+}
+
+/*
+ * Returns the descriptor of the frame at kernel address addr, or NULL if
+ * the frame has no chunk yet and there is no memory for one.
+ */
+static pframe_desc_t *
+pframe_frame_desc(void *addr)
+{
+        uint32_t pfn = pframe_pfn(addr);
+        pframe_desc_t **chunk = &pframe_chunks[pfn / PFRAME_CHUNK_NDESCS];
+
+        if (NULL == *chunk) {
+                if (NULL == (*chunk = page_alloc_n(PFRAME_CHUNK_PAGES)))
+                        return NULL;
+                memset(*chunk, 0, PFRAME_CHUNK_PAGES * PAGE_SIZE);
+                pframe_nchunks++;
+        }
+        return &(*chunk)[pfn % PFRAME_CHUNK_NDESCS];
+}
+
+/*
+ * Returns the first frame at or after frame number *pfn that holds a
+ * page and sets *pfn to its frame number, or returns NULL if there is
+ * none. Lets a scanner walk physical memory a little at a time.
+ */
+pframe_t *
+pframe_next_frame(uint32_t *pfn)
+{
+        uint32_t n = *pfn;
+        pframe_desc_t *chunk;
+
+        while (n < PFRAME_MAX_PFN) {
+                if (NULL == (chunk = pframe_chunks[n / PFRAME_CHUNK_NDESCS])) {
+                        n = (n / PFRAME_CHUNK_NDESCS + 1) * PFRAME_CHUNK_NDESCS;
+                        continue;
+                }
+                if (NULL != chunk[n % PFRAME_CHUNK_NDESCS].pd_pframe.pf_obj) {
+                        *pfn = n;
+                        return &chunk[n % PFRAME_CHUNK_NDESCS].pd_pframe;
+                }
+                n++;
+        }
+        return NULL;
+}
+
+/*
+ * Returns the page cached in the frame at physical address paddr, or
+ * NULL if the frame does not hold one.
+ */
+pframe_t *
+pframe_from_phys(uintptr_t paddr)
+{
+        uint32_t pfn = paddr >> PAGE_SHIFT;
+        pframe_desc_t *chunk = pframe_chunks[pfn / PFRAME_CHUNK_NDESCS];
+
+        if (NULL == chunk || NULL == chunk[pfn % PFRAME_CHUNK_NDESCS].pd_pframe.pf_obj)
+                return NULL;
+        return &chunk[pfn % PFRAME_CHUNK_NDESCS].pd_pframe;
+}
 
 /*
- * Initialize the pinned and allocated counts and lists. Then, make a pframe
- * slab allocator. You should also list_init all the lists that make
+ * Initialize the pinned and allocated counts and lists. Then, set up the
+ * frame descriptor table. You should also list_init all the lists that make
  * up the pframe_hash. Finally, you need to set things up for pageoutd to
  * run by setting nfreepages_min and nfreepages_target.
  */
 void
 pframe_init(void)
 {
+        uint32_t i;
+
         /* initialize page lists: */
         npinned = 0;
         list_init(&pinned_list);
         nallocated = 0;
         list_init(&alloc_list);
+        ndirty = 0;
+        list_init(&dirty_list);
+        list_init(&pinned_dirty_list);
+        list_init(&lazyfree_list);
+        list_init(&wmapped_list);
+
+        pframe_chunks_init();
+
+        radix_init();
+        pframe_obj_allocator = slab_allocator_create("pframe_obj", sizeof(pframe_obj_t));
+        KASSERT(NULL != pframe_obj_allocator);
+
+        /* initialize pframe_hash, sized for every free page to be resident: */
+        pframe_hash = NULL;
+        pframe_hash_size = 0;
+        if (pframe_hash_resize(page_free_count() / (PF_OBJ_PAGES * PF_HASH_LOAD)) < 0) {
+                dbg(DBG_PFRAME, "WARNING: using the %u-bucket fallback pframe hash\n",
+                    PF_HASH_MIN);
+                for (i = 0; i < PF_HASH_MIN; ++i)
+                        list_init(&pframe_hash_min[i]);
+                pframe_hash = pframe_hash_min;
+                pframe_hash_size = PF_HASH_MIN;
+        }
 
-        pframe_allocator = slab_allocator_create("pframe", sizeof(pframe_t));
-        KASSERT(NULL != pframe_allocator);
-
-        /* initialize pframe_hash: */
-        int i;
-        for (i = 0; i < PF_HASH_SIZE; ++i)
-                list_init(&pframe_hash[i]);
+        /* pick the replacement policy: */
+        pframe_npages = page_free_count();
+        if (pframe_policy_select(PFRAME_POLICY_DEFAULT) < 0) {
+                dbg(DBG_PFRAME, "WARNING: unknown replacement policy %s, using lru\n",
+                    PFRAME_POLICY_DEFAULT);
+                pframe_policy_select("lru");
+        }
 
         /* initialize pageout parameters: */
         nfreepages_target = page_free_count() >> 1;
         nfreepages_min = 0;
 
-        /* initialize alloc_waitq */
+        /* initialize alloc_waitq, dirty_waitq and the page wait queues */
         sched_queue_init(&alloc_waitq);
+        sched_queue_init(&dirty_waitq);
+        for (i = 0; i < PF_NWAITQS; ++i)
+                sched_queue_init(&pframe_waitqs[i]);
+
+        list_init(&pfill_queue);
 }
 
 void
@@ -149,12 +718,26 @@ pframe_shutdown()
 {
         KASSERT(PID_IDLE == curproc->p_pid); /* Should call from idleproc */
 
-        /* Stop pageoutd and wait for it */
+        /* ksmd frees pages, so it goes first */
+        ksm_shutdown();
+
+        /* Stop pageoutd, pflushd and the fill workers and wait for them */
         pageoutd_exit();
+        pflushd_exit();
+        pfilld_exit();
 
         int pid = pageoutd->p_pid;
-        int child = do_waitpid(-1, 0, NULL);
+        int child = do_waitpid(pid, 0, NULL);
         KASSERT(pid == child && "waited on process other than pageoutd");
+        pid = pflushd->p_pid;
+        child = do_waitpid(pid, 0, NULL);
+        KASSERT(pid == child && "waited on process other than pflushd");
+        int i;
+        for (i = 0; i < PFILL_NWORKERS; ++i) {
+                pid = pfilld[i]->p_pid;
+                child = do_waitpid(pid, 0, NULL);
+                KASSERT(pid == child && "waited on process other than pfilld");
+        }
         KASSERT(0 == npinned && "WARNING: FOUND PINNED "
                 "PAGES!!!!!!!!!! SOMETHING IS BROKEN!!\n");
 
@@ -169,6 +752,8 @@ pframe_shutdown()
                 KASSERT(!pframe_is_pinned(pf));
                 pframe_free(pf);
         } list_iterate_end();
+
+        pframe_zero_drain();
 }
 
 /*
@@ -189,25 +774,58 @@ pframe_shutdown()
 pframe_t *
 pframe_get_resident(struct mmobj *o, uint32_t pagenum)
 {
-        list_t *hashchain;
         pframe_t *pf;
 
-        hashchain = &pframe_hash[hash_page(o, pagenum)];
-        list_iterate_begin(hashchain, pf, pframe_t, pf_hlink) {
-                if ((o == pf->pf_obj) && (pagenum == pf->pf_pagenum)) {
-                        /* found a page with the specified identity. It is
-                         * up to the caller to recognize/care if the page
-                         * is busy. */
-                        if (!pframe_is_pinned(pf)) {
-                                /* send to back of alloc_list */
-                                list_remove(&pf->pf_link);
-                                list_insert_tail(&alloc_list, &pf->pf_link);
-                        }
-                        return pf;
-                }
-        } list_iterate_end();
+        /* found a page with the specified identity. It is up to the
+         * caller to recognize/care if the page is busy. */
+        if (NULL != (pf = pframe_hash_find(o, pagenum)) && !pframe_is_pinned(pf))
+                pframe_policy->pp_touch(pf);
+        return pf;
+}
 
-        return NULL;
+/*
+ * Look a page up in the resident page index without counting it as a
+ * request (the replacement policy is not told about it), for callers
+ * that only want to know whether the page is there.
+ */
+pframe_t *
+pframe_hash_find(mmobj_t *o, uint32_t pagenum)
+{
+        pframe_obj_t *po;
+
+        if (NULL == (po = pframe_obj_lookup(o)))
+                return NULL;
+        return radix_lookup(&po->po_pages, pagenum);
+}
+
+/*
+ * Fill pfs with up to max resident pages of o whose page numbers lie in
+ * [first, last], in ascending page order, and return how many were found.
+ * Like pframe_hash_find() this is not a request for the pages. Nothing
+ * here blocks, so the pages stay put until the caller blocks.
+ */
+uint32_t
+pframe_gang_lookup(mmobj_t *o, uint32_t first, uint32_t last,
+                   pframe_t **pfs, uint32_t max)
+{
+        pframe_obj_t *po;
+
+        if (NULL == (po = pframe_obj_lookup(o)))
+                return 0;
+        return radix_gang_lookup(&po->po_pages, first, last, (void **) pfs, max);
+}
+
+/* Like pframe_gang_lookup(), but only returns dirty pages. */
+uint32_t
+pframe_gang_lookup_dirty(mmobj_t *o, uint32_t first, uint32_t last,
+                         pframe_t **pfs, uint32_t max)
+{
+        pframe_obj_t *po;
+
+        if (NULL == (po = pframe_obj_lookup(o)))
+                return 0;
+        return radix_gang_lookup_tag(&po->po_pages, first, last, (void **) pfs, max,
+                                     PF_TAG_DIRTY);
 }
 
 /*
@@ -220,22 +838,47 @@ pframe_get_resident(struct mmobj *o, uint32_t pagenum)
  *
  * @param o the mmobj identifying this page
  * @param pagenum the page number of this page in the object
+ * @param frame the page frame to use, or NULL to take one from the free
+ *        list; a frame passed in is not freed if the allocation fails
  *
  * @return a new pframe
  */
 static pframe_t *
-pframe_alloc(mmobj_t *o, uint32_t pagenum)
+pframe_alloc_frame(mmobj_t *o, uint32_t pagenum, void *frame)
 {
+        pframe_desc_t *pd;
         pframe_t *pf;
-        if (NULL == (pf = slab_obj_alloc(pframe_allocator))) {
+        pframe_obj_t *po;
+        void *page = frame;
+        int zeroed = 0;
+
+        if (NULL == (po = pframe_obj_get(o))) {
                 dbg(DBG_PFRAME, "WARNING: not enough kernel memory\n");
                 return NULL;
         }
-        if (NULL == (pf->pf_addr = page_alloc())) {
+        if (NULL == page && 0 < zero_pool_count && anon_is_anon(o)) {
+                page = zero_pool[--zero_pool_count];
+                zeroed = 1;
+        } else if (NULL == page && NULL == (page = page_alloc())) {
                 dbg(DBG_PFRAME, "WARNING: not enough kernel memory\n");
-                slab_obj_free(pframe_allocator, pf);
+                pframe_obj_release(po);
                 return NULL;
         }
+        if (NULL == (pd = pframe_frame_desc(page))
+            || 0 > radix_insert(&po->po_pages, pagenum, &pd->pd_pframe)) {
+                dbg(DBG_PFRAME, "WARNING: not enough kernel memory\n");
+                if (zeroed)
+                        zero_pool[zero_pool_count++] = page;
+                else if (NULL == frame)
+                        page_free(page);
+                pframe_obj_release(po);
+                return NULL;
+        }
+
+        pf = &pd->pd_pframe;
+        KASSERT(NULL == pf->pf_obj && "frame already holds a page");
+        pf->pf_addr = page;
+        pd->pd_zeroed = zeroed;
 
         nallocated++;
         list_insert_tail(&alloc_list, &pf->pf_link);
@@ -243,10 +886,28 @@ pframe_alloc(mmobj_t *o, uint32_t pagenum)
         pf->pf_obj = o;
         pf->pf_pagenum = pagenum;
         pf->pf_flags = 0;
-        sched_queue_init(&pf->pf_waitq);
         pf->pf_pincount = 0;
 
-        list_insert_head(&pframe_hash[hash_page(o, pagenum)], &pf->pf_hlink);
+        /* charge the frame to whoever caused it to be allocated */
+        pframe_desc(pf)->pd_owner = (NULL != curproc) ? curproc->p_pid : -1;
+        if (-1 != pframe_desc(pf)->pd_owner)
+                memlimit_charge(pframe_desc(pf)->pd_owner);
+
+        list_link_init(&pframe_desc(pf)->pd_plink);
+        pframe_desc(pf)->pd_ref = 0;
+        pframe_desc(pf)->pd_queue = 0;
+        pframe_desc(pf)->pd_adopted = 0;
+        pframe_policy->pp_insert(pf, 1);
+        list_link_init(&pframe_desc(pf)->pd_dlink);
+        list_link_init(&pframe_desc(pf)->pd_pdlink);
+        list_link_init(&pframe_desc(pf)->pd_odlink);
+        list_link_init(&pframe_desc(pf)->pd_fillq);
+        list_link_init(&pframe_desc(pf)->pd_lflink);
+        list_link_init(&pframe_desc(pf)->pd_wmlink);
+        pframe_desc(pf)->pd_pobj = po;
+        po->po_npages++;
+
+        list_link_init(&pf->pf_hlink);
 
         o->mmo_ops->ref(o);
         o->mmo_nrespages++;
@@ -255,6 +916,87 @@ pframe_alloc(mmobj_t *o, uint32_t pagenum)
         return pf;
 }
 
+#define pframe_alloc(o, pagenum) pframe_alloc_frame((o), (pagenum), NULL)
+
+/*
+ * Make the pages [pagenum, pagenum + npages) of o resident in the run of
+ * frames starting at addr, which the caller got from page_alloc_n(). The
+ * pages are zero-filled and pinned as anon_fillpage() would leave them,
+ * plus one more pin that keeps them resident while a large page maps
+ * them, until pframe_unadopt(). None of them may be resident or swapped
+ * out already. Each frame is given back on its own when its page is
+ * freed. Returns 0, or -ENOMEM after giving back every frame of the run.
+ */
+int
+pframe_adopt_run(mmobj_t *o, uint32_t pagenum, uint32_t npages, void *addr)
+{
+        tlb_gather_t tg;
+        pframe_t *pf;
+        uint32_t i, j;
+
+        /* zero-filling a page that has a copy elsewhere would lose it */
+        KASSERT(!swap_has_range(o, pagenum, pagenum + npages - 1));
+
+        tlb_gather_init(&tg);
+        memset(addr, 0, npages * PAGE_SIZE);
+        for (i = 0; i < npages; ++i) {
+                KASSERT(NULL == pframe_hash_find(o, pagenum + i));
+                if (NULL == (pf = pframe_alloc_frame(o, pagenum + i,
+                                                     (char *) addr + i * PAGE_SIZE))) {
+                        for (j = i; j < npages; ++j)
+                                page_free((char *) addr + j * PAGE_SIZE);
+                        tlb_gather_finish(&tg);
+                        while (i-- > 0) {
+                                pf = pframe_hash_find(o, pagenum + i);
+                                pframe_unadopt(pf);
+                                if (pframe_is_pinned(pf))
+                                        pframe_unpin(pf);
+                                pframe_free(pf);
+                        }
+                        return -ENOMEM;
+                }
+                if (swap_fill_pins())
+                        pframe_pin(pf);
+                pframe_pin(pf);
+                pframe_desc(pf)->pd_adopted = 1;
+                /* drop other sharers' zero page mappings, as anon_fillpage() does */
+                pframe_unmap_gather(pf, &tg);
+        }
+        tlb_gather_finish(&tg);
+        return 0;
+}
+
+/* Whether pf still has the pin pframe_adopt_run() took. */
+int
+pframe_is_adopted(pframe_t *pf)
+{
+        return pframe_desc(pf)->pd_adopted;
+}
+
+/*
+ * Drop the pin pframe_adopt_run() took on pf, if it still has it. The
+ * caller must have torn down every large mapping of the page first.
+ */
+void
+pframe_unadopt(pframe_t *pf)
+{
+        if (pframe_desc(pf)->pd_adopted) {
+                pframe_desc(pf)->pd_adopted = 0;
+                pframe_unpin(pf);
+        }
+}
+
+/*
+ * Sleep until pf is no longer busy. The page may have been freed by the
+ * time this returns, so the caller must look it up again.
+ */
+void
+pframe_wait_busy(pframe_t *pf)
+{
+        if (pframe_is_busy(pf))
+                sched_sleep_on(pframe_waitq(pf));
+}
+
 int
 pframe_lookup(struct mmobj *o, uint32_t pagenum, int forwrite, pframe_t **result)
 {
@@ -278,17 +1020,38 @@ pframe_migrate(pframe_t *pf, mmobj_t *dest)
         KASSERT(!pframe_is_busy(pf));
         if (NULL != pframe_get_resident(dest, pf->pf_pagenum)) {
                 /* dest already has a newer version of the page, clean this page */
-                pframe_unpin(pf);
+                pframe_unadopt(pf);
+                if (pframe_is_pinned(pf))
+                        pframe_unpin(pf);
                 pframe_clean(pf);
                 pframe_free(pf);
         } else {
                 mmobj_t *src = pf->pf_obj;
+                pframe_obj_t *po = pframe_obj_get(dest);
+                if (NULL == po || 0 > radix_insert(&po->po_pages, pf->pf_pagenum, pf)) {
+                        /* leave the page where it is; dest's lookups
+                         * still find it further down the chain */
+                        dbg(DBG_PFRAME, "WARNING: not enough kernel memory to migrate\n");
+                        if (NULL != po)
+                                pframe_obj_release(po);
+                        return;
+                }
+                if (pframe_is_dirty(pf))
+                        radix_tag_set(&po->po_pages, pf->pf_pagenum, PF_TAG_DIRTY);
+                int dirty = list_link_is_linked(&pframe_desc(pf)->pd_dlink);
+                if (dirty)
+                        pframe_dirty_unlink(pf);
+                radix_delete(&pframe_desc(pf)->pd_pobj->po_pages, pf->pf_pagenum);
+                pframe_desc(pf)->pd_pobj->po_npages--;
+                pframe_obj_release(pframe_desc(pf)->pd_pobj);
+                pframe_desc(pf)->pd_pobj = po;
+                po->po_npages++;
                 pf->pf_obj = dest;
-                list_remove(&pf->pf_hlink);
+                if (dirty)
+                        pframe_dirty_link(pf);
                 list_remove(&pf->pf_olink);
                 src->mmo_nrespages--;
                 src->mmo_ops->put(src);
-                list_insert_head(&pframe_hash[hash_page(dest, pf->pf_pagenum)], &pf->pf_hlink);
                 list_insert_head(&dest->mmo_respages, &pf->pf_olink);
                 dest->mmo_nrespages++;
                 dest->mmo_ops->ref(dest);
@@ -305,11 +1068,11 @@ pframe_fill(pframe_t *pf)
 {
         int ret;
 
-        pframe_set_busy(pf);
+        pframe_busy(pf);
         ret = pf->pf_obj->mmo_ops->fillpage(pf->pf_obj, pf);
-        pframe_clear_busy(pf);
+        pframe_unbusy(pf);
 
-        sched_broadcast_on(&pf->pf_waitq);
+        sched_broadcast_on(pframe_waitq(pf));
 
         return ret;
 }
@@ -340,16 +1103,21 @@ pframe_get(struct mmobj *o, uint32_t pagenum, pframe_t **result)
 {
     int retval;
     pframe_t *pf;
+lookup:
     pf = pframe_get_resident(o, pagenum);
 
     // If the page is already resident in memory, then we return the existing page
     if (pf)
     {
-            while (pframe_is_busy(pf))
+            if (pframe_is_busy(pf))
             {
-                    sched_sleep_on(&pf->pf_waitq);
+                    sched_sleep_on(pframe_waitq(pf));
                     dbg(DBG_PRINT, "(GRADING3B 7)\n");
+                    // the page may have been reclaimed, or may have failed
+                    // to fill (see pfilld_run), while we slept
+                    goto lookup;
             }
+            pframe_policy->pp_hits++;
             *result = pf;
             KASSERT(NULL != *result);
             dbg(DBG_PRINT, "(GRADING3A 1.a)\n");
@@ -358,8 +1126,27 @@ pframe_get(struct mmobj *o, uint32_t pagenum, pframe_t **result)
             return 0;
     }
 
+    // wait for pageoutd if we are out of free pages (pageoutd itself
+    // may need pages to clean with, so it never waits on itself)
+    if (pageoutd_needed() && curthr != pageoutd_thr)
+    {
+            // pages nobody needs can be had without pageoutd
+            if (!pframe_lazyfree_reclaim())
+            {
+                    pageoutd_wakeup();
+                    sched_sleep_on(&alloc_waitq);
+            }
+            // someone else may have brought the page in meanwhile
+            goto lookup;
+    }
+    pframe_policy->pp_misses++;
+
     // allocate a new page and fill it
-    pf = pframe_alloc(o, pagenum);
+    if ((pf = pframe_alloc(o, pagenum)) == NULL)
+    {
+            *result = NULL;
+            return -ENOMEM;
+    }
 
     if((retval = pframe_fill(pf)) != 0){
             pframe_free(pf);
@@ -377,78 +1164,285 @@ pframe_get(struct mmobj *o, uint32_t pagenum, pframe_t **result)
 }
 
 /*
- * Increases the pin count on this page. Pages with a pin count > 0 will not be
- * paged out by pageoutd, so this ensures that the page will remain resident
- * until the pin count is decreased.
- *
- * If the pframe has not yet been pinned, remove this pframe's list link from
- * the allocated list and add it to the pinned list.  Be sure to decrement
- * nallocated and increment npinned.
- *
- * In either case, increment the pf_pincount.
- *
- * @param pf the page to pin
+ * Insert a page into a dirty list kept in age order. 'off' is the offset
+ * of the list's link within pframe_desc_t. Newly dirtied pages belong at
+ * the tail; pages that were pinned for a while keep the age they had
+ * when they were dirtied, but are rarely pinned for long, so the walk
+ * from the tail is short either way.
  */
-void
-pframe_pin(pframe_t *pf)
+static void
+pframe_dirty_insert(list_t *list, pframe_desc_t *pd, size_t off)
 {
-    KASSERT(!pframe_is_free(pf));
-    dbg(DBG_PRINT, "(GRADING3A 1.b)\n");
-    KASSERT(pf->pf_pincount >= 0);
-    dbg(DBG_PRINT, "(GRADING3A 1.b)\n");
-
-    if (!pframe_is_pinned(pf))
-    {
-            list_remove(&pf->pf_link);
-            list_insert_tail(&pinned_list, &pf->pf_link);
-            npinned++;
-            nallocated--;
-            dbg(DBG_PRINT, "(GRADING3A)\n");
-    }
+        list_link_t *link;
 
-    pf->pf_pincount++;
-    dbg(DBG_PRINT, "(GRADING3A)\n");
+        for (link = list->l_prev; link != list; link = link->l_prev) {
+                pframe_desc_t *other = (pframe_desc_t *)((char *) link - off);
+                if ((int32_t)(other->pd_dirtied - pd->pd_dirtied) <= 0)
+                        break;
+        }
+        list_insert_before(link->l_next, (list_link_t *)((char *) pd + off));
 }
 
 /*
- * Decreases the pin count on a page. If the pin count reaches zero, then the
- * page could be paged out any time after the calling context blocks.
- *
- * If the pin count reaches zero, move the pframe's list link from the pinned
- * list to the allocated list.  Be sure to correctly update npinned and
- * nallocated
- *
- * @param pf a pinned page (a page with a positive pin count)
+ * Pages of anon and shadow objects are written to swap, and only when
+ * pageoutd wants their frames; pflushd and sync leave them alone. They
+ * stay off the dirty lists, but are still tagged dirty in their object's
+ * index so that pageout can cluster them.
  */
-void
-pframe_unpin(pframe_t *pf)
+#define pframe_swap_backed(pf) \
+        (NULL != (pf)->pf_obj->mmo_shadowed || anon_is_anon((pf)->pf_obj))
+
+/* Put a dirty page on dirty_list and its object's dirty list, or on
+ * pinned_dirty_list if it is pinned. */
+static void
+pframe_dirty_link(pframe_t *pf)
 {
-    KASSERT(!pframe_is_free(pf));
-    dbg(DBG_PRINT, "(GRADING3A 1.c)\n");
-    KASSERT(pf->pf_pincount > 0);
-    dbg(DBG_PRINT, "(GRADING3A 1.c)\n");
+        pframe_desc_t *pd = pframe_desc(pf);
+
+        if (pframe_swap_backed(pf))
+                return;
+        if (pframe_is_pinned(pf)) {
+                if (!list_link_is_linked(&pd->pd_pdlink)) {
+                        pframe_dirty_insert(&pinned_dirty_list, pd,
+                                            offsetof(pframe_desc_t, pd_pdlink));
+                        npinned_dirty++;
+                }
+                return;
+        }
+        pframe_dirty_insert(&dirty_list, pd, offsetof(pframe_desc_t, pd_dlink));
+        pframe_dirty_insert(&pd->pd_pobj->po_dirty, pd, offsetof(pframe_desc_t, pd_odlink));
+        ndirty++;
+        pd->pd_pobj->po_ndirty++;
+}
 
-    pf->pf_pincount--;
+static void
+pframe_dirty_unlink(pframe_t *pf)
+{
+        pframe_desc_t *pd = pframe_desc(pf);
 
-    if (pf->pf_pincount == 0)
-    {
-            list_remove(&pf->pf_link);
-            list_insert_tail(&alloc_list, &pf->pf_link);
-            npinned--;
-            nallocated++;
-            dbg(DBG_PRINT, "(GRADING3A)\n");
-    }
-    dbg(DBG_PRINT, "(GRADING3A)\n");
+        if (list_link_is_linked(&pd->pd_pdlink)) {
+                list_remove(&pd->pd_pdlink);
+                npinned_dirty--;
+        }
+        if (!list_link_is_linked(&pd->pd_dlink))
+                return;
+        list_remove(&pd->pd_dlink);
+        list_remove(&pd->pd_odlink);
+        ndirty--;
+        pd->pd_pobj->po_ndirty--;
 }
 
-/*
- * Indicates that a page is about to be modified. This should be called on a
- * page before any attempt to modify its contents. This marks the page dirty
- * (so that pageoutd knows to clean it before reclaiming the page frame)
- * and calls the dirtypage mmobj entry point.
- * The given page must not be busy.
- *
- * This routine can block at the mmobj operation level.
+static void
+pframe_lazyfree_unlink(pframe_t *pf)
+{
+        if (list_link_is_linked(&pframe_desc(pf)->pd_lflink)) {
+                list_remove(&pframe_desc(pf)->pd_lflink);
+                nlazyfree--;
+        }
+}
+
+static void
+pframe_wmapped_unlink(pframe_t *pf)
+{
+        if (list_link_is_linked(&pframe_desc(pf)->pd_wmlink)) {
+                list_remove(&pframe_desc(pf)->pd_wmlink);
+                nwmapped--;
+        }
+}
+
+/*
+ * Set or clear the dirty bit of a page, keeping the dirty lists up to
+ * date. A page that is dirtied again while already dirty keeps its age.
+ * Dirtying a lazily freed page means its contents are wanted after all.
+ */
+static void
+pframe_mark_dirty(pframe_t *pf)
+{
+        pframe_lazyfree_unlink(pf);
+        pframe_wmapped_unlink(pf);
+        if (!pframe_is_dirty(pf)) {
+                pframe_set_dirty(pf);
+                pframe_desc(pf)->pd_dirtied = tsc_ticks();
+        }
+        radix_tag_set(&pframe_desc(pf)->pd_pobj->po_pages, pf->pf_pagenum, PF_TAG_DIRTY);
+        if (!list_link_is_linked(&pframe_desc(pf)->pd_dlink))
+                pframe_dirty_link(pf);
+}
+
+static void
+pframe_mark_clean(pframe_t *pf)
+{
+        pframe_clear_dirty(pf);
+        radix_tag_clear(&pframe_desc(pf)->pd_pobj->po_pages, pf->pf_pagenum, PF_TAG_DIRTY);
+        pframe_dirty_unlink(pf);
+}
+
+/*
+ * Let the contents of pf go: the page is marked clean without being
+ * written and is reclaimed before any other page, unless it is dirtied
+ * (or pinned) again first. The page must be unpinned and not busy; the
+ * caller is responsible for dropping any copy of it its object keeps
+ * elsewhere (see swap_discard()) and for unmapping it, so that a write
+ * faults and dirties it again.
+ */
+void
+pframe_lazyfree(pframe_t *pf)
+{
+        KASSERT(!pframe_is_pinned(pf) && !pframe_is_busy(pf));
+
+        pframe_mark_clean(pf);
+        if (!list_link_is_linked(&pframe_desc(pf)->pd_lflink)) {
+                list_insert_tail(&lazyfree_list, &pframe_desc(pf)->pd_lflink);
+                nlazyfree++;
+        }
+}
+
+/*
+ * Reclaim the oldest lazily freed page that is not busy. Returns 1 if a
+ * page was freed, 0 if there was none. May block in the mmobj put.
+ */
+static int
+pframe_lazyfree_reclaim(void)
+{
+        pframe_desc_t *pd;
+
+        list_iterate_begin(&lazyfree_list, pd, pframe_desc_t, pd_lflink) {
+                if (!pframe_is_busy(&pd->pd_pframe)) {
+                        pframe_reclaim(&pd->pd_pframe);
+                        return 1;
+                }
+        } list_iterate_end();
+        return 0;
+}
+
+/*
+ * Like pframe_get(), but if the page is not resident its fill is handed to
+ * the pfilld workers and the page is returned still busy, without
+ * waiting for it. The caller must not use the page's contents (or even
+ * hold on to the pointer across a block) without waiting for it to
+ * become unbusy; if the fill fails the page is freed by the worker.
+ * Read-ahead uses this to have several fills in flight at once.
+ *
+ * Unlike pframe_get(), this does not wait for pageoutd: if memory is
+ * short it fails with -ENOMEM instead.
+ *
+ * @param o the parent object of the page
+ * @param pagenum the page number of this page in the object
+ * @param result used to return the pframe (NULL if there's an error)
+ * @return 0 on success, < 0 on failure.
+ */
+int
+pframe_get_async(struct mmobj *o, uint32_t pagenum, pframe_t **result)
+{
+        pframe_t *pf;
+
+        if (NULL != (pf = pframe_get_resident(o, pagenum))) {
+                *result = pf;
+                return 0;
+        }
+        if (NULL == pfilld_thr[0])
+                return pframe_get(o, pagenum, result);
+
+        *result = NULL;
+        if (pageoutd_needed())
+                return -ENOMEM;
+        pframe_policy->pp_misses++;
+        if (NULL == (pf = pframe_alloc(o, pagenum)))
+                return -ENOMEM;
+
+        pframe_busy(pf);
+        list_insert_tail(&pfill_queue, &pframe_desc(pf)->pd_fillq);
+        pfill_nqueued++;
+        pfill_npending++;
+        sched_wakeup_on(&pfilld_waitq);
+
+        *result = pf;
+        return 0;
+}
+
+/*
+ * Increases the pin count on this page. Pages with a pin count > 0 will not be
+ * paged out by pageoutd, so this ensures that the page will remain resident
+ * until the pin count is decreased.
+ *
+ * If the pframe has not yet been pinned, remove this pframe's list link from
+ * the allocated list and add it to the pinned list.  Be sure to decrement
+ * nallocated and increment npinned.
+ *
+ * In either case, increment the pf_pincount.
+ *
+ * @param pf the page to pin
+ */
+void
+pframe_pin(pframe_t *pf)
+{
+    KASSERT(!pframe_is_free(pf));
+    dbg(DBG_PRINT, "(GRADING3A 1.b)\n");
+    KASSERT(pf->pf_pincount >= 0);
+    dbg(DBG_PRINT, "(GRADING3A 1.b)\n");
+
+    if (!pframe_is_pinned(pf))
+    {
+            pframe_policy->pp_remove(pf);
+            pframe_dirty_unlink(pf);
+            pframe_lazyfree_unlink(pf);
+            list_remove(&pf->pf_link);
+            list_insert_tail(&pinned_list, &pf->pf_link);
+            npinned++;
+            nallocated--;
+            dbg(DBG_PRINT, "(GRADING3A)\n");
+    }
+
+    pf->pf_pincount++;
+    // a dirty file page moves over to pinned_dirty_list
+    if (1 == pf->pf_pincount && pframe_is_dirty(pf))
+            pframe_dirty_link(pf);
+    dbg(DBG_PRINT, "(GRADING3A)\n");
+}
+
+/*
+ * Decreases the pin count on a page. If the pin count reaches zero, then the
+ * page could be paged out any time after the calling context blocks.
+ *
+ * If the pin count reaches zero, move the pframe's list link from the pinned
+ * list to the allocated list.  Be sure to correctly update npinned and
+ * nallocated
+ *
+ * @param pf a pinned page (a page with a positive pin count)
+ */
+void
+pframe_unpin(pframe_t *pf)
+{
+    KASSERT(!pframe_is_free(pf));
+    dbg(DBG_PRINT, "(GRADING3A 1.c)\n");
+    KASSERT(pf->pf_pincount > 0);
+    dbg(DBG_PRINT, "(GRADING3A 1.c)\n");
+
+    pf->pf_pincount--;
+
+    if (pf->pf_pincount == 0)
+    {
+            list_remove(&pf->pf_link);
+            list_insert_tail(&alloc_list, &pf->pf_link);
+            pframe_policy->pp_insert(pf, 0);
+            pframe_dirty_unlink(pf);
+            if (pframe_is_dirty(pf))
+                    pframe_dirty_link(pf);
+            npinned--;
+            nallocated++;
+            dbg(DBG_PRINT, "(GRADING3A)\n");
+    }
+    dbg(DBG_PRINT, "(GRADING3A)\n");
+}
+
+/*
+ * Indicates that a page is about to be modified. This should be called on a
+ * page before any attempt to modify its contents. This marks the page dirty
+ * (so that pageoutd knows to clean it before reclaiming the page frame)
+ * and calls the dirtypage mmobj entry point.
+ * The given page must not be busy.
+ *
+ * This routine can block at the mmobj operation level.
  *
  * @param pf the page to dirty
  * @return 0 on success, -errno on failure
@@ -458,22 +1452,46 @@ pframe_dirty(pframe_t *pf)
 {
         int ret;
 
+        if (!pframe_is_dirty(pf) && dirty_over(dirty_ratio)
+            && curthr != pflushd_thr && curthr != pageoutd_thr && NULL != pflushd_thr) {
+                /* too much of memory is dirty: let pflushd catch up before
+                 * adding to it, as long as it is making progress. The
+                 * page is pinned so that it is still here afterwards. */
+                pframe_pin(pf);
+                dirty_nthrottled++;
+                while (dirty_over(dirty_ratio)) {
+                        uint32_t progress = pflushd_progress;
+                        pflushd_wakeup();
+                        sched_sleep_on(&dirty_waitq);
+                        if (progress == pflushd_progress)
+                                break;
+                }
+                while (pframe_is_busy(pf))
+                        sched_sleep_on(pframe_waitq(pf));
+                pframe_unpin(pf);
+        }
+
         KASSERT(!pframe_is_busy(pf));
 
-        pframe_set_busy(pf);
+        int wasdirty = pframe_is_dirty(pf);
+        pframe_busy(pf);
 
         if (!(ret = pf->pf_obj->mmo_ops->dirtypage(pf->pf_obj, pf))) {
-                pframe_set_dirty(pf);
+                /* some dirtypage ops set the dirty bit themselves */
+                if (!wasdirty)
+                        pframe_desc(pf)->pd_dirtied = tsc_ticks();
+                pframe_mark_dirty(pf);
         }
-        pframe_clear_busy(pf);
-        sched_broadcast_on(&pf->pf_waitq);
+        pframe_unbusy(pf);
+        sched_broadcast_on(pframe_waitq(pf));
 
         return ret;
 }
 
 /*
  * Clean a dirty page by writing it back to disk. Removes the dirty
- * bit of the page and updates the MMU entry.
+ * bit of the page and updates the MMU entries (see
+ * pframe_clean_mappings()).
  * The page must be dirty but unpinned.
  *
  * This routine can block at the mmobj operation level.
@@ -483,6 +1501,7 @@ pframe_dirty(pframe_t *pf)
 int
 pframe_clean(pframe_t *pf)
 {
+        tlb_gather_t tg;
         int ret;
 
         KASSERT(pframe_is_dirty(pf) && "Cleaning page that isn't dirty!");
@@ -496,22 +1515,74 @@ pframe_clean(pframe_t *pf)
          * that if the page is dirtied again while we're writing it out,
          * we won't (incorrectly) think the page has been fully cleaned.
          */
-        pframe_clear_dirty(pf);
+        pframe_mark_clean(pf);
 
-        /* Make sure a future write to the page will fault (and hence dirty it) */
-        tlb_flush((uintptr_t) pf->pf_addr);
-        pframe_remove_from_pts(pf);
+        /* Make sure a future write to the page is noticed */
+        tlb_gather_init(&tg);
+        pframe_clean_mappings(pf, &tg);
+        tlb_gather_finish(&tg);
 
-        pframe_set_busy(pf);
+        pframe_busy(pf);
         if ((ret = pf->pf_obj->mmo_ops->cleanpage(pf->pf_obj, pf)) < 0) {
-                pframe_set_dirty(pf);
+                pframe_mark_dirty(pf);
         }
-        pframe_clear_busy(pf);
-        sched_broadcast_on(&pf->pf_waitq);
+        pframe_unbusy(pf);
+        sched_broadcast_on(pframe_waitq(pf));
 
         return ret;
 }
 
+/*
+ * Clean a run of dirty, unpinned, non-busy pages of one object. The pages
+ * are all marked busy, and their mappings made to notice the next write,
+ * before the first one is written, then written back in the order given
+ * (callers sort them by page number), so that nobody can touch the run
+ * while part of it is on its way to disk.
+ *
+ * This routine can block at the mmobj operation level.
+ * @param run the pages to clean
+ * @param n the number of pages in run
+ * @return 0 on success, or the last -errno seen; pages that failed to
+ *         write are left dirty
+ */
+static int
+pframe_clean_run(pframe_t **run, uint32_t n)
+{
+        tlb_gather_t tg;
+        uint32_t i;
+        int ret, err = 0;
+
+        tlb_gather_init(&tg);
+        for (i = 0; i < n; ++i) {
+                KASSERT(pframe_is_dirty(run[i]) && "Cleaning page that isn't dirty!");
+                /* msync(2) also writes file pages that mlock(2) pinned */
+                KASSERT((run[i]->pf_pincount == 0 || !pframe_swap_backed(run[i]))
+                        && "Cleaning a pinned page!");
+                KASSERT(!pframe_is_busy(run[i]));
+
+                /* see pframe_clean() for the ordering */
+                pframe_mark_clean(run[i]);
+                pframe_clean_mappings(run[i], &tg);
+                pframe_busy(run[i]);
+        }
+        tlb_gather_finish(&tg);
+
+        for (i = 0; i < n; ++i) {
+                dbg(DBG_PFRAME, "cleaning page %d of obj %p\n", run[i]->pf_pagenum, run[i]->pf_obj);
+                if ((ret = run[i]->pf_obj->mmo_ops->cleanpage(run[i]->pf_obj, run[i])) < 0) {
+                        pframe_mark_dirty(run[i]);
+                        err = ret;
+                }
+        }
+
+        for (i = 0; i < n; ++i) {
+                pframe_unbusy(run[i]);
+                sched_broadcast_on(pframe_waitq(run[i]));
+        }
+
+        return err;
+}
+
 /*
  * Deallocates a pframe (reclaims the page frame for use by something else).
  * The page should not be pinned, free, or busy. Note that if the page is dirty
@@ -532,23 +1603,31 @@ pframe_free(pframe_t *pf)
         mmobj_t *o = pf->pf_obj;
 
 
-        /* Flush the TLB */
-        tlb_flush((uintptr_t) pf->pf_addr);
         /* Remove from all pagetables that map it */
         pframe_remove_from_pts(pf);
 
-        list_remove(&pf->pf_hlink);
+        pframe_policy->pp_remove(pf);
+        pframe_dirty_unlink(pf);
+        pframe_lazyfree_unlink(pf);
+        pframe_wmapped_unlink(pf);
+        radix_delete(&pframe_desc(pf)->pd_pobj->po_pages, pf->pf_pagenum);
+        pframe_desc(pf)->pd_pobj->po_npages--;
+        pframe_obj_release(pframe_desc(pf)->pd_pobj);
 
         pf->pf_obj = NULL;
         nallocated--;
         list_remove(&pf->pf_link);
 
-        page_free(pf->pf_addr);
-        slab_obj_free(pframe_allocator, pf);
+        if (-1 != pframe_desc(pf)->pd_owner)
+                memlimit_uncharge(pframe_desc(pf)->pd_owner);
 
         o->mmo_nrespages--;
         list_remove(&pf->pf_olink);
 
+        /* the descriptor stays with the frame; pf_obj == NULL marks it
+         * unused */
+        page_free(pf->pf_addr);
+
         /* Now that pf has effectively been freed, dereference the corresponding
          * object. We don't do this earlier as we are modifying the object's counts
          * and also because this op can block */
@@ -556,40 +1635,529 @@ pframe_free(pframe_t *pf)
 }
 
 /*
- * Clean all allocated pages (that is, all pages that are not pinned and
- * not free). This is called by sync(2).
+ * Write back the dirty pages on one of the dirty lists (dirty_list itself
+ * or an object's po_dirty), oldest first. Every page written leaves the
+ * head of the list, so this is a single pass over the list. Pages dirtied
+ * after the pass started are left alone, so that it terminates even if
+ * pages are constantly being dirtied.
+ *
+ * If 'o' is not NULL, the list is o's (looked up again after every block,
+ * since the record goes away with o's last resident page).
+ *
+ * Returns 0, or the error of the first page that failed to write.
  */
-void
-pframe_clean_all()
+static int
+pframe_clean_list(mmobj_t *o)
 {
+        uint32_t start = tsc_ticks();
+        pframe_obj_t *po;
+        list_t *list;
         pframe_t *pf;
-        dbg(DBG_PFRAME, "pframe_clean_all: starting (this may take a while)\n");
+        int ret;
 
-        /*
-         * Iterate from head of alloc_list to tail; This is a rough attempt to
-         * sync from least active to most active. Note that every time we block we
-         * need to start the loop over as the "current element" pf may have been
-         * moved or removed in the meantime (our list has no multithreaded
-         * integrity)
-         */
-list_start:
-        list_iterate_begin(&alloc_list, pf, pframe_t, pf_link) {
+        while (1) {
+                if (NULL == o) {
+                        list = &dirty_list;
+                        if (list_empty(list))
+                                return 0;
+                        pf = &list_head(list, pframe_desc_t, pd_dlink)->pd_pframe;
+                } else {
+                        if (NULL == (po = pframe_obj_lookup(o)))
+                                return 0;
+                        list = &po->po_dirty;
+                        if (list_empty(list))
+                                return 0;
+                        pf = &list_head(list, pframe_desc_t, pd_odlink)->pd_pframe;
+                }
                 KASSERT(!pframe_is_pinned(pf));
-                KASSERT(!pframe_is_free(pf));
+                KASSERT(pframe_is_dirty(pf));
+
+                if ((int32_t)(pframe_desc(pf)->pd_dirtied - start) > 0)
+                        return 0;
                 if (pframe_is_busy(pf)) {
-                        sched_sleep_on(&pf->pf_waitq);
+                        sched_sleep_on(pframe_waitq(pf));
+                        continue;
+                }
+                if ((ret = pageoutd_clean_cluster(pf)) < 0)
+                        return ret;
+        }
+}
+
+/*
+ * Write back the pages on pinned_dirty_list that were dirtied no later
+ * than 'before', or only those of o if it is not NULL. They are written
+ * one at a time where they are: being pinned, they stay resident. A page
+ * that fails to write is dirtied again, and so is not tried again in the
+ * same pass.
+ *
+ * Returns 0, or the error of the last page that failed to write.
+ */
+static int
+pframe_clean_pinned(mmobj_t *o, uint32_t before)
+{
+        pframe_desc_t *pd;
+        pframe_t *pf;
+        mmobj_t *obj;
+        int ret, err = 0;
+
+list_start:
+        list_iterate_begin(&pinned_dirty_list, pd, pframe_desc_t, pd_pdlink) {
+                if ((int32_t)(pd->pd_dirtied - before) > 0)
+                        break;
+                pf = &pd->pd_pframe;
+                if (NULL != o && pf->pf_obj != o)
+                        continue;
+                /* both block, so start over afterwards */
+                if (pframe_is_busy(pf)) {
+                        sched_sleep_on(pframe_waitq(pf));
                         goto list_start;
                 }
+                /* see pageoutd_clean_cluster() */
+                obj = pf->pf_obj;
+                obj->mmo_ops->ref(obj);
+                if ((ret = pframe_clean_run(&pf, 1)) < 0)
+                        err = ret;
+                obj->mmo_ops->put(obj);
+                goto list_start;
+        } list_iterate_end();
+        return err;
+}
+
+/*
+ * Clean all allocated pages (that is, all pages that are not free),
+ * pinned ones included. This is called by sync(2).
+ */
+void
+pframe_clean_all()
+{
+        uint32_t start = tsc_ticks();
+        int ret, pret;
+        dbg(DBG_PFRAME, "pframe_clean_all: starting (this may take a while)\n");
+
+        pframe_harvest_list(NULL);
+        ret = pframe_clean_list(NULL);
+        if ((pret = pframe_clean_pinned(NULL, start)) < 0)
+                ret = pret;
+        if (ret < 0)
+                dbg(DBG_PFRAME, "pframe_clean_all: write-back failed: %d\n", ret);
+        else
+                dbg(DBG_PFRAME, "pframe_clean_all: completed!\n");
+}
+
+/*
+ * Clean every dirty page of one object, pinned ones included. This is
+ * what fsync(2) is made of.
+ *
+ * This routine can block at the mmobj operation level.
+ * @param o the object whose pages are to be written back
+ * @return 0 on success, -errno of a page that failed to write
+ */
+int
+pframe_clean_obj(mmobj_t *o)
+{
+        uint32_t start = tsc_ticks();
+        int ret, pret;
+
+        KASSERT(NULL != o);
+        pframe_harvest_list(o);
+        ret = pframe_clean_list(o);
+        if ((pret = pframe_clean_pinned(o, start)) < 0)
+                ret = pret;
+        return ret;
+}
+
+/*
+ * Make the dirty page pf look as if it had been dirty for longer than
+ * dirty_expire, so that pflushd writes it back on its next pass.
+ */
+static void
+pframe_expire(pframe_t *pf)
+{
+        pframe_desc(pf)->pd_dirtied = tsc_ticks() - dirty_expire;
+        if (list_link_is_linked(&pframe_desc(pf)->pd_dlink)) {
+                pframe_dirty_unlink(pf);
+                pframe_dirty_link(pf);
+        }
+}
+
+/* Dirty pages looked up at a time by pframe_sync_range() */
+#define PFRAME_SYNC_BATCH       16
+
+/*
+ * Write back the dirty pages [first, last] of the file object o, and only
+ * those: flushing one page costs one write. This is what msync(2) is made
+ * of. The pages are written in page order, a batch at a time, the way
+ * pageout writes a cluster.
+ *
+ * With async set, the pages are handed to pflushd instead: they are made
+ * to look expired and pflushd is woken. Pages that mlock(2) pinned are
+ * kept on a list of their own (see pframe_clean_pinned()), and are
+ * written right away either way. Pages that are busy are waited for, unless async is set.
+ *
+ * This routine can block at the mmobj operation level.
+ * @return 0 on success, -errno of the last page that failed to write
+ */
+int
+pframe_sync_range(mmobj_t *o, uint32_t first, uint32_t last, int async)
+{
+        pframe_t *pfs[PFRAME_SYNC_BATCH], *run[PFRAME_SYNC_BATCH];
+        uint32_t n, i, nrun, next;
+        int ret, expired = 0, done = 0, err = 0;
+
+        KASSERT(!anon_is_anon(o) && NULL == o->mmo_shadowed);
+
+        /* find the pages written through writable mappings first */
+        next = first;
+        while (0 != nwmapped && next <= last
+               && 0 != (n = pframe_gang_lookup(o, next, last, pfs, PFRAME_SYNC_BATCH))) {
+                for (i = 0; i < n; ++i)
+                        pframe_harvest_page(pfs[i]);
+                if (pfs[n - 1]->pf_pagenum == last)
+                        break;
+                next = pfs[n - 1]->pf_pagenum + 1;
+        }
+
+        while (!done && first <= last
+               && 0 != (n = pframe_gang_lookup_dirty(o, first, last, pfs, PFRAME_SYNC_BATCH))) {
+                for (i = 0, nrun = 0; i < n && !pframe_is_busy(pfs[i]); ++i) {
+                        if (async && !pframe_is_pinned(pfs[i])) {
+                                pframe_expire(pfs[i]);
+                                expired = 1;
+                        } else {
+                                run[nrun++] = pfs[i];
+                        }
+                }
+
+                /* a busy page is looked up again once it is done; pages
+                 * that failed to write are not */
+                next = (i < n) ? pfs[i]->pf_pagenum : pfs[n - 1]->pf_pagenum + 1;
+                done = (i == n && pfs[n - 1]->pf_pagenum == last);
+
+                if (nrun > 0) {
+                        /* see pageoutd_clean_cluster() */
+                        o->mmo_ops->ref(o);
+                        if ((ret = pframe_clean_run(run, nrun)) < 0)
+                                err = ret;
+                        o->mmo_ops->put(o);
+                }
+                if (i < n) {
+                        if (async)
+                                done = (next++ == last);
+                        else if (pframe_is_busy(pfs[i]))
+                                sched_sleep_on(pframe_waitq(pfs[i]));
+                }
+                first = next;
+        }
+
+        if (expired && NULL != pflushd_thr)
+                pflushd_wakeup();
+        return err;
+}
+
+/*
+ * Free a page on behalf of the pager, letting the replacement policy
+ * remember it first.
+ */
+static void
+pframe_reclaim(pframe_t *pf)
+{
+        if (NULL != pframe_policy->pp_evict)
+                pframe_policy->pp_evict(pf);
+        pframe_free(pf);
+}
+
+/* Pages pframe_reclaim_owner() gives up on before it stops trying */
+#define PFRAME_RECLAIM_MAXFAIL  8
+
+/*
+ * Reclaim up to 'target' unpinned pages charged to the given process,
+ * cleaning them first if they are dirty. This is called on the fault path
+ * of a process that is at its resident limit, so that it pays for its own
+ * memory pressure instead of taking pages away from everybody else.
+ *
+ * A page that fails to write back is skipped from then on, and at most
+ * 2 * target pages are cleaned, so that pages that will not come clean
+ * (or are dirtied again as fast as they are cleaned) cannot keep the
+ * caller here.
+ *
+ * Returns the number of pages actually freed.
+ */
+int
+pframe_reclaim_owner(pid_t pid, int target)
+{
+        pframe_t *pf, *failed[PFRAME_RECLAIM_MAXFAIL];
+        int nfreed = 0, ncleaned = 0, nfailed = 0, i;
+
+list_start:
+        if (nfreed >= target)
+                goto out;
+        list_iterate_begin(&alloc_list, pf, pframe_t, pf_link) {
+                if (pframe_desc(pf)->pd_owner != pid || pframe_is_busy(pf))
+                        continue;
+                for (i = 0; i < nfailed && failed[i] != pf; ++i)
+                        ;
+                if (i < nfailed)
+                        continue;
+                pframe_harvest_page(pf);
                 if (pframe_is_dirty(pf)) {
-                        pframe_clean(pf);
+                        if (ncleaned++ >= 2 * target)
+                                goto out;
+                        /* blocks, so start over afterwards */
+                        if (0 > pframe_clean(pf)) {
+                                if (nfailed == PFRAME_RECLAIM_MAXFAIL)
+                                        goto out;
+                                failed[nfailed++] = pf;
+                        }
                         goto list_start;
                 }
+                pframe_reclaim(pf);
+                if (++nfreed >= target)
+                        goto out;
+                /* pframe_free may block in the mmobj put operation */
+                goto list_start;
         } list_iterate_end();
 
-        /* In theory, this function might never terminate (if new pages are
-         * constantly being added at the same time). That's why the user shouldn't
-         * call sync(2) very much... */
-        dbg(DBG_PFRAME, "pframe_clean_all: completed!\n");
+out:
+        memlimit_reclaimed(pid, nfreed);
+        return nfreed;
+}
+
+/*
+ * Returns the number of pinned pages charged to the given process. They
+ * cannot be reclaimed, whether they are locked with mlock(2) or are
+ * anonymous memory with no swap to go to.
+ */
+uint32_t
+pframe_owner_pinned(pid_t pid)
+{
+        pframe_t *pf;
+        uint32_t n = 0;
+
+        list_iterate_begin(&pinned_list, pf, pframe_t, pf_link) {
+                if (pframe_desc(pf)->pd_owner == pid)
+                        n++;
+        } list_iterate_end();
+        return n;
+}
+
+/*
+ * Forget the owner of every page charged to the given (exiting) process.
+ * The pages themselves stay cached.
+ */
+void
+pframe_disown(pid_t pid)
+{
+        pframe_t *pf;
+        list_iterate_begin(&alloc_list, pf, pframe_t, pf_link) {
+                if (pframe_desc(pf)->pd_owner == pid)
+                        pframe_desc(pf)->pd_owner = -1;
+        } list_iterate_end();
+        list_iterate_begin(&pinned_list, pf, pframe_t, pf_link) {
+                if (pframe_desc(pf)->pd_owner == pid)
+                        pframe_desc(pf)->pd_owner = -1;
+        } list_iterate_end();
+}
+
+/* Physical address of the frame a page table entry maps */
+#define pframe_pte_phys(pte)    ((pte) & ~(PAGE_SIZE - 1))
+
+/*
+ * The entry pte, about to be removed, maps page pagenum of vma's bottom
+ * object. If it maps a page on the WMAPPED list and the page has been
+ * written through it, the page is dirtied, lest the write be lost.
+ */
+static void
+pframe_harvest_pte(vmarea_t *vma, uint32_t pagenum, uint32_t pte)
+{
+        pframe_t *pf;
+
+        if (0 == nwmapped || (pte & (PT_PRESENT | PT_DIRTY)) != (PT_PRESENT | PT_DIRTY))
+                return;
+        pf = pframe_hash_find(mmobj_bottom_obj(vma->vma_obj), pagenum);
+        if (NULL == pf || !list_link_is_linked(&pframe_desc(pf)->pd_wmlink)
+            || pframe_pte_phys(pte) != pt_virt_to_phys((uintptr_t) pf->pf_addr))
+                return;
+        wmapped_nharvested++;
+        pframe_mark_dirty(pf);
+}
+
+/*
+ * Harvest the dirty bits of the pages [lopage, hipage) of the address
+ * space before they are unmapped. Only shared mappings map file pages
+ * writable.
+ */
+void
+pframe_harvest_unmap(vmmap_t *map, uint32_t lopage, uint32_t hipage)
+{
+        pagedir_t *pd;
+        vmarea_t *vma;
+        uint32_t vfn, end, *pte;
+
+        if (0 == nwmapped || NULL == map->vmm_proc)
+                return;
+        pd = map->vmm_proc->p_pagedir;
+
+        list_iterate_begin(&map->vmm_list, vma, vmarea_t, vma_plink) {
+                if (vma->vma_end <= lopage || vma->vma_start >= hipage
+                    || MAP_SHARED != (vma->vma_flags & MAP_TYPE))
+                        continue;
+                end = MIN(hipage, vma->vma_end);
+                for (vfn = MAX(lopage, vma->vma_start); vfn < end; ++vfn) {
+                        if (NULL != (pte = hugepage_pte(pd, (uintptr_t) PN_TO_ADDR(vfn))))
+                                pframe_harvest_pte(vma, vfn - vma->vma_start + vma->vma_off, *pte);
+                }
+        } list_iterate_end();
+}
+
+typedef struct pframe_harvest {
+        pframe_t        *ph_pf;
+        tlb_gather_t    *ph_tg;
+        int             ph_dirty;       /* a mapping had written the page */
+        int             ph_writable;    /* a mapping may still write it */
+} pframe_harvest_t;
+
+static void
+pframe_harvest_vma(vmarea_t *vma, uint32_t pagenum, void *arg)
+{
+        pframe_harvest_t *ph = (pframe_harvest_t *) arg;
+        uintptr_t vaddr = (uintptr_t) PN_TO_ADDR(vma->vma_start + pagenum - vma->vma_off);
+        pagedir_t *pd;
+        uint32_t *pte;
+
+        if (NULL == vma->vma_vmmap->vmm_proc)
+                return;
+        pd = vma->vma_vmmap->vmm_proc->p_pagedir;
+
+        /* the area may map nothing there, or a copy of the page */
+        if (NULL == (pte = hugepage_pte(pd, vaddr)) || !(*pte & PT_PRESENT)
+            || pframe_pte_phys(*pte) != pt_virt_to_phys((uintptr_t) ph->ph_pf->pf_addr))
+                return;
+        if (*pte & PT_DIRTY) {
+                *pte &= ~PT_DIRTY;
+                tlb_gather_page(ph->ph_tg, pd, vaddr);
+                ph->ph_dirty = 1;
+        }
+        if (*pte & PT_WRITE)
+                ph->ph_writable = 1;
+}
+
+/*
+ * Clear the dirty bits of every mapping of the file page pf and return
+ * whether any of them was set. The page goes on the WMAPPED list if it is
+ * still mapped writable anywhere, and off it otherwise.
+ */
+static int
+pframe_harvest(pframe_t *pf, tlb_gather_t *tg)
+{
+        pframe_harvest_t ph = { pf, tg, 0, 0 };
+
+        rmap_foreach(pf->pf_obj, pf->pf_pagenum, pframe_harvest_vma, &ph);
+        if (!ph.ph_writable) {
+                pframe_wmapped_unlink(pf);
+        } else if (!list_link_is_linked(&pframe_desc(pf)->pd_wmlink)) {
+                list_insert_tail(&wmapped_list, &pframe_desc(pf)->pd_wmlink);
+                nwmapped++;
+        }
+        return ph.ph_dirty;
+}
+
+/* Dirty pf if it is on the WMAPPED list and has been written since. */
+static void
+pframe_harvest_page(pframe_t *pf)
+{
+        tlb_gather_t tg;
+
+        if (!list_link_is_linked(&pframe_desc(pf)->pd_wmlink))
+                return;
+        tlb_gather_init(&tg);
+        if (pframe_harvest(pf, &tg)) {
+                wmapped_nharvested++;
+                pframe_mark_dirty(pf);
+        }
+        tlb_gather_finish(&tg);
+}
+
+/*
+ * Harvest the pages on the WMAPPED list, or only those of o if it is not
+ * NULL. Does not block.
+ */
+static void
+pframe_harvest_list(mmobj_t *o)
+{
+        pframe_desc_t *pd;
+        tlb_gather_t tg;
+
+        tlb_gather_init(&tg);
+        list_iterate_begin(&wmapped_list, pd, pframe_desc_t, pd_wmlink) {
+                if (NULL != o && pd->pd_pframe.pf_obj != o)
+                        continue;
+                if (pframe_harvest(&pd->pd_pframe, &tg)) {
+                        wmapped_nharvested++;
+                        pframe_mark_dirty(&pd->pd_pframe);
+                }
+        } list_iterate_end();
+        tlb_gather_finish(&tg);
+
+        if (NULL == o)
+                wmapped_scanned = tsc_ticks();
+}
+
+/*
+ * Make sure the next write to pf, which is about to be written back, is
+ * noticed. Pages of anon and shadow objects are unmapped, so that the
+ * write faults. File pages stay mapped, with the dirty bits of their
+ * mappings cleared for the MMU to set again (see the WMAPPED list).
+ */
+static void
+pframe_clean_mappings(pframe_t *pf, tlb_gather_t *tg)
+{
+        if (pframe_swap_backed(pf))
+                pframe_unmap_gather(pf, tg);
+        else
+                pframe_harvest(pf, tg);
+}
+
+static void
+pframe_unmap_vma(vmarea_t *vma, uint32_t pagenum, void *arg)
+{
+        /* Get the virtual address in the area corresponding to this page */
+        uintptr_t vaddr = (uintptr_t) PN_TO_ADDR(vma->vma_start + pagenum - vma->vma_off);
+        uint32_t *pte;
+
+        /* And unmap it from that area's proc, taking down any large page
+         * that covers it first */
+        if (NULL != vma->vma_vmmap->vmm_proc) {
+                pagedir_t *pd = vma->vma_vmmap->vmm_proc->p_pagedir;
+                hugepage_unmap_range(pd, vaddr, vaddr + PAGE_SIZE);
+                if (NULL != (pte = hugepage_pte(pd, vaddr)))
+                        pframe_harvest_pte(vma, pagenum, *pte);
+                pt_unmap(pd, vaddr);
+                tlb_gather_page((tlb_gather_t *) arg, pd, vaddr);
+        }
+}
+
+/*
+ * Unmap page pagenum of o from every process that maps the object, no
+ * matter which frame it maps there: the page itself, or a frame shared
+ * with other pages such as the zero page. The reverse map only hands us
+ * the areas that cover the page, not every mapper of the object.
+ */
+void
+pframe_unmap_page(mmobj_t *o, uint32_t pagenum)
+{
+        tlb_gather_t tg;
+
+        tlb_gather_init(&tg);
+        rmap_foreach(o, pagenum, pframe_unmap_vma, &tg);
+        tlb_gather_finish(&tg);
+}
+
+/* Unmap pf like pframe_remove_from_pts(), leaving the TLB entries to be
+ * invalidated by the caller along with those of other pages */
+static void
+pframe_unmap_gather(pframe_t *pf, tlb_gather_t *tg)
+{
+        rmap_foreach(pf->pf_obj, pf->pf_pagenum, pframe_unmap_vma, tg);
 }
 
 /* Remove a page frame from the page tables of all processes that map it
@@ -599,19 +2167,53 @@ list_start:
 void
 pframe_remove_from_pts(pframe_t *pf)
 {
-        vmarea_t *vma;
-        list_iterate_begin(mmobj_bottom_vmas(pf->pf_obj), vma, vmarea_t, vma_olink) {
-                /* Get the virtual address in the area corresponding to this pf */
-                if ((pf->pf_pagenum >= vma->vma_off)
-                    && (pf->pf_pagenum < vma->vma_off + (vma->vma_end - vma->vma_start))) {
-                        uintptr_t vaddr = (uintptr_t) PN_TO_ADDR(vma->vma_start + pf->pf_pagenum - vma->vma_off);
-                        /* And unmap it from that area's proc */
-                        if (NULL != vma->vma_vmmap->vmm_proc) {
-                                pt_unmap(vma->vma_vmmap->vmm_proc->p_pagedir, vaddr);
-                        }
-                }
+        pframe_unmap_page(pf->pf_obj, pf->pf_pagenum);
+}
+
+/* ------------------------------------------------------------------ */
+/* ---------------------- REPLACEMENT POLICIES ---------------------- */
+/* ------------------------------------------------------------------ */
 
+/*
+ * Make the named policy the current one, handing every reclaimable page
+ * over from the old policy. Returns 0 on success or -EINVAL if there is
+ * no such policy.
+ */
+static int
+pframe_policy_select(const char *name)
+{
+        pframe_policy_t *pol = NULL;
+        pframe_t *pf;
+        uint32_t i;
+
+        for (i = 0; i < pframe_npolicies; ++i) {
+                if (0 == strcmp(name, pframe_policies[i].pp_name))
+                        pol = &pframe_policies[i];
+        }
+        if (NULL == pol)
+                return -EINVAL;
+        if (pol == pframe_policy)
+                return 0;
+
+        if (NULL != pframe_policy) {
+                list_iterate_begin(&alloc_list, pf, pframe_t, pf_link) {
+                        pframe_policy->pp_remove(pf);
+                } list_iterate_end();
+                if (NULL != pframe_policy->pp_fini)
+                        pframe_policy->pp_fini();
+        }
+
+        pol->pp_init(pframe_npages);
+        pol->pp_hits = 0;
+        pol->pp_misses = 0;
+        list_iterate_begin(&alloc_list, pf, pframe_t, pf_link) {
+                pframe_desc(pf)->pd_queue = 0;
+                pol->pp_insert(pf, 0);
         } list_iterate_end();
+
+        pframe_policy = pol;
+        dbg(DBG_PFRAME, "page replacement policy is now %s\n", pol->pp_name);
+        return 0;
 }
 
 /* ------------------------------------------------------------------ */
@@ -654,7 +2256,85 @@ pageoutd_exit()
 }
 
 /*
- * The pageout daemon, when run, gets the least-recently-requested page from the
+ * Pick the page pageoutd should reclaim next: the first page near the
+ * head of alloc_list that is charged to a process over its resident limit,
+ * or the replacement policy's choice if there is no such page.
+ */
+static pframe_t *
+pageoutd_victim(void)
+{
+        pframe_t *pf;
+        int nscanned = 0;
+
+        /* pages whose contents nobody wants go first */
+        if (!list_empty(&lazyfree_list))
+                return &list_head(&lazyfree_list, pframe_desc_t, pd_lflink)->pd_pframe;
+
+        list_iterate_begin(&alloc_list, pf, pframe_t, pf_link) {
+                if (nscanned++ >= PAGEOUTD_OWNER_SCAN)
+                        break;
+                if (-1 != pframe_desc(pf)->pd_owner
+                    && memlimit_rss_exceeded(pframe_desc(pf)->pd_owner))
+                        return pf;
+        } list_iterate_end();
+
+        pf = pframe_policy->pp_victim();
+        KASSERT(NULL != pf && "alloc_list and policy queues disagree");
+        return pf;
+}
+
+/* True if pf could be written back together with a cluster. */
+#define pageoutd_clusterable(pf) \
+        (NULL != (pf) && pframe_is_dirty(pf) && !pframe_is_busy(pf) && !pframe_is_pinned(pf))
+
+/*
+ * Clean the dirty page pf together with the run of dirty pages around it
+ * in the same object, at most pageout_cluster pages in all.
+ */
+static int
+pageoutd_clean_cluster(pframe_t *pf)
+{
+        pframe_t *near[2 * PAGEOUT_CLUSTER_MAX - 1];
+        uint32_t pn = pf->pf_pagenum, span = pageout_cluster - 1;
+        uint32_t first, last, n, lo, hi;
+        mmobj_t *o = pf->pf_obj;
+        int ret;
+
+        /* one tagged walk of the object's index finds every dirty page
+         * that could end up in the run. Nothing here blocks, so the pages
+         * found stay put until pframe_clean_run() marks them busy. */
+        first = (pn >= span) ? pn - span : 0;
+        last = (pn <= (uint32_t) -1 - span) ? pn + span : (uint32_t) -1;
+        n = pframe_gang_lookup_dirty(o, first, last, near, 2 * span + 1);
+        for (lo = 0; lo < n && near[lo] != pf; ++lo)
+                ;
+        KASSERT(lo < n && "dirty page missing from its object's index");
+
+        /* grow the run downwards, then upwards */
+        hi = lo;
+        while (hi - lo + 1 < pageout_cluster && lo > 0
+               && near[lo - 1]->pf_pagenum + 1 == near[lo]->pf_pagenum
+               && pageoutd_clusterable(near[lo - 1]))
+                lo--;
+        while (hi - lo + 1 < pageout_cluster && hi + 1 < n
+               && near[hi + 1]->pf_pagenum == near[hi]->pf_pagenum + 1
+               && pageoutd_clusterable(near[hi + 1]))
+                hi++;
+
+        pageout_nclusters++;
+        pageout_nclustered += hi - lo + 1;
+
+        /* keep the object alive while its pages are written: the last
+         * reference to an anon or shadow object may go away meanwhile,
+         * and its teardown must not find the pages busy */
+        o->mmo_ops->ref(o);
+        ret = pframe_clean_run(&near[lo], hi - lo + 1);
+        o->mmo_ops->put(o);
+        return ret;
+}
+
+/*
+ * The pageout daemon, when run, gets the replacement policy's victim from the
  * list of pages which are available to be paged out. Make sure to check if the
  * page is busy before yanking it. If the page you select is dirty, make sure
  * to clean it before yanking it. Finally, go back to sleep after having paged
@@ -666,20 +2346,28 @@ pageoutd_run(int arg1, void *arg2)
 {
         while (1) {
                 KASSERT(nallocated >= 0);
+                /* zeroed pages are the cheapest to give back */
+                pframe_zero_drain();
                 while ((!pageoutd_target_met()) && (!list_empty(&alloc_list))) {
                         pframe_t *pf;
 
-                        /* obtain least-recently-requested page: */
-                        pf = list_head(&alloc_list, pframe_t, pf_link);
+                        /* obtain the page the replacement policy wants to
+                         * give up, preferring pages of processes over
+                         * their resident limit: */
+                        pf = pageoutd_victim();
+
+                        /* a write through a writable mapping only shows
+                         * once the dirty bits are harvested */
+                        pframe_harvest_page(pf);
 
                         if (pframe_is_busy(pf)) {
-                                sched_sleep_on(&pf->pf_waitq);
+                                sched_sleep_on(pframe_waitq(pf));
                         } else if (pframe_is_dirty(pf)) {
-                                pframe_clean(pf);
+                                pageoutd_clean_cluster(pf);
                         } else {
-                                /* it's not busy, it's clean, and it's
-                                 * least-recently-requested; reclaim it: */
-                                pframe_free(pf);
+                                /* it's not busy, it's clean, and the
+                                 * policy picked it; reclaim it: */
+                                pframe_reclaim(pf);
                         }
                 }
 
@@ -701,3 +2389,308 @@ pageoutd_run(int arg1, void *arg2)
         }
         return NULL;
 }
+
+/* ------------------------------------------------------------------ */
+/* ----------------------- DIRTY PAGE FLUSHER ----------------------- */
+/* ------------------------------------------------------------------ */
+
+static __attribute__((unused)) void
+pflushd_init(void)
+{
+        sched_queue_init(&pflushd_waitq);
+
+        KASSERT(curproc && (PID_IDLE == curproc->p_pid)
+                && "should be calling this from idleproc");
+        pflushd = proc_create("pflushd");
+        KASSERT(NULL != pflushd);
+        pflushd_thr = kthread_create(pflushd, pflushd_run, 0, NULL);
+        KASSERT(NULL != pflushd_thr);
+
+        sched_make_runnable(pflushd_thr);
+}
+init_func(pflushd_init);
+init_depends(sched_init);
+
+static void
+pflushd_exit()
+{
+        KASSERT(NULL != pflushd_thr);
+        kthread_cancel(pflushd_thr, (void *) 0);
+        pflushd_thr = NULL;
+}
+
+/*
+ * Called by the scheduler each time it finds the run queue empty, before
+ * it waits for an interrupt. Since nothing else wakes pflushd on a
+ * schedule, this is where expired dirty pages are noticed when the system
+ * is otherwise quiet, and where pages written through writable mappings
+ * are found. Must not block.
+ */
+void
+pframe_idle(void)
+{
+        if (0 != nwmapped && tsc_ticks() - wmapped_scanned >= dirty_expire / 2)
+                pframe_harvest_list(NULL);
+        if (NULL != pflushd_thr && (pflushd_needed() || pinned_dirty_expired()))
+                pflushd_wakeup();
+        pframe_zero_refill(ZERO_POOL_BATCH);
+}
+
+/*
+ * The flusher writes back dirty pages, oldest first, while any of them
+ * has been dirty for longer than dirty_expire or while more than
+ * dirty_background_ratio percent of memory is dirty. Each page is
+ * written together with its dirty neighbours, like pageoutd does.
+ * Both arguments unused.
+ */
+static void *
+pflushd_run(int arg1, void *arg2)
+{
+        while (1) {
+                while (pflushd_needed()) {
+                        pframe_t *pf = &list_head(&dirty_list, pframe_desc_t, pd_dlink)->pd_pframe;
+
+                        if (pframe_is_busy(pf)) {
+                                sched_sleep_on(pframe_waitq(pf));
+                                continue;
+                        }
+
+                        uint32_t before = pageout_nclustered;
+                        pageoutd_clean_cluster(pf);
+                        pflushd_nwritten += pageout_nclustered - before;
+                        pflushd_progress++;
+                        sched_broadcast_on(&dirty_waitq);
+
+                        /* a page that could not be written is back at the
+                         * tail of dirty_list; leave the rest for later
+                         * rather than spinning on a failing device */
+                        if (pframe_is_dirty(pf) && !pframe_is_busy(pf))
+                                break;
+                }
+
+                /* pinned pages are only written once they expire; they
+                 * take no part in the dirty ratios, as pageout cannot
+                 * free them anyway */
+                if (pinned_dirty_expired())
+                        pframe_clean_pinned(NULL, tsc_ticks() - dirty_expire);
+
+                /* let throttled writers re-check */
+                sched_broadcast_on(&dirty_waitq);
+
+                if (sched_cancellable_sleep_on(&pflushd_waitq))
+                        kthread_exit((void *)0);
+        }
+        return NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/* ------------------------ PRE-ZEROED PAGES ------------------------ */
+/* ------------------------------------------------------------------ */
+
+/*
+ * Zero up to max free pages into the pool, stopping once it holds
+ * zero_pool_target pages or free memory runs down to pageoutd's target.
+ * Called from the idle loop a batch at a time, and by idleproc to fill
+ * the pool before init starts.
+ */
+void
+pframe_zero_refill(uint32_t max)
+{
+        void *page;
+
+        while (max-- > 0 && zero_pool_count < zero_pool_target
+               && page_free_count() > nfreepages_target) {
+                if (NULL == (page = page_alloc()))
+                        break;
+                memset(page, 0, PAGE_SIZE);
+                zero_pool[zero_pool_count++] = page;
+                zero_pool_nzeroed++;
+        }
+}
+
+/* Give every pooled page back to the free list. */
+static void
+pframe_zero_drain(void)
+{
+        while (zero_pool_count > 0)
+                page_free(zero_pool[--zero_pool_count]);
+}
+
+/*
+ * Zero the contents of a page that is being filled. Anonymous pages were
+ * usually given a frame from the pool by pframe_alloc(), in which case
+ * there is nothing left to do.
+ */
+void
+pframe_zero(pframe_t *pf)
+{
+        KASSERT(pframe_is_busy(pf));
+
+        if (pframe_desc(pf)->pd_zeroed) {
+                pframe_desc(pf)->pd_zeroed = 0;
+                zero_pool_hits++;
+        } else {
+                memset(pf->pf_addr, 0, PAGE_SIZE);
+                zero_pool_misses++;
+        }
+}
+
+/* ------------------------------------------------------------------ */
+/* ------------------------ PAGE FILL WORKERS ----------------------- */
+/* ------------------------------------------------------------------ */
+
+static __attribute__((unused)) void
+pfilld_init(void)
+{
+        int i;
+
+        sched_queue_init(&pfilld_waitq);
+
+        KASSERT(curproc && (PID_IDLE == curproc->p_pid)
+                && "should be calling this from idleproc");
+        for (i = 0; i < PFILL_NWORKERS; ++i) {
+                pfilld[i] = proc_create("pfilld");
+                KASSERT(NULL != pfilld[i]);
+                pfilld_thr[i] = kthread_create(pfilld[i], pfilld_run, i, NULL);
+                KASSERT(NULL != pfilld_thr[i]);
+                sched_make_runnable(pfilld_thr[i]);
+        }
+}
+init_func(pfilld_init);
+init_depends(sched_init);
+
+static void
+pfilld_exit()
+{
+        int i;
+
+        KASSERT(list_empty(&pfill_queue));
+        for (i = 0; i < PFILL_NWORKERS; ++i) {
+                KASSERT(NULL != pfilld_thr[i]);
+                kthread_cancel(pfilld_thr[i], (void *) 0);
+                pfilld_thr[i] = NULL;
+        }
+}
+
+/*
+ * A page fill worker takes busy pages queued by pframe_get_async() and
+ * fills them, then wakes whoever is waiting on the page. A page that
+ * fails to fill is freed here, since nobody else owns it; threads that
+ * were waiting for it look it up again and retry the fill themselves.
+ * arg1 is the worker's index, arg2 unused.
+ */
+static void *
+pfilld_run(int arg1, void *arg2)
+{
+        pframe_t *pf;
+        int ret;
+
+        while (1) {
+                while (list_empty(&pfill_queue)) {
+                        if (sched_cancellable_sleep_on(&pfilld_waitq))
+                                kthread_exit((void *)0);
+                }
+                pf = &list_head(&pfill_queue, pframe_desc_t, pd_fillq)->pd_pframe;
+                list_remove(&pframe_desc(pf)->pd_fillq);
+                pfill_npending--;
+                KASSERT(pframe_is_busy(pf));
+
+                if (++pfill_inflight > pfill_maxinflight)
+                        pfill_maxinflight = pfill_inflight;
+                ret = pf->pf_obj->mmo_ops->fillpage(pf->pf_obj, pf);
+                pfill_inflight--;
+
+                pframe_unbusy(pf);
+                sched_broadcast_on(pframe_waitq(pf));
+
+                if (ret < 0) {
+                        dbg(DBG_PFRAME, "pfilld %d: filling page %d of obj %p failed: %d\n",
+                            arg1, pf->pf_pagenum, pf->pf_obj, ret);
+                        pfill_nerrors++;
+                        pframe_free(pf);
+                }
+        }
+        return NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/* ------------------------- KSHELL COMMANDS ------------------------ */
+/* ------------------------------------------------------------------ */
+#ifdef __DRIVERS__
+
+/*
+ * pframe                     - show page cache statistics
+ * pframe resize <buckets>    - rebuild the resident page hash
+ * pframe policy [<name>]     - list or switch page replacement policies
+ * pframe tune [<name> <val>] - list or set run-time tunables
+ */
+static int
+pframe_kshell(kshell_t *ksh, int argc, char **argv)
+{
+        uint32_t n;
+        char *buf;
+        int err;
+
+        if (2 <= argc && 0 == strcmp(argv[1], "tune")) {
+                if (2 == argc) {
+                        for (n = 0; n < PFRAME_NTUNABLES; ++n)
+                                kprintf(ksh, "%-20s %u [%u-%u]\n", pframe_tunables[n].pt_name,
+                                        *pframe_tunables[n].pt_val, pframe_tunables[n].pt_min,
+                                        pframe_tunables[n].pt_max);
+                        return 0;
+                }
+                if (4 == argc) {
+                        for (n = 0; n < PFRAME_NTUNABLES; ++n) {
+                                pframe_tunable_t *t = &pframe_tunables[n];
+                                uint32_t v;
+                                if (0 != strcmp(argv[2], t->pt_name))
+                                        continue;
+                                if (parse_uint(argv[3], &v) || v < t->pt_min || v > t->pt_max)
+                                        kprintf(ksh, "pframe: %s must be in [%u-%u]\n",
+                                                t->pt_name, t->pt_min, t->pt_max);
+                                else
+                                        *t->pt_val = v;
+                                return 0;
+                        }
+                }
+                kprintf(ksh, "pframe: usage: pframe tune [<name> <value>]\n");
+                return 0;
+        } else if (2 <= argc && 0 == strcmp(argv[1], "policy")) {
+                if (2 == argc) {
+                        for (n = 0; n < pframe_npolicies; ++n)
+                                kprintf(ksh, "%c %s\n",
+                                        (&pframe_policies[n] == pframe_policy) ? '*' : ' ',
+                                        pframe_policies[n].pp_name);
+                } else if (pframe_policy_select(argv[2]) < 0) {
+                        kprintf(ksh, "pframe: no policy named %s\n", argv[2]);
+                }
+                return 0;
+        } else if (3 == argc && 0 == strcmp(argv[1], "resize")) {
+                if (parse_uint(argv[2], &n) || 0 == n || n > PF_HASH_MAX) {
+                        kprintf(ksh, "pframe: bucket count must be 1-%d\n", PF_HASH_MAX);
+                } else if ((err = pframe_hash_resize(n)) < 0) {
+                        kprintf(ksh, "pframe: %s\n", strerror(-err));
+                }
+                return 0;
+        } else if (1 != argc) {
+                kprintf(ksh, "usage: pframe [resize <buckets> | policy [<name>] | tune [<name> <value>]]\n");
+                return 0;
+        }
+
+        if (NULL == (buf = page_alloc()))
+                return -ENOMEM;
+        pframe_info(NULL, buf, PAGE_SIZE);
+        kprintf(ksh, "%s", buf);
+        page_free(buf);
+        return 0;
+}
+
+static __attribute__((unused)) void
+pframe_kshell_init(void)
+{
+        kshell_add_command("pframe", pframe_kshell, "show page cache statistics");
+}
+init_func(pframe_kshell_init);
+init_depends(kshell_init);
+
+#endif /* __DRIVERS__ */
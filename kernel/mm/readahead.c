@@ -0,0 +1,296 @@
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/list.h"
+#include "util/string.h"
+#include "util/parse.h"
+
+#include "mm/mmobj.h"
+#include "mm/page.h"
+#include "mm/pframe.h"
+#include "mm/pframe_ext.h"
+#include "mm/readahead.h"
+#include "mm/fileobj.h"
+
+#include "fs/vfs.h"
+#include "fs/vnode.h"
+
+#include "test/kshell/kshell.h"
+#include "test/kshell/io.h"
+
+/*
+ * Returns the vnode whose mmobj o is, or NULL if o is no file's (see
+ * mm/fileobj.h).
+ */
+vnode_t *
+mmobj_vnode(mmobj_t *o)
+{
+        if (NULL == vfs_root_vn || vfs_root_vn->vn_mmobj.mmo_ops != o->mmo_ops)
+                return NULL;
+        return CONTAINER_OF(o, vnode_t, vn_mmobj);
+}
+
+/*
+ * Returns the number of pages of the file whose mmobj o is, counting a
+ * partial last page, or 0 if o is no file's.
+ */
+uint32_t
+mmobj_file_npages(mmobj_t *o)
+{
+        vnode_t *vn = mmobj_vnode(o);
+
+        if (NULL == vn)
+                return 0;
+        return ADDR_TO_PN(PAGE_ALIGN_UP(vn->vn_len));
+}
+
+/*
+ * Read-ahead state of one stream. There is no hook for the destruction
+ * of a file_t, so instead of living as long as their key, records come
+ * from a fixed pool and the least recently used one is recycled when a
+ * new stream shows up. Losing the state of an idle stream only costs it
+ * its window.
+ */
+typedef struct ra_state {
+        const void     *ra_key;
+        mmobj_t        *ra_obj;         /* object the stream reads from */
+        uint32_t        ra_next;        /* page a sequential reader asks for next */
+        uint32_t        ra_size;        /* current window, 0 if not sequential */
+        uint32_t        ra_first;       /* read ahead and not yet used: */
+        uint32_t        ra_end;         /*   [ra_first, ra_end) */
+        uint32_t        ra_mark;        /* reaching this page starts the next window */
+        list_link_t     ra_hlink;
+        list_link_t     ra_lru;
+} ra_state_t;
+
+#define RA_NSTATES      64
+#define RA_HASH_SIZE    16
+#define ra_hash(key)    ((((uint32_t)(key)) >> 4) % RA_HASH_SIZE)
+
+static ra_state_t ra_states[RA_NSTATES];
+static list_t ra_hash[RA_HASH_SIZE];
+static list_t ra_lru;                   /* most recently used first */
+
+/* Window sizes in pages. Read-ahead is cut down so that it never takes
+ * more than 1/RA_FREE_SHARE of the free pages, and stops altogether
+ * below RA_FREE_MIN free pages. */
+#define RA_MIN_WINDOW   4
+#define RA_FREE_SHARE   16
+#define RA_FREE_MIN     64
+static uint32_t readahead_max = 32;
+
+/* statistics */
+static uint32_t readahead_npages;       /* pages brought in ahead of use */
+static uint32_t readahead_hits;         /* ... that were still resident when used */
+static uint32_t readahead_misses;       /* ... that had been reclaimed before use */
+
+static __attribute__((unused)) void
+readahead_init(void)
+{
+        int i;
+
+        list_init(&ra_lru);
+        for (i = 0; i < RA_HASH_SIZE; ++i)
+                list_init(&ra_hash[i]);
+        for (i = 0; i < RA_NSTATES; ++i) {
+                ra_states[i].ra_key = NULL;
+                list_link_init(&ra_states[i].ra_hlink);
+                list_insert_tail(&ra_lru, &ra_states[i].ra_lru);
+        }
+}
+init_func(readahead_init);
+
+static ra_state_t *
+ra_lookup(const void *key)
+{
+        ra_state_t *st;
+        list_iterate_begin(&ra_hash[ra_hash(key)], st, ra_state_t, ra_hlink) {
+                if (st->ra_key == key)
+                        return st;
+        } list_iterate_end();
+        return NULL;
+}
+
+static void
+ra_reset(ra_state_t *st, mmobj_t *obj)
+{
+        st->ra_obj = obj;
+        st->ra_next = (uint32_t) -1;
+        st->ra_size = 0;
+        st->ra_first = 0;
+        st->ra_end = 0;
+        st->ra_mark = 0;
+}
+
+/*
+ * Start bringing pages [start, end) of obj in. The fills are queued to
+ * the page fill workers and not waited for, so the whole window is in
+ * flight at once. Returns the first page not queued.
+ */
+static uint32_t
+ra_fill(mmobj_t *obj, uint32_t start, uint32_t end)
+{
+        pframe_t *pf;
+
+        for (; start < end; ++start) {
+                if (page_free_count() < RA_FREE_MIN)
+                        break;
+                if (NULL != pframe_hash_find(obj, start))
+                        continue;
+                if (pframe_get_async(obj, start, &pf) < 0)
+                        break;
+                readahead_npages++;
+        }
+        return start;
+}
+
+/*
+ * Report an access to pages [pagenum, pagenum + npages) of obj through
+ * the given stream, and read ahead if the stream is sequential. 'limit'
+ * is the number of pages in the object (or in the part of it that the
+ * stream can reach); nothing at or beyond it is read. 'resident' tells
+ * whether page pagenum was resident before the caller looked it up,
+ * which is what makes a page read ahead a hit. May block.
+ */
+void
+readahead_access(const void *key, mmobj_t *obj, uint32_t pagenum,
+                 uint32_t npages, uint32_t limit, int resident)
+{
+        uint32_t last = pagenum + npages - 1, start, end, window;
+        ra_state_t *st;
+
+        KASSERT(NULL != key && 0 < npages);
+
+        if (NULL == (st = ra_lookup(key))) {
+                st = list_tail(&ra_lru, ra_state_t, ra_lru);
+                if (list_link_is_linked(&st->ra_hlink))
+                        list_remove(&st->ra_hlink);
+                st->ra_key = key;
+                list_insert_head(&ra_hash[ra_hash(key)], &st->ra_hlink);
+                ra_reset(st, obj);
+        } else if (st->ra_obj != obj) {
+                ra_reset(st, obj);
+        }
+        list_remove(&st->ra_lru);
+        list_insert_head(&ra_lru, &st->ra_lru);
+
+        /* was the page we read ahead still there? */
+        if (pagenum >= st->ra_first && pagenum < st->ra_end) {
+                if (resident)
+                        readahead_hits++;
+                else
+                        readahead_misses++;
+                st->ra_first = last + 1;
+        }
+
+        if (pagenum + 1 == st->ra_next && npages == 1)
+                return;         /* the same page again */
+        if (pagenum != st->ra_next && pagenum + 1 != st->ra_next) {
+                /* random access: drop the window */
+                st->ra_next = last + 1;
+                st->ra_size = 0;
+                st->ra_first = st->ra_end = 0;
+                st->ra_mark = last + 1;
+                return;
+        }
+        st->ra_next = last + 1;
+
+        if (last < st->ra_mark)
+                return;
+
+        if (0 == st->ra_size)
+                st->ra_size = RA_MIN_WINDOW;
+        else if (st->ra_size < readahead_max)
+                st->ra_size = MIN(st->ra_size * 2, readahead_max);
+
+        window = MIN(st->ra_size, page_free_count() / RA_FREE_SHARE);
+        start = MAX(st->ra_end, last + 1);
+        end = MIN(start + window, limit);
+        if (start >= end)
+                return;
+
+        if (start != st->ra_end)
+                st->ra_first = start;
+        st->ra_mark = start;
+        st->ra_end = ra_fill(obj, start, end);
+}
+
+/*
+ * Start bringing pages [start, end) of obj in, as far as the free pages
+ * allow, without waiting for them. For callers that know better than
+ * the heuristics above which pages will be wanted (madvise(2)).
+ */
+void
+readahead_range(mmobj_t *obj, uint32_t start, uint32_t end)
+{
+        end = MIN(end, start + page_free_count() / RA_FREE_SHARE);
+        if (start < end)
+                ra_fill(obj, start, end);
+}
+
+/*
+ * Read ahead the largest window past pagenum, for a stream that is
+ * known to be sequential. Pages at or beyond limit are not read.
+ */
+void
+readahead_sequential(mmobj_t *obj, uint32_t pagenum, uint32_t limit)
+{
+        readahead_range(obj, pagenum + 1, MIN(pagenum + 1 + readahead_max, limit));
+}
+
+/* Drop the state of a stream whose key is going away. */
+void
+readahead_forget(const void *key)
+{
+        ra_state_t *st;
+
+        if (NULL == (st = ra_lookup(key)))
+                return;
+        list_remove(&st->ra_hlink);
+        st->ra_key = NULL;
+        list_remove(&st->ra_lru);
+        list_insert_tail(&ra_lru, &st->ra_lru);
+}
+
+#ifdef __DRIVERS__
+
+/*
+ * readahead             - show read-ahead statistics
+ * readahead max <pages> - set the largest window
+ */
+static int
+readahead_kshell(kshell_t *ksh, int argc, char **argv)
+{
+        uint32_t v;
+
+        if (3 == argc && 0 == strcmp(argv[1], "max")) {
+                if (parse_uint(argv[2], &v) || v < RA_MIN_WINDOW)
+                        kprintf(ksh, "readahead: window must be at least %d pages\n", RA_MIN_WINDOW);
+                else
+                        readahead_max = v;
+                return 0;
+        } else if (1 != argc) {
+                kprintf(ksh, "usage: readahead [max <pages>]\n");
+                return 0;
+        }
+
+        kprintf(ksh, "max window:   %u pages\n", readahead_max);
+        kprintf(ksh, "read ahead:   %u pages\n", readahead_npages);
+        kprintf(ksh, "hits:         %u\n", readahead_hits);
+        kprintf(ksh, "misses:       %u\n", readahead_misses);
+        return 0;
+}
+
+static __attribute__((unused)) void
+readahead_kshell_init(void)
+{
+        kshell_add_command("readahead", readahead_kshell,
+                           "show or tune sequential read-ahead");
+}
+init_func(readahead_kshell_init);
+init_depends(kshell_init);
+
+#endif /* __DRIVERS__ */
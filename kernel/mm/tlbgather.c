@@ -0,0 +1,116 @@
+#include "kernel.h"
+#include "globals.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/string.h"
+
+#include "mm/mm.h"
+#include "mm/page.h"
+#include "mm/pagetable.h"
+#include "mm/tlb.h"
+#include "mm/tlbgather.h"
+
+#include "test/kshell/kshell.h"
+#include "test/kshell/io.h"
+
+/* statistics */
+static uint32_t tlb_ngathers;           /* tlb_gather_finish() calls with work to do */
+static uint32_t tlb_npages;             /* entries invalidated with invlpg */
+static uint32_t tlb_nfull;              /* whole TLB flushes */
+
+void
+tlb_gather_init(tlb_gather_t *tg)
+{
+        tg->tg_npages = 0;
+        tg->tg_nranges = 0;
+        tg->tg_all = 0;
+}
+
+/*
+ * Note that the mappings of [vlow, vhigh) in pd changed. The bounds need
+ * not be page-aligned.
+ */
+void
+tlb_gather_range(tlb_gather_t *tg, pagedir_t *pd, uintptr_t vlow, uintptr_t vhigh)
+{
+        uint32_t n;
+
+        if (pd != pt_get() || tg->tg_all || vlow >= vhigh)
+                return;
+
+        vlow = (uintptr_t) PAGE_ALIGN_DOWN(vlow);
+        vhigh = (uintptr_t) PAGE_ALIGN_UP(vhigh);
+        n = (vhigh - vlow) >> PAGE_SHIFT;
+
+        /* compare page counts rather than adding them, the range may be
+         * most of the address space */
+        if (n > TLB_GATHER_MAX_PAGES - tg->tg_npages) {
+                tg->tg_all = 1;
+                return;
+        }
+        tg->tg_npages += n;
+
+        /* unmapping a run page by page gives adjacent ranges */
+        if (0 != tg->tg_nranges && tg->tg_ranges[tg->tg_nranges - 1].tr_high == vlow) {
+                tg->tg_ranges[tg->tg_nranges - 1].tr_high = vhigh;
+        } else if (TLB_GATHER_NRANGES == tg->tg_nranges) {
+                tg->tg_all = 1;
+        } else {
+                tg->tg_ranges[tg->tg_nranges].tr_low = vlow;
+                tg->tg_ranges[tg->tg_nranges].tr_high = vhigh;
+                tg->tg_nranges++;
+        }
+}
+
+/*
+ * Invalidate everything gathered in tg, and empty it for reuse.
+ */
+void
+tlb_gather_finish(tlb_gather_t *tg)
+{
+        uintptr_t vaddr;
+        uint32_t i;
+
+        if (tg->tg_all) {
+                tlb_flush_all();
+                tlb_nfull++;
+                tlb_ngathers++;
+        } else if (0 != tg->tg_nranges) {
+                for (i = 0; i < tg->tg_nranges; ++i) {
+                        for (vaddr = tg->tg_ranges[i].tr_low;
+                             vaddr < tg->tg_ranges[i].tr_high; vaddr += PAGE_SIZE)
+                                tlb_flush(vaddr);
+                }
+                tlb_npages += tg->tg_npages;
+                tlb_ngathers++;
+        }
+        tlb_gather_init(tg);
+}
+
+#ifdef __DRIVERS__
+
+static int
+tlb_kshell(kshell_t *ksh, int argc, char **argv)
+{
+        if (1 != argc) {
+                kprintf(ksh, "usage: tlb\n");
+                return 0;
+        }
+
+        kprintf(ksh, "gathers:        %u\n", tlb_ngathers);
+        kprintf(ksh, "pages flushed:  %u\n", tlb_npages);
+        kprintf(ksh, "full flushes:   %u\n", tlb_nfull);
+        kprintf(ksh, "ceiling:        %u pages\n", TLB_GATHER_MAX_PAGES);
+        return 0;
+}
+
+static __attribute__((unused)) void
+tlb_kshell_init(void)
+{
+        kshell_add_command("tlb", tlb_kshell, "show TLB invalidation statistics");
+}
+init_func(tlb_kshell_init);
+init_depends(kshell_init);
+
+#endif /* __DRIVERS__ */
@@ -12,15 +12,19 @@
 #include "mm/mman.h"
 #include "mm/page.h"
 #include "mm/pframe.h"
+#include "mm/pframe_ext.h"
 #include "mm/mmobj.h"
 #include "mm/pagetable.h"
 #include "mm/tlb.h"
+#include "mm/tlbgather.h"
 
 #include "fs/file.h"
 #include "fs/vnode.h"
 
 #include "vm/shadow.h"
 #include "vm/vmmap.h"
+#include "vm/hugepage.h"
+#include "vm/rmap.h"
 
 #include "api/exec.h"
 
@@ -100,6 +104,7 @@ do_fork(struct regs *regs)
                         mmobj_shad_c->mmo_un.mmo_bottom_obj = bottom_obj;
                         mmobj_shad_c->mmo_shadowed = vma_c->vma_obj;
                         list_insert_tail(&bottom_obj->mmo_un.mmo_vmas, &vma_c->vma_olink);
+                        rmap_add(vma_c);
                         
                         vma_c->vma_obj = mmobj_shad_c;
 
@@ -113,9 +118,17 @@ do_fork(struct regs *regs)
                                 dbg(DBG_PRINT, "(GRADING3A)\n");
                         }
                         list_insert_tail(&bottom_obj->mmo_un.mmo_vmas, &vma_p->vma_olink);
+                        rmap_add(vma_p);
                         vma_p->vma_obj = mmobj_shad_p;
                         dbg(DBG_PRINT, "(GRADING3A)\n");
                 }
+                else
+                {
+                        /* a shared mapping maps its object directly; the
+                         * child's pages are unmapped through it too */
+                        list_insert_tail(mmobj_bottom_vmas(vma_c->vma_obj), &vma_c->vma_olink);
+                        rmap_add(vma_c);
+                }
                 list_link_obj = list_link_obj->l_next;
                 dbg(DBG_PRINT, "(GRADING3A)\n");
         }
@@ -127,11 +140,23 @@ do_fork(struct regs *regs)
         newproc->p_brk = curproc->p_brk;
         newproc->p_start_brk = curproc->p_start_brk;
 
-        // unmap the whole range
+        // unmap the whole range, keeping what was written to shared
+        // file pages through it
+        hugepage_unmap_range(curproc->p_pagedir, USER_MEM_LOW, USER_MEM_HIGH);
+        pframe_harvest_unmap(curproc->p_vmmap, ADDR_TO_PN(USER_MEM_LOW), ADDR_TO_PN(USER_MEM_HIGH));
         pt_unmap_range(curproc->p_pagedir, USER_MEM_LOW, USER_MEM_HIGH);
 
-        // TLB
-        tlb_flush_all();
+        // TLB: only what the parent has mapped needs to go
+        tlb_gather_t tg;
+        vmarea_t *vma;
+        tlb_gather_init(&tg);
+        list_iterate_begin(&curproc->p_vmmap->vmm_list, vma, vmarea_t, vma_plink)
+        {
+                tlb_gather_range(&tg, curproc->p_pagedir, (uintptr_t) PN_TO_ADDR(vma->vma_start),
+                                 (uintptr_t) PN_TO_ADDR(vma->vma_end));
+        }
+        list_iterate_end();
+        tlb_gather_finish(&tg);
 
         for (int i = 0; i < NFILES; i++)
         {
@@ -20,6 +20,7 @@
 #include "mm/mman.h"
 
 #include "vm/vmmap.h"
+#include "vm/memlimit.h"
 
 #include "fs/vfs.h"
 #include "fs/vfs_syscall.h"
@@ -38,6 +39,8 @@ proc_init()
         list_init(&_proc_list);
         proc_allocator = slab_allocator_create("proc", sizeof(proc_t));
         KASSERT(proc_allocator != NULL);
+
+        memlimit_init();
 }
 
 proc_t *
@@ -113,6 +116,7 @@ proc_info(const void *arg, char *buf, size_t osize)
 #ifdef __VM__
         iprintf(&buf, &size, "start brk:    0x%p\n", p->p_start_brk);
         iprintf(&buf, &size, "brk:          0x%p\n", p->p_brk);
+        memlimit_info(p, &buf, &size);
 #endif
 
         return size;
@@ -238,6 +242,8 @@ proc_create(char *name)
         p->p_pagedir = pt_create_pagedir();
         list_insert_head(&_proc_list, &p->p_list_link);
 
+        memlimit_proc_init(p);
+
 // #ifdef __VFS__
 
         for (int i = 0; i < NFILES; i++)
@@ -335,6 +341,7 @@ proc_cleanup(int status)
         }
 
         vmmap_destroy(curproc->p_vmmap);
+        memlimit_proc_exit(curproc);
 
         KASSERT(NULL != curproc->p_pproc);
         KASSERT(KT_EXITED == curthr->kt_state);
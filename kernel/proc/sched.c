@@ -9,6 +9,10 @@
 #include "util/init.h"
 #include "util/debug.h"
 
+#include "mm/pframe_ext.h"
+
+#include "vm/ksm.h"
+
 static ktqueue_t kt_runq;
 
 static __attribute__((unused)) void
@@ -224,6 +228,10 @@ sched_switch(void) {
     intr_setipl(IPL_HIGH);
     
     while(sched_queue_empty(&kt_runq)) {
+        pframe_idle();
+        ksm_idle();
+        if (!sched_queue_empty(&kt_runq))
+            break;
         intr_disable();
         intr_setipl(IPL_LOW);
         intr_wait();
@@ -0,0 +1,119 @@
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/string.h"
+#include "util/parse.h"
+#include "util/tsc.h"
+
+#include "proc/proc.h"
+#include "proc/kthread.h"
+#include "proc/sched.h"
+
+#include "fs/vfs_syscall.h"
+#include "fs/fcntl.h"
+
+#include "mm/page.h"
+
+#include "test/kshell/kshell.h"
+#include "test/kshell/io.h"
+
+/*
+ * readbench - parallel sequential readers against one disk.
+ *
+ * Starts a number of kernel processes that each read the same file from
+ * start to end through do_read(), one page at a time, and reports how
+ * long it took in TSC megacycles. Every reader has its own file_t and
+ * thus its own read-ahead stream. Run it on a file that is not already
+ * cached (e.g. right after boot) to measure the disk rather than the page
+ * cache; compare with 'pframe' and 'readahead' to see how many fills were
+ * in flight at once.
+ */
+
+#ifdef __DRIVERS__
+
+#define READBENCH_MAX_READERS 16
+
+static uint32_t readbench_nbytes;
+static int readbench_nerrors;
+
+static void *
+readbench_reader(int arg1, void *arg2)
+{
+        const char *path = arg2;
+        char *buf;
+        int fd, n;
+
+        if (NULL == (buf = page_alloc())) {
+                readbench_nerrors++;
+                return NULL;
+        }
+        if ((fd = do_open(path, O_RDONLY)) < 0) {
+                readbench_nerrors++;
+                page_free(buf);
+                return NULL;
+        }
+        while ((n = do_read(fd, buf, PAGE_SIZE)) > 0)
+                readbench_nbytes += n;
+        if (n < 0)
+                readbench_nerrors++;
+
+        do_close(fd);
+        page_free(buf);
+        return NULL;
+}
+
+/*
+ * readbench <file> [<readers>]
+ */
+static int
+readbench_kshell(kshell_t *ksh, int argc, char **argv)
+{
+        proc_t *procs[READBENCH_MAX_READERS];
+        kthread_t *thr;
+        uint64_t start, cycles;
+        uint32_t nreaders = 1, i;
+        int status;
+
+        if (3 == argc && parse_uint(argv[2], &nreaders))
+                nreaders = 0;
+        if ((2 != argc && 3 != argc) || nreaders < 1 || nreaders > READBENCH_MAX_READERS) {
+                kprintf(ksh, "usage: readbench <file> [<readers, 1-%d>]\n", READBENCH_MAX_READERS);
+                return 0;
+        }
+
+        readbench_nbytes = 0;
+        readbench_nerrors = 0;
+
+        start = tsc_read();
+        for (i = 0; i < nreaders; ++i) {
+                procs[i] = proc_create("readbench");
+                KASSERT(NULL != procs[i]);
+                thr = kthread_create(procs[i], readbench_reader, i, argv[1]);
+                KASSERT(NULL != thr);
+                sched_make_runnable(thr);
+        }
+        for (i = 0; i < nreaders; ++i)
+                do_waitpid(procs[i]->p_pid, 0, &status);
+        cycles = tsc_read() - start;
+
+        if (0 != readbench_nerrors)
+                kprintf(ksh, "readbench: %d readers failed\n", readbench_nerrors);
+        kprintf(ksh, "%u readers, %u bytes in %u Mcycles (%u bytes/Mcycle)\n",
+                nreaders, readbench_nbytes, (uint32_t)(cycles >> 20),
+                (cycles >> 20) ? (uint32_t)(readbench_nbytes / (uint32_t)(cycles >> 20)) : 0);
+        return 0;
+}
+
+static __attribute__((unused)) void
+readbench_init(void)
+{
+        kshell_add_command("readbench", readbench_kshell,
+                           "time parallel sequential readers of one file");
+}
+init_func(readbench_init);
+init_depends(kshell_init);
+
+#endif /* __DRIVERS__ */
@@ -0,0 +1,140 @@
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/list.h"
+#include "util/string.h"
+#include "util/parse.h"
+#include "util/tsc.h"
+
+#include "mm/mm.h"
+#include "mm/mman.h"
+#include "mm/page.h"
+#include "mm/mmobj.h"
+
+#include "vm/vmmap.h"
+#include "vm/anon.h"
+#include "vm/rmap.h"
+
+#include "test/kshell/kshell.h"
+#include "test/kshell/io.h"
+
+/*
+ * rmapbench - many mappers of one object.
+ *
+ * Maps one anon object with a number of vmareas, each covering a small
+ * window of the object that overlaps the next one by half, the way many
+ * processes each map a piece of a large shared file. Then, for every page
+ * of the object, finds the areas that map it, first by walking the
+ * object's whole list of areas (what pframe_remove_from_pts() used to
+ * do) and then through the reverse map, and reports both times in TSC
+ * kilocycles. The areas belong to no process, so nothing is unmapped.
+ */
+
+#ifdef __DRIVERS__
+
+#define RMAPBENCH_MAX_MAPPERS   (PAGE_SIZE / sizeof(vmarea_t *))
+
+static void
+rmapbench_count(vmarea_t *vma, uint32_t pagenum, void *arg)
+{
+        (*(uint32_t *) arg)++;
+}
+
+/*
+ * rmapbench [<mappers> [<pages per mapper>]]
+ */
+static int
+rmapbench_kshell(kshell_t *ksh, int argc, char **argv)
+{
+        uint32_t nmappers = 256, npages = 16, nobjpages, i, pn;
+        uint32_t nlist = 0, nrmap = 0;
+        uint64_t start, list_cycles, rmap_cycles;
+        vmarea_t **vmas, *vma;
+        mmobj_t *obj;
+
+        if (argc > 3
+            || (argc > 1 && 0 > parse_uint(argv[1], &nmappers))
+            || (argc > 2 && 0 > parse_uint(argv[2], &npages))
+            || nmappers < 1 || nmappers > RMAPBENCH_MAX_MAPPERS
+            || npages < 2) {
+                kprintf(ksh, "usage: rmapbench [<mappers, 1-%u> [<pages per mapper, 2 or more>]]\n",
+                        RMAPBENCH_MAX_MAPPERS);
+                return 0;
+        }
+
+        if (NULL == (vmas = page_alloc())) {
+                kprintf(ksh, "rmapbench: out of memory\n");
+                return 0;
+        }
+        obj = anon_create();
+        KASSERT(NULL != obj);
+
+        for (i = 0; i < nmappers; ++i) {
+                if (NULL == (vma = vmarea_alloc()))
+                        break;
+                vma->vma_start = ADDR_TO_PN(USER_MEM_LOW);
+                vma->vma_end = vma->vma_start + npages;
+                vma->vma_off = i * (npages / 2);
+                vma->vma_prot = PROT_READ;
+                vma->vma_flags = MAP_SHARED;
+                vma->vma_obj = obj;
+                obj->mmo_ops->ref(obj);
+                list_link_init(&vma->vma_plink);
+                list_link_init(&vma->vma_olink);
+                list_insert_tail(mmobj_bottom_vmas(obj), &vma->vma_olink);
+                rmap_add(vma);
+                vmas[i] = vma;
+        }
+        if (0 == (nmappers = i)) {
+                kprintf(ksh, "rmapbench: out of memory\n");
+                obj->mmo_ops->put(obj);
+                page_free(vmas);
+                return 0;
+        }
+        nobjpages = (nmappers - 1) * (npages / 2) + npages;
+
+        start = tsc_read();
+        for (pn = 0; pn < nobjpages; ++pn) {
+                list_iterate_begin(mmobj_bottom_vmas(obj), vma, vmarea_t, vma_olink) {
+                        if (pn >= vma->vma_off
+                            && pn < vma->vma_off + (vma->vma_end - vma->vma_start))
+                                nlist++;
+                } list_iterate_end();
+        }
+        list_cycles = tsc_read() - start;
+
+        start = tsc_read();
+        for (pn = 0; pn < nobjpages; ++pn)
+                rmap_foreach(obj, pn, rmapbench_count, &nrmap);
+        rmap_cycles = tsc_read() - start;
+
+        for (i = 0; i < nmappers; ++i) {
+                list_remove(&vmas[i]->vma_olink);
+                rmap_remove(vmas[i]);
+                obj->mmo_ops->put(obj);
+                vmarea_free(vmas[i]);
+        }
+        obj->mmo_ops->put(obj);
+        page_free(vmas);
+
+        if (nlist != nrmap)
+                kprintf(ksh, "rmapbench: list found %u mappings, rmap %u\n", nlist, nrmap);
+        kprintf(ksh, "%u mappers, %u pages, %u mappings\n", nmappers, nobjpages, nrmap);
+        kprintf(ksh, "list walk: %u Kcycles\n", (uint32_t)(list_cycles >> 10));
+        kprintf(ksh, "rmap:      %u Kcycles\n", (uint32_t)(rmap_cycles >> 10));
+        return 0;
+}
+
+static __attribute__((unused)) void
+rmapbench_init(void)
+{
+        kshell_add_command("rmapbench", rmapbench_kshell,
+                           "time finding the mappers of each page of a widely mapped object");
+}
+init_func(rmapbench_init);
+init_depends(kshell_init);
+
+#endif /* __DRIVERS__ */
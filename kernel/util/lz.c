@@ -0,0 +1,138 @@
+#include "kernel.h"
+
+#include "util/debug.h"
+#include "util/lz.h"
+
+#define LZ_HASH_LOG     12
+#define LZ_HASH_SIZE    (1 << LZ_HASH_LOG)
+
+#define LZ_MAX_LIT      (1 << 5)
+#define LZ_MAX_OFF      (1 << 13)
+#define LZ_MAX_REF      ((1 << 8) + (1 << 3))
+
+#define lz_hash(p) \
+        ((((uint32_t)(p)[0] << 16 | (uint32_t)(p)[1] << 8 | (p)[2]) * 2654435761u) \
+         >> (32 - LZ_HASH_LOG))
+
+/*
+ * Offsets of the last position seen with each hash. Entries left over
+ * from an earlier call are harmless: a candidate match is only used if
+ * it lies before the current position and its bytes really match.
+ */
+static uint16_t lz_table[LZ_HASH_SIZE];
+
+uint32_t
+lz_compress(const void *in, uint32_t inlen, void *out, uint32_t outlen)
+{
+        const uint8_t *base = in, *ip = base, *in_end = base + inlen;
+        uint8_t *op = out, *out_end = op + outlen;
+        uint8_t *lit;
+        uint32_t nlit = 0;
+
+        KASSERT(inlen < 0x10000);
+
+        if (0 == inlen)
+                return 0;
+        if (op >= out_end)
+                return 0;
+        lit = op++;             /* control byte of the current literal run */
+
+        while (ip < in_end) {
+                if (ip + 2 < in_end) {
+                        uint32_t h = lz_hash(ip);
+                        const uint8_t *ref = base + lz_table[h];
+                        uint32_t off = ip - ref - 1;
+
+                        lz_table[h] = ip - base;
+                        if (ref < ip && off < LZ_MAX_OFF
+                            && ref[0] == ip[0] && ref[1] == ip[1] && ref[2] == ip[2]) {
+                                uint32_t len = 3, max = in_end - ip;
+
+                                if (max > LZ_MAX_REF)
+                                        max = LZ_MAX_REF;
+                                while (len < max && ref[len] == ip[len])
+                                        len++;
+
+                                /* end the literal run, dropping its control
+                                 * byte if it is empty */
+                                if (0 != nlit)
+                                        *lit = nlit - 1;
+                                else
+                                        op--;
+
+                                /* the reference, and the next run's
+                                 * control byte */
+                                if (op + 4 > out_end)
+                                        return 0;
+                                len -= 2;
+                                if (len < 7) {
+                                        *op++ = (off >> 8) + (len << 5);
+                                } else {
+                                        *op++ = (off >> 8) + (7 << 5);
+                                        *op++ = len - 7;
+                                }
+                                *op++ = off;
+                                ip += len + 2;
+
+                                lit = op++;
+                                nlit = 0;
+                                continue;
+                        }
+                }
+
+                if (op >= out_end)
+                        return 0;
+                *op++ = *ip++;
+                if (LZ_MAX_LIT == ++nlit) {
+                        *lit = nlit - 1;
+                        if (op >= out_end)
+                                return 0;
+                        lit = op++;
+                        nlit = 0;
+                }
+        }
+
+        if (0 != nlit)
+                *lit = nlit - 1;
+        else
+                op--;
+        return op - (uint8_t *) out;
+}
+
+uint32_t
+lz_decompress(const void *in, uint32_t inlen, void *out, uint32_t outlen)
+{
+        const uint8_t *ip = in, *in_end = ip + inlen;
+        uint8_t *op = out, *out_end = op + outlen;
+        const uint8_t *ref;
+        uint32_t ctrl, len;
+
+        while (ip < in_end) {
+                ctrl = *ip++;
+                if (ctrl < LZ_MAX_LIT) {
+                        len = ctrl + 1;
+                        if (ip + len > in_end || op + len > out_end)
+                                return 0;
+                        while (len--)
+                                *op++ = *ip++;
+                } else {
+                        len = ctrl >> 5;
+                        if (7 == len) {
+                                if (ip >= in_end)
+                                        return 0;
+                                len += *ip++;
+                        }
+                        len += 2;
+                        if (ip >= in_end)
+                                return 0;
+                        ref = op - ((ctrl & 0x1f) << 8) - *ip++ - 1;
+                        if (ref < (uint8_t *) out || op + len > out_end)
+                                return 0;
+                        /* byte by byte: the source may overlap what is
+                         * being written */
+                        while (len--)
+                                *op++ = *ref++;
+                }
+        }
+        return op - (uint8_t *) out;
+}
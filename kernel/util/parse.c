@@ -0,0 +1,32 @@
+#include "kernel.h"
+#include "errno.h"
+
+#include "util/parse.h"
+
+int
+parse_uint(const char *str, uint32_t *val)
+{
+        uint32_t v = 0, base = 10, d;
+
+        if ('0' == str[0] && ('x' == str[1] || 'X' == str[1])) {
+                base = 16;
+                str += 2;
+        }
+        if ('\0' == *str)
+                return -EINVAL;
+        for (; '\0' != *str; ++str) {
+                if (*str >= '0' && *str <= '9')
+                        d = *str - '0';
+                else if (16 == base && *str >= 'a' && *str <= 'f')
+                        d = *str - 'a' + 10;
+                else if (16 == base && *str >= 'A' && *str <= 'F')
+                        d = *str - 'A' + 10;
+                else
+                        return -EINVAL;
+                if (v > (0xffffffff - d) / base)
+                        return -ERANGE;
+                v = v * base + d;
+        }
+        *val = v;
+        return 0;
+}
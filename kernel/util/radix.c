@@ -0,0 +1,381 @@
+#include "kernel.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/string.h"
+#include "util/radix.h"
+
+#include "mm/slab.h"
+
+typedef struct radix_node {
+        void           *rn_slots[RADIX_SLOTS];
+        uint64_t        rn_tags[RADIX_NTAGS];   /* slot bits with a tagged entry below */
+        uint32_t        rn_count;               /* non-NULL slots */
+} radix_node_t;
+
+/* a tree can never be taller than this */
+#define RADIX_MAX_HEIGHT ((32 + RADIX_SHIFT - 1) / RADIX_SHIFT)
+
+#define radix_offset(index, level) \
+        (((index) >> ((level) * RADIX_SHIFT)) & (RADIX_SLOTS - 1))
+#define radix_bit(offset) (((uint64_t) 1) << (offset))
+
+static slab_allocator_t *radix_node_allocator = NULL;
+
+void
+radix_init(void)
+{
+        radix_node_allocator = slab_allocator_create("radix_node", sizeof(radix_node_t));
+        KASSERT(NULL != radix_node_allocator);
+}
+
+void
+radix_tree_init(radix_tree_t *rt)
+{
+        rt->rt_root = NULL;
+        rt->rt_height = 0;
+}
+
+static radix_node_t *
+radix_node_alloc(void)
+{
+        radix_node_t *node = slab_obj_alloc(radix_node_allocator);
+        if (NULL != node)
+                memset(node, 0, sizeof(*node));
+        return node;
+}
+
+/* Largest index a tree of the given height can hold. */
+static uint32_t
+radix_maxindex(uint32_t height)
+{
+        if (height >= RADIX_MAX_HEIGHT)
+                return (uint32_t) -1;
+        return (1U << (height * RADIX_SHIFT)) - 1;
+}
+
+/* Make the tree tall enough to hold index. Returns 0 or -ENOMEM. */
+static int
+radix_extend(radix_tree_t *rt, uint32_t index)
+{
+        radix_node_t *node;
+        int tag;
+
+        if (NULL == rt->rt_root) {
+                while (index > radix_maxindex(rt->rt_height))
+                        rt->rt_height++;
+                if (0 == rt->rt_height)
+                        rt->rt_height = 1;
+                return 0;
+        }
+        while (index > radix_maxindex(rt->rt_height)) {
+                if (NULL == (node = radix_node_alloc()))
+                        return -ENOMEM;
+                node->rn_slots[0] = rt->rt_root;
+                node->rn_count = 1;
+                for (tag = 0; tag < RADIX_NTAGS; ++tag) {
+                        if (0 != rt->rt_root->rn_tags[tag])
+                                node->rn_tags[tag] = radix_bit(0);
+                }
+                rt->rt_root = node;
+                rt->rt_height++;
+        }
+        return 0;
+}
+
+/*
+ * Undo what a failed radix_insert() did to rt: free the chain of nodes
+ * it hung below parent's slot off (the first of them at level 'level'),
+ * if any, then the levels radix_extend() added on top of old_root.
+ */
+static void
+radix_insert_undo(radix_tree_t *rt, uint32_t index, radix_node_t *old_root,
+                  uint32_t old_height, radix_node_t *parent, uint32_t off, uint32_t level)
+{
+        radix_node_t *node, *next;
+
+        if (NULL != parent) {
+                node = parent->rn_slots[off];
+                parent->rn_slots[off] = NULL;
+                parent->rn_count--;
+                for (; NULL != node; node = next, --level) {
+                        next = (0 == level) ? NULL : node->rn_slots[radix_offset(index, level)];
+                        slab_obj_free(radix_node_allocator, node);
+                }
+        }
+
+        if (NULL == old_root) {
+                /* the tree was empty; at most its new root is left */
+                if (NULL != rt->rt_root)
+                        slab_obj_free(radix_node_allocator, rt->rt_root);
+                rt->rt_root = NULL;
+        } else {
+                while (rt->rt_root != old_root) {
+                        node = rt->rt_root;
+                        KASSERT(1 == node->rn_count);
+                        rt->rt_root = node->rn_slots[0];
+                        slab_obj_free(radix_node_allocator, node);
+                }
+        }
+        rt->rt_height = old_height;
+}
+
+/*
+ * Store item at index. Returns 0, -EEXIST if there already is an entry
+ * at index, or -ENOMEM, in which case the tree is left as it was.
+ */
+int
+radix_insert(radix_tree_t *rt, uint32_t index, void *item)
+{
+        radix_node_t *old_root = rt->rt_root, *node, *child, *parent = NULL;
+        uint32_t old_height = rt->rt_height, level, off, parent_off = 0, added = 0;
+        int err;
+
+        KASSERT(NULL != item);
+
+        if ((err = radix_extend(rt, index)) < 0)
+                goto fail;
+        if (NULL == rt->rt_root && NULL == (rt->rt_root = radix_node_alloc())) {
+                err = -ENOMEM;
+                goto fail;
+        }
+
+        node = rt->rt_root;
+        for (level = rt->rt_height - 1; level > 0; --level) {
+                off = radix_offset(index, level);
+                if (NULL == (child = node->rn_slots[off])) {
+                        if (NULL == (child = radix_node_alloc())) {
+                                err = -ENOMEM;
+                                goto fail;
+                        }
+                        node->rn_slots[off] = child;
+                        node->rn_count++;
+                        /* remember where the new nodes start */
+                        if (NULL == parent) {
+                                parent = node;
+                                parent_off = off;
+                                added = level - 1;
+                        }
+                }
+                node = child;
+        }
+
+        off = radix_offset(index, 0);
+        if (NULL != node->rn_slots[off])
+                return -EEXIST;
+        node->rn_slots[off] = item;
+        node->rn_count++;
+        return 0;
+
+fail:
+        radix_insert_undo(rt, index, old_root, old_height, parent, parent_off, added);
+        return err;
+}
+
+void *
+radix_lookup(radix_tree_t *rt, uint32_t index)
+{
+        radix_node_t *node = rt->rt_root;
+        uint32_t level;
+
+        if (NULL == node || index > radix_maxindex(rt->rt_height))
+                return NULL;
+        for (level = rt->rt_height - 1; level > 0; --level) {
+                if (NULL == (node = node->rn_slots[radix_offset(index, level)]))
+                        return NULL;
+        }
+        return node->rn_slots[radix_offset(index, 0)];
+}
+
+/*
+ * Find the path from the root to the leaf node holding index. path[l] is
+ * the node at level l (0 is the leaf). Returns 0, or -ENOENT if there is
+ * no entry at index.
+ */
+static int
+radix_path(radix_tree_t *rt, uint32_t index, radix_node_t **path)
+{
+        radix_node_t *node = rt->rt_root;
+        uint32_t level;
+
+        if (NULL == node || index > radix_maxindex(rt->rt_height))
+                return -ENOENT;
+        for (level = rt->rt_height - 1; level > 0; --level) {
+                path[level] = node;
+                if (NULL == (node = node->rn_slots[radix_offset(index, level)]))
+                        return -ENOENT;
+        }
+        path[0] = node;
+        return (NULL == node->rn_slots[radix_offset(index, 0)]) ? -ENOENT : 0;
+}
+
+/* Clear a tag bit at the leaf and in every ancestor left without one. */
+static void
+radix_path_untag(radix_tree_t *rt, uint32_t index, radix_node_t **path, int tag)
+{
+        uint32_t level;
+
+        for (level = 0; level < rt->rt_height; ++level) {
+                path[level]->rn_tags[tag] &= ~radix_bit(radix_offset(index, level));
+                if (0 != path[level]->rn_tags[tag])
+                        break;
+        }
+}
+
+/* Remove and return the entry at index, or NULL if there is none. */
+void *
+radix_delete(radix_tree_t *rt, uint32_t index)
+{
+        radix_node_t *path[RADIX_MAX_HEIGHT];
+        uint32_t level, off;
+        void *item;
+        int tag;
+
+        if (radix_path(rt, index, path) < 0)
+                return NULL;
+
+        off = radix_offset(index, 0);
+        item = path[0]->rn_slots[off];
+        for (tag = 0; tag < RADIX_NTAGS; ++tag) {
+                if (path[0]->rn_tags[tag] & radix_bit(off))
+                        radix_path_untag(rt, index, path, tag);
+        }
+
+        /* free the nodes that are left empty */
+        path[0]->rn_slots[off] = NULL;
+        for (level = 0; level < rt->rt_height; ++level) {
+                if (0 != --path[level]->rn_count)
+                        break;
+                slab_obj_free(radix_node_allocator, path[level]);
+                if (level + 1 < rt->rt_height) {
+                        path[level + 1]->rn_slots[radix_offset(index, level + 1)] = NULL;
+                } else {
+                        rt->rt_root = NULL;
+                        rt->rt_height = 0;
+                }
+        }
+        return item;
+}
+
+/* Tag the (existing) entry at index. */
+void
+radix_tag_set(radix_tree_t *rt, uint32_t index, int tag)
+{
+        radix_node_t *path[RADIX_MAX_HEIGHT];
+        uint32_t level;
+
+        KASSERT(0 <= tag && tag < RADIX_NTAGS);
+        if (radix_path(rt, index, path) < 0) {
+                KASSERT(0 && "tagging a missing entry");
+                return;
+        }
+        for (level = 0; level < rt->rt_height; ++level)
+                path[level]->rn_tags[tag] |= radix_bit(radix_offset(index, level));
+}
+
+void
+radix_tag_clear(radix_tree_t *rt, uint32_t index, int tag)
+{
+        radix_node_t *path[RADIX_MAX_HEIGHT];
+
+        KASSERT(0 <= tag && tag < RADIX_NTAGS);
+        if (radix_path(rt, index, path) < 0)
+                return;
+        if (path[0]->rn_tags[tag] & radix_bit(radix_offset(index, 0)))
+                radix_path_untag(rt, index, path, tag);
+}
+
+int
+radix_tag_get(radix_tree_t *rt, uint32_t index, int tag)
+{
+        radix_node_t *path[RADIX_MAX_HEIGHT];
+
+        KASSERT(0 <= tag && tag < RADIX_NTAGS);
+        if (radix_path(rt, index, path) < 0)
+                return 0;
+        return 0 != (path[0]->rn_tags[tag] & radix_bit(radix_offset(index, 0)));
+}
+
+/*
+ * Collect the entries of the subtree rooted at node (at the given level,
+ * covering indices from base) whose index is in [first, last], in index
+ * order, until *n reaches max. tag < 0 means any entry. If indices is not
+ * NULL, the index of each entry is stored there too.
+ */
+static void
+radix_walk(radix_node_t *node, uint32_t level, uint32_t base, uint32_t first,
+           uint32_t last, void **results, uint32_t *indices, uint32_t *n,
+           uint32_t max, int tag)
+{
+        uint32_t off, lo, hi, span = 1U << (level * RADIX_SHIFT);
+
+        lo = (first > base) ? radix_offset(first, level) : 0;
+        hi = ((uint64_t) base + (uint64_t) span * RADIX_SLOTS - 1 > last)
+             ? radix_offset(last, level) : RADIX_SLOTS - 1;
+
+        for (off = lo; off <= hi && *n < max; ++off) {
+                if (NULL == node->rn_slots[off])
+                        continue;
+                if (tag >= 0 && !(node->rn_tags[tag] & radix_bit(off)))
+                        continue;
+                if (0 == level) {
+                        if (NULL != indices)
+                                indices[*n] = base + off;
+                        results[(*n)++] = node->rn_slots[off];
+                } else {
+                        radix_walk(node->rn_slots[off], level - 1, base + off * span,
+                                   first, last, results, indices, n, max, tag);
+                }
+        }
+}
+
+/*
+ * Gang lookup: store up to max entries with indices in [first, last] into
+ * results, in increasing index order. Returns the number stored. To
+ * iterate over a large range, call again from one past the index of the
+ * last entry returned.
+ */
+uint32_t
+radix_gang_lookup(radix_tree_t *rt, uint32_t first, uint32_t last,
+                  void **results, uint32_t max)
+{
+        uint32_t n = 0;
+
+        if (NULL == rt->rt_root || first > last)
+                return 0;
+        last = MIN(last, radix_maxindex(rt->rt_height));
+        if (first <= last)
+                radix_walk(rt->rt_root, rt->rt_height - 1, 0, first, last, results, NULL, &n, max, -1);
+        return n;
+}
+
+/* As radix_gang_lookup(), also storing the index of each entry. */
+uint32_t
+radix_gang_lookup_index(radix_tree_t *rt, uint32_t first, uint32_t last,
+                        void **results, uint32_t *indices, uint32_t max)
+{
+        uint32_t n = 0;
+
+        if (NULL == rt->rt_root || first > last)
+                return 0;
+        last = MIN(last, radix_maxindex(rt->rt_height));
+        if (first <= last)
+                radix_walk(rt->rt_root, rt->rt_height - 1, 0, first, last, results, indices, &n, max, -1);
+        return n;
+}
+
+/* As radix_gang_lookup(), but only entries carrying the given tag. */
+uint32_t
+radix_gang_lookup_tag(radix_tree_t *rt, uint32_t first, uint32_t last,
+                      void **results, uint32_t max, int tag)
+{
+        uint32_t n = 0;
+
+        KASSERT(0 <= tag && tag < RADIX_NTAGS);
+        if (NULL == rt->rt_root || first > last)
+                return 0;
+        last = MIN(last, radix_maxindex(rt->rt_height));
+        if (first <= last)
+                radix_walk(rt->rt_root, rt->rt_height - 1, 0, first, last, results, NULL, &n, max, tag);
+        return n;
+}
@@ -6,10 +6,14 @@
 
 #include "mm/mmobj.h"
 #include "mm/pframe.h"
+#include "mm/pframe_ext.h"
 #include "mm/mm.h"
 #include "mm/page.h"
 #include "mm/slab.h"
 #include "mm/tlb.h"
+#include "mm/fileobj.h"
+
+#include "vm/swap.h"
 
 int anon_count = 0; /* for debugging/verification purposes */
 
@@ -69,6 +73,15 @@ anon_create()
     return anon_obj;
 }
 
+/*
+ * Returns nonzero if o is an anonymous object.
+ */
+int
+anon_is_anon(mmobj_t *o)
+{
+        return &anon_mmobj_ops == o->mmo_ops;
+}
+
 /* Implementation of mmobj entry points: */
 
 /*
@@ -102,10 +115,14 @@ anon_put(mmobj_t *o)
 
             list_iterate_begin(&o->mmo_respages, pf, pframe_t, pf_olink)
             {
-                    pframe_unpin(pf);
+                    pframe_unadopt(pf);
+                    /* with swap, pages are only pinned while in use */
+                    if (pframe_is_pinned(pf))
+                            pframe_unpin(pf);
                     pframe_free(pf);
                     dbg(DBG_PRINT, "(GRADING3A)\n");
             } list_iterate_end();
+            swap_release_obj(o);
             slab_obj_free(anon_allocator, o);
             dbg(DBG_PRINT, "(GRADING3A)\n");
             return;
@@ -134,23 +151,37 @@ anon_fillpage(mmobj_t *o, pframe_t *pf)
     KASSERT(!pframe_is_pinned(pf));
     dbg(DBG_PRINT, "(GRADING3A 4.d)\n");
 
-    memset(pf->pf_addr, 0, PAGE_SIZE);
-    pframe_pin(pf);
+    int ret;
+
+    if (0 > (ret = swap_in(o, pf)))
+            return ret;
+    /* usually already zeroed while the system was idle */
+    if (0 == ret)
+            pframe_zero(pf);
+
+    /* anyone sharing this object who read the page so far maps the zero
+     * page, and must see this one from now on */
+    pframe_remove_from_pts(pf);
+
+    /* without swap there is nowhere to write the page to, so it must
+     * stay resident */
+    if (!swap_enabled())
+            pframe_pin(pf);
 
     dbg(DBG_PRINT, "(GRADING3A)\n");
     return 0;
 }
 
+/* The copy in swap, if any, is about to become stale. */
 static int
 anon_dirtypage(mmobj_t *o, pframe_t *pf)
 {
-        NOT_YET_IMPLEMENTED("VM: anon_dirtypage");
-        return -1;
+        swap_discard(o, pf->pf_pagenum);
+        return 0;
 }
 
 static int
 anon_cleanpage(mmobj_t *o, pframe_t *pf)
 {
-        NOT_YET_IMPLEMENTED("VM: anon_cleanpage");
-        return -1;
+        return swap_out(o, pf);
 }
@@ -8,6 +8,10 @@
 
 #include "vm/mmap.h"
 #include "vm/vmmap.h"
+#include "vm/memlimit.h"
+#include "vm/rmap.h"
+#include "vm/populate.h"
+#include "vm/mlock.h"
 
 #include "proc/proc.h"
 
@@ -77,6 +81,17 @@ do_brk(void *addr, void **ret)
                 }
                 
         }
+
+        /* growing the heap counts against the address-space limit */
+        if (addr > curproc->p_brk)
+        {
+                uint32_t grow = ADDR_TO_PN(PAGE_ALIGN_UP(addr)) - ADDR_TO_PN(PAGE_ALIGN_UP(curproc->p_brk));
+                int err;
+                if (grow > 0 && (err = memlimit_vsize_check(curproc, grow)) < 0)
+                {
+                        return err;
+                }
+        }
         
         struct vmmap *vmmap_cur = NULL;
         vmmap_cur = curproc->p_vmmap;
@@ -131,6 +146,9 @@ do_brk(void *addr, void **ret)
                 {
                         int vmmap_ret = vmmap_map(vmmap_cur, NULL, pgn_start, npages, PROT_READ | PROT_WRITE, MAP_PRIVATE, ((uint32_t)(vma_cur->vma_end) << 12) % PAGE_SIZE, VMMAP_DIR_HILO, &vma);
                         vma->vma_end = pgn_end;
+                        rmap_update(vma);
+                        /* the heap has grown even if it cannot be locked */
+                        mlock_future(vma);
 
                         curproc->p_brk = addr;
                         dbg(DBG_PRINT, "(GRADING3A)\n");
@@ -168,6 +186,8 @@ do_brk(void *addr, void **ret)
                 curproc->p_brk = addr;
                 
                 vma->vma_end = pgn_end;
+                rmap_update(vma);
+                mlock_future(vma);
                 
                 *ret = addr;
                 dbg(DBG_PRINT, "(GRADING3A)\n");
@@ -185,3 +205,29 @@ do_brk(void *addr, void **ret)
         dbg(DBG_PRINT, "(GRADING3D 2)\n");
         return 0;
 }
+
+/*
+ * brk_populate(2): like brk(2), but the pages the heap grows by are
+ * faulted in and mapped before returning (see vm/populate.h). A heap
+ * that could not be populated in full has still grown; the rest of it
+ * is faulted in as usual.
+ */
+int
+do_brk_populate(void *addr, void **ret)
+{
+        void *old_brk = curproc->p_brk;
+        uint32_t first, end;
+        int err;
+
+        if ((err = do_brk(addr, ret)) < 0)
+                return err;
+
+        if (NULL != addr && addr > old_brk) {
+                /* the page holding the old break is mapped already if the
+                 * process used it */
+                first = ADDR_TO_PN(old_brk);
+                end = ADDR_TO_PN(PAGE_ALIGN_UP(addr));
+                populate_range(first, end - first);
+        }
+        return 0;
+}
@@ -0,0 +1,154 @@
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/string.h"
+#include "util/parse.h"
+
+#include "proc/proc.h"
+
+#include "mm/mm.h"
+#include "mm/page.h"
+#include "mm/mmobj.h"
+#include "mm/pframe.h"
+#include "mm/pagetable.h"
+
+#include "vm/vmmap.h"
+#include "vm/swap.h"
+#include "vm/hugepage.h"
+#include "vm/faultaround.h"
+#include "vm/vmarea_ext.h"
+
+#include "test/kshell/kshell.h"
+#include "test/kshell/io.h"
+
+static uint32_t faultaround_window = 16;
+
+/* statistics */
+static uint32_t faultaround_nfaults;    /* faults that looked around */
+static uint32_t faultaround_nmapped;    /* neighbours mapped */
+
+/*
+ * Set the fault-around window of vma to npages pages. Returns 0, or
+ * -EINVAL if the window is too large.
+ */
+int
+faultaround_set_window(vmarea_t *vma, uint32_t npages)
+{
+        if (npages > FAULTAROUND_MAX_WINDOW)
+                return -EINVAL;
+        vmarea_ext(vma)->vx_fa_window = npages;
+        return 0;
+}
+
+/*
+ * Find the page a read fault on page pn of vma would map, if that can be
+ * done without blocking: the first object down the shadow chain that has
+ * the page must have it resident and not busy. A page that is swapped
+ * out, or that nobody has yet, is left for a real fault.
+ */
+static pframe_t *
+fa_find(vmarea_t *vma, uint32_t pn)
+{
+        pframe_t *pf;
+        mmobj_t *o;
+
+        for (o = vma->vma_obj; NULL != o; o = o->mmo_shadowed) {
+                if (NULL != (pf = pframe_get_resident(o, pn)))
+                        return pframe_is_busy(pf) ? NULL : pf;
+                if (swap_has(o, pn))
+                        return NULL;
+        }
+        return NULL;
+}
+
+/*
+ * Map the resident neighbours of the page at vaddr, which a read fault
+ * just mapped, in the window around it.
+ */
+void
+faultaround(vmarea_t *vma, uintptr_t vaddr)
+{
+        uint32_t vfn = ADDR_TO_PN(vaddr);
+        uint32_t npages, first, end, v;
+        pframe_t *pf;
+
+        npages = vmarea_ext(vma)->vx_fa_window;
+        if (VMAREA_FA_DEFAULT == npages)
+                npages = faultaround_window;
+        if (npages < 2)
+                return;
+
+        /* an aligned window, so that faults next to each other do not
+         * look at the same pages again */
+        first = MAX(vfn - vfn % npages, vma->vma_start);
+        end = MIN(vfn - vfn % npages + npages, vma->vma_end);
+
+        faultaround_nfaults++;
+        for (v = first; v < end; ++v) {
+                if (v == vfn || hugepage_is_mapped(curproc->p_pagedir, (uintptr_t) PN_TO_ADDR(v)))
+                        continue;
+                if (NULL == (pf = fa_find(vma, v - vma->vma_start + vma->vma_off)))
+                        continue;
+                pt_map(curproc->p_pagedir, (uintptr_t) PN_TO_ADDR(v),
+                       pt_virt_to_phys((uintptr_t) pf->pf_addr),
+                       PD_PRESENT | PD_USER, PT_PRESENT | PT_USER);
+                faultaround_nmapped++;
+        }
+}
+
+#ifdef __DRIVERS__
+
+/*
+ * faultaround                                 - show statistics
+ * faultaround window <pages>                  - set the default window
+ * faultaround window <pages> <pid> <address>  - set the window of one area
+ */
+static int
+faultaround_kshell(kshell_t *ksh, int argc, char **argv)
+{
+        uint32_t npages, pid, addr;
+        vmarea_t *vma;
+        proc_t *p;
+
+        if ((3 == argc || 5 == argc) && 0 == strcmp(argv[1], "window")) {
+                if (0 > parse_uint(argv[2], &npages) || npages > FAULTAROUND_MAX_WINDOW) {
+                        kprintf(ksh, "faultaround: window must be 0-%d pages\n",
+                                FAULTAROUND_MAX_WINDOW);
+                        return 0;
+                }
+                if (3 == argc) {
+                        faultaround_window = npages;
+                        return 0;
+                }
+                if (0 > parse_uint(argv[3], &pid) || 0 > parse_uint(argv[4], &addr)
+                    || NULL == (p = proc_lookup(pid)) || NULL == p->p_vmmap
+                    || NULL == (vma = vmmap_lookup(p->p_vmmap, ADDR_TO_PN(addr)))) {
+                        kprintf(ksh, "faultaround: no such mapping\n");
+                        return 0;
+                }
+                faultaround_set_window(vma, npages);
+                return 0;
+        } else if (1 != argc) {
+                kprintf(ksh, "usage: faultaround [window <pages> [<pid> <address>]]\n");
+                return 0;
+        }
+
+        kprintf(ksh, "window:        %u pages\n", faultaround_window);
+        kprintf(ksh, "faults:        %u\n", faultaround_nfaults);
+        kprintf(ksh, "pages mapped:  %u\n", faultaround_nmapped);
+        return 0;
+}
+
+static __attribute__((unused)) void
+faultaround_kshell_init(void)
+{
+        kshell_add_command("faultaround", faultaround_kshell,
+                           "show or tune mapping of resident neighbours on a fault");
+}
+init_func(faultaround_kshell_init);
+init_depends(kshell_init);
+
+#endif /* __DRIVERS__ */
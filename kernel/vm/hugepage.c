@@ -0,0 +1,361 @@
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/string.h"
+
+#include "proc/proc.h"
+
+#include "mm/mm.h"
+#include "mm/mman.h"
+#include "mm/page.h"
+#include "mm/mmobj.h"
+#include "mm/pframe.h"
+#include "mm/pframe_ext.h"
+#include "mm/pagetable.h"
+#include "mm/tlb.h"
+#include "mm/fileobj.h"
+
+#include "vm/vmmap.h"
+#include "vm/pagefault.h"
+#include "vm/memlimit.h"
+#include "vm/hugepage.h"
+#include "vm/swap.h"
+
+#include "test/kshell/kshell.h"
+#include "test/kshell/io.h"
+
+/*
+ * pt_map() only knows how to fill in page tables, so large mappings are
+ * entered in the page directory here. This must match the layout of
+ * struct pagedir in mm/pagetable.c: the directory the MMU walks, followed
+ * by the kernel addresses of the page tables it points to. A large entry
+ * has no page table, so its pd_virtual slot stays 0; pagetable.c must
+ * therefore never see one, which is why every path that unmaps user
+ * memory calls hugepage_unmap_range() first.
+ */
+typedef struct hugepage_dir {
+        uint32_t        hd_physical[PT_ENTRY_COUNT];
+        uintptr_t       hd_virtual[PT_ENTRY_COUNT];
+} hugepage_dir_t;
+
+#ifndef PD_LARGE
+#define PD_LARGE                0x080
+#endif
+
+#define CR4_PSE                 0x010
+#define CPUID_PSE               0x008   /* leaf 1, %edx */
+
+#define hugepage_pdindex(vaddr) ((uintptr_t)(vaddr) >> HUGEPAGE_SHIFT)
+#define hugepage_pde(pd, vaddr) (((hugepage_dir_t *)(pd))->hd_physical[hugepage_pdindex(vaddr)])
+
+/* Pages looked up per pframe_gang_lookup() call when checking a run */
+#define HUGEPAGE_BATCH          64
+
+/* A run is only taken while at least this many pages would stay free,
+ * so that large pages do not push everyone else into pageout. */
+#define HUGEPAGE_FREE_MIN       (2 * HUGEPAGE_NPAGES)
+
+static int hugepage_pse = 0;           /* CR4.PSE is set */
+static int hugepage_enabled = 0;       /* new large mappings allowed */
+
+/* statistics */
+static uint32_t hugepage_nmapped;       /* runs allocated and mapped */
+static uint32_t hugepage_nremapped;     /* resident runs mapped again */
+static uint32_t hugepage_nfallbacks;    /* eligible faults that got small pages */
+static uint32_t hugepage_ndemoted;      /* large mappings torn down */
+
+static __attribute__((unused)) void
+hugepage_init(void)
+{
+        uint32_t eax, ebx, ecx, edx, cr4;
+
+        __asm__ volatile("cpuid"
+                         : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                         : "a"(1));
+        if (!(edx & CPUID_PSE)) {
+                dbg(DBG_VM, "no PSE support, large pages disabled\n");
+                return;
+        }
+
+        __asm__ volatile("movl %%cr4, %0" : "=r"(cr4));
+        cr4 |= CR4_PSE;
+        __asm__ volatile("movl %0, %%cr4" : : "r"(cr4));
+
+        hugepage_pse = 1;
+        hugepage_enabled = 1;
+}
+init_func(hugepage_init);
+
+/*
+ * Returns nonzero if the stretch of vma starting at vfn may be backed by
+ * a large page: the stretch is 4 MB-aligned and inside the area, and its
+ * pages belong to the area's own anonymous memory, that is, the mapping's
+ * object is an anon object or the one shadow object of a private
+ * anonymous mapping that has not been forked. Deeper shadow chains share
+ * pages with other processes and must keep copy-on-write granularity.
+ */
+static int
+hugepage_eligible(vmarea_t *vma, uint32_t vfn)
+{
+        mmobj_t *o = vma->vma_obj;
+
+        if (0 != (vfn & (HUGEPAGE_NPAGES - 1)))
+                return 0;
+        if (vfn < vma->vma_start || vfn + HUGEPAGE_NPAGES > vma->vma_end)
+                return 0;
+        if (anon_is_anon(o))
+                return 1;
+        return NULL != o->mmo_shadowed && anon_is_anon(o->mmo_shadowed);
+}
+
+/*
+ * Check the pages [pn, pn + HUGEPAGE_NPAGES) of o. Returns 0 if none of
+ * them exists yet, 1 if all of them are resident, idle and still pinned
+ * by pframe_adopt_run(), in a run of frames that a large page can map
+ * (in which case the physical address of the run is stored in *paddr),
+ * and -1 otherwise. A page that was swapped out or merged by ksmd
+ * exists only in the swap index; it must be swapped in by a small fault,
+ * not zero-filled with the run.
+ */
+static int
+hugepage_run_resident(mmobj_t *o, uint32_t pn, uintptr_t *paddr)
+{
+        pframe_t *pfs[HUGEPAGE_BATCH];
+        uint32_t done = 0, n, i;
+        uintptr_t base = 0;
+
+        if (swap_has_range(o, pn, pn + HUGEPAGE_NPAGES - 1))
+                return -1;
+
+        while (done < HUGEPAGE_NPAGES) {
+                n = pframe_gang_lookup(o, pn + done, pn + HUGEPAGE_NPAGES - 1,
+                                       pfs, HUGEPAGE_BATCH);
+                if (0 == n)
+                        break;
+                for (i = 0; i < n; ++i, ++done) {
+                        pframe_t *pf = pfs[i];
+                        uintptr_t phys = pt_virt_to_phys((uintptr_t) pf->pf_addr);
+
+                        if (pf->pf_pagenum != pn + done)
+                                return -1;
+                        if (!pframe_is_adopted(pf) || pframe_is_busy(pf))
+                                return -1;
+                        if (0 == done)
+                                base = phys;
+                        if (phys != base + done * PAGE_SIZE)
+                                return -1;
+                }
+        }
+
+        if (0 == done)
+                return 0;
+        if (done < HUGEPAGE_NPAGES || 0 != (base & (HUGEPAGE_SIZE - 1)))
+                return -1;
+        *paddr = base;
+        return 1;
+}
+
+/*
+ * Get a physically contiguous, 4 MB-aligned run of free page frames, or
+ * NULL if memory is too short or too fragmented.
+ */
+static void *
+hugepage_alloc_run(void)
+{
+        void *run;
+        uintptr_t phys;
+        uint32_t i;
+
+        if (page_free_count() < HUGEPAGE_NPAGES + HUGEPAGE_FREE_MIN)
+                return NULL;
+        if (!memlimit_rss_room(curproc->p_pid, HUGEPAGE_NPAGES))
+                return NULL;
+        if (NULL == (run = page_alloc_n(HUGEPAGE_NPAGES)))
+                return NULL;
+
+        phys = pt_virt_to_phys((uintptr_t) run);
+        if (0 != (phys & (HUGEPAGE_SIZE - 1))
+            || pt_virt_to_phys((uintptr_t) run + HUGEPAGE_SIZE - PAGE_SIZE)
+               != phys + HUGEPAGE_SIZE - PAGE_SIZE) {
+                /* frames are freed one by one once they are in use, so
+                 * give this run back the same way */
+                for (i = 0; i < HUGEPAGE_NPAGES; ++i)
+                        page_free((char *) run + i * PAGE_SIZE);
+                return NULL;
+        }
+        return run;
+}
+
+/*
+ * Try to serve a fault at vaddr in vma with a large page. Returns 1 if
+ * the stretch around vaddr is now mapped by one, 0 if the caller should
+ * fall back to mapping the single page.
+ */
+int
+hugepage_fault(vmarea_t *vma, uintptr_t vaddr)
+{
+        uint32_t vfn = ADDR_TO_PN(vaddr) & ~(HUGEPAGE_NPAGES - 1);
+        uint32_t pn = vfn - vma->vma_start + vma->vma_off;
+        uint32_t pdflags = PD_PRESENT | PD_USER | PD_LARGE;
+        uintptr_t paddr;
+        void *run;
+
+        if (!hugepage_enabled || !hugepage_eligible(vma, vfn))
+                return 0;
+
+        /* some of the stretch is already mapped with small pages */
+        if (hugepage_pde(curproc->p_pagedir, vaddr) & PD_PRESENT)
+                return 0;
+
+        switch (hugepage_run_resident(vma->vma_obj, pn, &paddr)) {
+                case 1:
+                        hugepage_nremapped++;
+                        break;
+                case 0:
+                        if (NULL == (run = hugepage_alloc_run())
+                            || 0 > pframe_adopt_run(vma->vma_obj, pn, HUGEPAGE_NPAGES, run)) {
+                                hugepage_nfallbacks++;
+                                return 0;
+                        }
+                        paddr = pt_virt_to_phys((uintptr_t) run);
+                        hugepage_nmapped++;
+                        break;
+                default:
+                        hugepage_nfallbacks++;
+                        return 0;
+        }
+
+        /* the pages belong to this mapping alone, so writes need no
+         * copy-on-write fault */
+        if (vma->vma_prot & PROT_WRITE)
+                pdflags |= PD_WRITE;
+        hugepage_pde(curproc->p_pagedir, vaddr) = paddr | pdflags;
+
+        dbg(DBG_VM, "pid %d: large page at 0x%08x for page %u of obj %p\n",
+            curproc->p_pid, PN_TO_ADDR(vfn), pn, vma->vma_obj);
+        return 1;
+}
+
+/*
+ * Tear down every large mapping of pd that overlaps [vlow, vhigh). The
+ * pages stay resident; later faults map them again.
+ */
+void
+hugepage_unmap_range(pagedir_t *pd, uintptr_t vlow, uintptr_t vhigh)
+{
+        uintptr_t vaddr;
+
+        /* large mappings made before 'hugepage off' still go away here */
+        if (!hugepage_pse)
+                return;
+
+        for (vaddr = vlow & ~(HUGEPAGE_SIZE - 1); vaddr < vhigh; vaddr += HUGEPAGE_SIZE) {
+                uint32_t *pde = &hugepage_pde(pd, vaddr);
+                if ((*pde & (PD_PRESENT | PD_LARGE)) == (PD_PRESENT | PD_LARGE)) {
+                        *pde = 0;
+                        if (pt_get() == pd)
+                                tlb_flush(vaddr);
+                        hugepage_ndemoted++;
+                }
+                if (vaddr + HUGEPAGE_SIZE < vaddr)
+                        break;
+        }
+}
+
+/*
+ * Returns HUGEPAGE_MAPPED_LARGE if vaddr is mapped in pd by a large page,
+ * HUGEPAGE_MAPPED_SMALL if it is mapped by an entry of a page table (the
+ * page directory layout is mirrored above), and 0 if it is not mapped.
+ */
+int
+hugepage_is_mapped(pagedir_t *pd, uintptr_t vaddr)
+{
+        uint32_t *pte;
+
+        if ((hugepage_pde(pd, vaddr) & (PD_PRESENT | PD_LARGE)) == (PD_PRESENT | PD_LARGE))
+                return HUGEPAGE_MAPPED_LARGE;
+        if (NULL == (pte = hugepage_pte(pd, vaddr)) || !(*pte & PT_PRESENT))
+                return 0;
+        return HUGEPAGE_MAPPED_SMALL;
+}
+
+/*
+ * Returns the page table entry for vaddr in pd, present or not, or NULL
+ * if there is no page table for it (including when a large page maps
+ * it). The entry may be changed as long as the caller sees to the TLB.
+ */
+uint32_t *
+hugepage_pte(pagedir_t *pd, uintptr_t vaddr)
+{
+        uint32_t pde = hugepage_pde(pd, vaddr);
+        uint32_t *pt;
+
+        if (!(pde & PD_PRESENT) || (pde & PD_LARGE))
+                return NULL;
+        pt = (uint32_t *)((hugepage_dir_t *) pd)->hd_virtual[hugepage_pdindex(vaddr)];
+        if (NULL == pt)
+                return NULL;
+        return &pt[ADDR_TO_PN(vaddr) % PT_ENTRY_COUNT];
+}
+
+/*
+ * Find room for an npages mapping that starts on a 4 MB boundary, as high
+ * in the address space as possible. Returns the starting vfn or -1.
+ */
+int
+hugepage_align_range(vmmap_t *map, uint32_t npages)
+{
+        int vfn;
+
+        if (!hugepage_enabled)
+                return -1;
+        if (0 > (vfn = vmmap_find_range(map, npages + HUGEPAGE_NPAGES - 1, VMMAP_DIR_HILO)))
+                return -1;
+        return (vfn + HUGEPAGE_NPAGES - 1) & ~(HUGEPAGE_NPAGES - 1);
+}
+
+#ifdef __DRIVERS__
+
+/*
+ * hugepage          - show large page statistics
+ * hugepage on|off   - allow or stop new large mappings
+ */
+static int
+hugepage_kshell(kshell_t *ksh, int argc, char **argv)
+{
+        if (2 == argc && 0 == strcmp(argv[1], "on")) {
+                if (!hugepage_pse)
+                        kprintf(ksh, "hugepage: no PSE support\n");
+                else
+                        hugepage_enabled = 1;
+                return 0;
+        } else if (2 == argc && 0 == strcmp(argv[1], "off")) {
+                /* existing large mappings stay until they are unmapped */
+                hugepage_enabled = 0;
+                return 0;
+        } else if (1 != argc) {
+                kprintf(ksh, "usage: hugepage [on|off]\n");
+                return 0;
+        }
+
+        kprintf(ksh, "large pages:   %s\n", hugepage_enabled ? "on" : "off");
+        kprintf(ksh, "runs mapped:   %u\n", hugepage_nmapped);
+        kprintf(ksh, "runs remapped: %u\n", hugepage_nremapped);
+        kprintf(ksh, "fallbacks:     %u\n", hugepage_nfallbacks);
+        kprintf(ksh, "demotions:     %u\n", hugepage_ndemoted);
+        return 0;
+}
+
+static __attribute__((unused)) void
+hugepage_kshell_init(void)
+{
+        kshell_add_command("hugepage", hugepage_kshell,
+                           "show large page statistics, or turn them on or off");
+}
+init_func(hugepage_kshell_init);
+init_depends(kshell_init);
+
+#endif /* __DRIVERS__ */
@@ -0,0 +1,432 @@
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/list.h"
+#include "util/string.h"
+#include "util/parse.h"
+#include "util/tsc.h"
+
+#include "proc/proc.h"
+#include "proc/kthread.h"
+#include "proc/sched.h"
+
+#include "mm/mm.h"
+#include "mm/page.h"
+#include "mm/mmobj.h"
+#include "mm/pframe.h"
+#include "mm/pframe_ext.h"
+#include "mm/slab.h"
+#include "mm/fileobj.h"
+
+#include "vm/swap.h"
+#include "vm/zeropage.h"
+#include "vm/ksm.h"
+
+#include "test/kshell/kshell.h"
+#include "test/kshell/io.h"
+
+#define KSM_HASH_SIZE           256
+#define ksm_hash(sum)           ((sum) % KSM_HASH_SIZE)
+
+/* Shared frames, hashed by checksum. The zero page is always here. */
+static list_t ksm_stable[KSM_HASH_SIZE];
+static slab_allocator_t *ksm_allocator = NULL;
+static ksm_page_t ksm_zero;
+
+/*
+ * Pages seen once during the current pass, waiting for a twin. Only the
+ * (object, page number) is kept, as a key: by the time a twin turns up
+ * the page may be gone, or the object may even have been freed, so the
+ * page is looked up again and compared in full before anything is done.
+ * The pool is fixed; when it runs out the oldest candidate is forgotten.
+ */
+typedef struct ksm_candidate {
+        mmobj_t         *kc_obj;
+        uint32_t        kc_pagenum;
+        uint32_t        kc_sum;
+        list_link_t     kc_hlink;       /* on ksm_unstable, by checksum */
+        list_link_t     kc_lru;
+} ksm_candidate_t;
+
+#define KSM_NCANDIDATES         512
+
+static ksm_candidate_t ksm_candidates[KSM_NCANDIDATES];
+static list_t ksm_unstable[KSM_HASH_SIZE];
+static list_t ksm_candidate_lru;        /* least recently added first */
+
+/* The scanner. It is woken from the idle loop at most once every
+ * ksm_interval ticks and looks at ksm_batch frames each time. */
+static proc_t *ksmd = NULL;
+static kthread_t *ksmd_thr = NULL;
+static ktqueue_t ksmd_waitq;
+
+/* off unless configured (KSM in Config.mk) or turned on with 'ksm on' */
+#ifdef __KSM__
+static int ksm_on = 1;
+#else
+static int ksm_on = 0;
+#endif
+static uint32_t ksm_batch = 64;         /* frames looked at per wakeup */
+static uint32_t ksm_interval = 100;     /* ticks of 2^20 cycles between wakeups */
+static uint32_t ksm_last;               /* last wakeup */
+static uint32_t ksm_cursor;             /* next frame number to look at */
+
+/* statistics */
+static uint32_t ksm_nscanned;           /* pages looked at */
+static uint32_t ksm_nmerged;            /* pages freed by merging */
+static uint32_t ksm_npasses;            /* complete walks of memory */
+
+static void *ksmd_run(int arg1, void *arg2);
+
+static uint32_t
+ksm_checksum(const void *page)
+{
+        const uint32_t *w = page;
+        uint32_t sum = 2166136261u, i;
+
+        for (i = 0; i < PAGE_SIZE / sizeof(uint32_t); ++i)
+                sum = (sum ^ w[i]) * 16777619u;
+        return sum;
+}
+
+/* Forget every candidate, at the start of a pass. */
+static void
+ksm_forget(void)
+{
+        uint32_t i;
+
+        for (i = 0; i < KSM_NCANDIDATES; ++i) {
+                if (list_link_is_linked(&ksm_candidates[i].kc_hlink))
+                        list_remove(&ksm_candidates[i].kc_hlink);
+        }
+}
+
+static __attribute__((unused)) void
+ksm_init(void)
+{
+        uint32_t i;
+
+        for (i = 0; i < KSM_HASH_SIZE; ++i) {
+                list_init(&ksm_stable[i]);
+                list_init(&ksm_unstable[i]);
+        }
+        list_init(&ksm_candidate_lru);
+        for (i = 0; i < KSM_NCANDIDATES; ++i) {
+                list_link_init(&ksm_candidates[i].kc_hlink);
+                list_insert_tail(&ksm_candidate_lru, &ksm_candidates[i].kc_lru);
+        }
+        ksm_allocator = slab_allocator_create("ksm_page", sizeof(ksm_page_t));
+        KASSERT(NULL != ksm_allocator);
+
+        sched_queue_init(&ksmd_waitq);
+
+        KASSERT(curproc && (PID_IDLE == curproc->p_pid)
+                && "should be calling this from idleproc");
+        ksmd = proc_create("ksmd");
+        KASSERT(NULL != ksmd);
+        ksmd_thr = kthread_create(ksmd, ksmd_run, 0, NULL);
+        KASSERT(NULL != ksmd_thr);
+
+        sched_make_runnable(ksmd_thr);
+}
+init_func(ksm_init);
+init_depends(sched_init);
+
+/*
+ * Called from pframe_shutdown(): stop ksmd and wait for it.
+ */
+void
+ksm_shutdown(void)
+{
+        int pid, child;
+
+        KASSERT(NULL != ksmd_thr);
+        kthread_cancel(ksmd_thr, (void *) 0);
+        ksmd_thr = NULL;
+
+        pid = ksmd->p_pid;
+        child = do_waitpid(pid, 0, NULL);
+        KASSERT(pid == child && "waited on process other than ksmd");
+}
+
+/*
+ * Called from the idle loop. Must not block.
+ */
+void
+ksm_idle(void)
+{
+        if (ksm_on && NULL != ksmd_thr && tsc_ticks() - ksm_last >= ksm_interval) {
+                ksm_last = tsc_ticks();
+                sched_broadcast_on(&ksmd_waitq);
+        }
+}
+
+void
+ksm_get(ksm_page_t *kp)
+{
+        kp->kp_refcount++;
+}
+
+void
+ksm_put(ksm_page_t *kp)
+{
+        KASSERT(0 < kp->kp_refcount);
+        if (0 != --kp->kp_refcount)
+                return;
+
+        KASSERT(&ksm_zero != kp);
+        list_remove(&kp->kp_hlink);
+        page_free(kp->kp_addr);
+        slab_obj_free(ksm_allocator, kp);
+}
+
+/*
+ * Returns nonzero if pf may be merged right now: it is a page of anon or
+ * shadow memory that nobody is using, that is, one with no pins but
+ * those of its fill (see swap_fill_pins()).
+ */
+static int
+ksm_mergeable(pframe_t *pf)
+{
+        mmobj_t *o = pf->pf_obj;
+
+        if (NULL == o->mmo_shadowed && !anon_is_anon(o))
+                return 0;
+        if (pframe_is_busy(pf))
+                return 0;
+        return pf->pf_pincount == swap_fill_pins();
+}
+
+static ksm_page_t *
+ksm_stable_find(const void *page, uint32_t sum)
+{
+        ksm_page_t *kp;
+
+        list_iterate_begin(&ksm_stable[ksm_hash(sum)], kp, ksm_page_t, kp_hlink) {
+                if (kp->kp_sum == sum && 0 == memcmp(kp->kp_addr, page, PAGE_SIZE))
+                        return kp;
+        } list_iterate_end();
+        return NULL;
+}
+
+/*
+ * Make a new shared frame with the contents of page. The caller gets a
+ * reference.
+ */
+static ksm_page_t *
+ksm_stable_create(const void *page, uint32_t sum)
+{
+        ksm_page_t *kp;
+
+        if (NULL == (kp = slab_obj_alloc(ksm_allocator)))
+                return NULL;
+        if (NULL == (kp->kp_addr = page_alloc())) {
+                slab_obj_free(ksm_allocator, kp);
+                return NULL;
+        }
+        memcpy(kp->kp_addr, page, PAGE_SIZE);
+        kp->kp_sum = sum;
+        kp->kp_refcount = 1;
+        list_insert_head(&ksm_stable[ksm_hash(sum)], &kp->kp_hlink);
+        return kp;
+}
+
+/*
+ * Replace pf by kp, if pf is still mergeable and identical to it. Freeing
+ * the page takes it out of every page table; the next read fault maps
+ * kp instead. This can block.
+ */
+static int
+ksm_merge(pframe_t *pf, ksm_page_t *kp)
+{
+        if (!ksm_mergeable(pf) || 0 != memcmp(pf->pf_addr, kp->kp_addr, PAGE_SIZE))
+                return 0;
+        if (0 > swap_merge(pf->pf_obj, pf->pf_pagenum, kp))
+                return 0;
+
+        dbg(DBG_PFRAME, "ksm: merging page %d of obj %p\n", pf->pf_pagenum, pf->pf_obj);
+        if (pframe_is_pinned(pf))
+                pframe_unpin(pf);
+        pframe_free(pf);
+        ksm_nmerged++;
+        return 1;
+}
+
+static void
+ksm_candidate_add(mmobj_t *o, uint32_t pagenum, uint32_t sum)
+{
+        ksm_candidate_t *kc = list_head(&ksm_candidate_lru, ksm_candidate_t, kc_lru);
+
+        if (list_link_is_linked(&kc->kc_hlink))
+                list_remove(&kc->kc_hlink);
+        kc->kc_obj = o;
+        kc->kc_pagenum = pagenum;
+        kc->kc_sum = sum;
+        list_insert_head(&ksm_unstable[ksm_hash(sum)], &kc->kc_hlink);
+
+        list_remove(&kc->kc_lru);
+        list_insert_tail(&ksm_candidate_lru, &kc->kc_lru);
+}
+
+/*
+ * Returns a candidate page identical to pf, taking it out of the
+ * unstable table, or NULL.
+ */
+static pframe_t *
+ksm_candidate_find(pframe_t *pf, uint32_t sum)
+{
+        ksm_candidate_t *kc;
+        pframe_t *twin;
+
+        list_iterate_begin(&ksm_unstable[ksm_hash(sum)], kc, ksm_candidate_t, kc_hlink) {
+                if (kc->kc_sum != sum)
+                        continue;
+                twin = pframe_hash_find(kc->kc_obj, kc->kc_pagenum);
+                if (NULL == twin || twin == pf || !ksm_mergeable(twin)
+                    || 0 != memcmp(twin->pf_addr, pf->pf_addr, PAGE_SIZE))
+                        continue;
+                list_remove(&kc->kc_hlink);
+                return twin;
+        } list_iterate_end();
+        return NULL;
+}
+
+static void
+ksm_scan_page(pframe_t *pf)
+{
+        uint32_t sum = ksm_checksum(pf->pf_addr);
+        mmobj_t *o = pf->pf_obj;
+        uint32_t pagenum = pf->pf_pagenum;
+        ksm_page_t *kp;
+        pframe_t *twin;
+
+        if (NULL != (kp = ksm_stable_find(pf->pf_addr, sum))) {
+                ksm_merge(pf, kp);
+                return;
+        }
+
+        if (NULL == (twin = ksm_candidate_find(pf, sum))) {
+                ksm_candidate_add(o, pagenum, sum);
+                return;
+        }
+
+        /* hold a reference so that kp outlives the merges, which can
+         * block and let the pages' objects go away */
+        if (NULL == (kp = ksm_stable_create(pf->pf_addr, sum)))
+                return;
+        ksm_merge(twin, kp);
+        if (NULL != (pf = pframe_hash_find(o, pagenum)))
+                ksm_merge(pf, kp);
+        ksm_put(kp);
+}
+
+static void
+ksm_scan(uint32_t n)
+{
+        pframe_t *pf;
+
+        while (n-- > 0) {
+                if (NULL == (pf = pframe_next_frame(&ksm_cursor))) {
+                        /* end of memory: start the next pass afresh */
+                        ksm_cursor = 0;
+                        ksm_npasses++;
+                        ksm_forget();
+                        return;
+                }
+                ksm_cursor++;
+                ksm_nscanned++;
+                if (ksm_mergeable(pf))
+                        ksm_scan_page(pf);
+        }
+}
+
+static void *
+ksmd_run(int arg1, void *arg2)
+{
+        /* the zero page is a shared frame that is never freed */
+        ksm_zero.kp_addr = zeropage_page();
+        ksm_zero.kp_sum = ksm_checksum(ksm_zero.kp_addr);
+        ksm_zero.kp_refcount = 1;
+        list_insert_head(&ksm_stable[ksm_hash(ksm_zero.kp_sum)], &ksm_zero.kp_hlink);
+
+        while (1) {
+                if (sched_cancellable_sleep_on(&ksmd_waitq))
+                        kthread_exit((void *)0);
+                if (ksm_on)
+                        ksm_scan(ksm_batch);
+        }
+        return NULL;
+}
+
+#ifdef __DRIVERS__
+
+/*
+ * ksm                     - show merging statistics
+ * ksm on|off              - start or stop scanning (merged pages stay)
+ * ksm batch <frames>      - frames looked at per wakeup
+ * ksm interval <ticks>    - ticks of 2^20 cycles between wakeups
+ */
+static int
+ksm_kshell(kshell_t *ksh, int argc, char **argv)
+{
+        uint32_t i, nshared = 0, nsharing = 0, v;
+        ksm_page_t *kp;
+
+        if (2 == argc && 0 == strcmp(argv[1], "on")) {
+                ksm_on = 1;
+                return 0;
+        } else if (2 == argc && 0 == strcmp(argv[1], "off")) {
+                ksm_on = 0;
+                return 0;
+        } else if (3 == argc && 0 == strcmp(argv[1], "batch")) {
+                if (parse_uint(argv[2], &v) || 0 == v)
+                        kprintf(ksh, "ksm: bad batch '%s'\n", argv[2]);
+                else
+                        ksm_batch = v;
+                return 0;
+        } else if (3 == argc && 0 == strcmp(argv[1], "interval")) {
+                if (parse_uint(argv[2], &v))
+                        kprintf(ksh, "ksm: bad interval '%s'\n", argv[2]);
+                else
+                        ksm_interval = v;
+                return 0;
+        } else if (1 != argc) {
+                kprintf(ksh, "usage: ksm [on|off|batch <frames>|interval <ticks>]\n");
+                return 0;
+        }
+
+        for (i = 0; i < KSM_HASH_SIZE; ++i) {
+                list_iterate_begin(&ksm_stable[i], kp, ksm_page_t, kp_hlink) {
+                        if (&ksm_zero == kp)
+                                continue;
+                        nshared++;
+                        nsharing += kp->kp_refcount;
+                } list_iterate_end();
+        }
+
+        kprintf(ksh, "ksm:            %s, %u frames every %u ticks\n",
+                ksm_on ? "on" : "off", ksm_batch, ksm_interval);
+        /* the zero page exists anyway, so every page merged into it is
+         * saved; the other shared frames cost one page each */
+        kprintf(ksh, "frames shared:  %u\n", nshared);
+        kprintf(ksh, "pages sharing:  %u, and %u the zero page\n",
+                nsharing, ksm_zero.kp_refcount - 1);
+        kprintf(ksh, "pages saved:    %u\n", nsharing - nshared + ksm_zero.kp_refcount - 1);
+        kprintf(ksh, "pages scanned:  %u in %u full passes\n", ksm_nscanned, ksm_npasses);
+        kprintf(ksh, "pages merged:   %u\n", ksm_nmerged);
+        return 0;
+}
+
+static __attribute__((unused)) void
+ksm_kshell_init(void)
+{
+        kshell_add_command("ksm", ksm_kshell,
+                           "show same-page merging statistics, or set it up");
+}
+init_func(ksm_kshell_init);
+init_depends(kshell_init);
+
+#endif /* __DRIVERS__ */
@@ -0,0 +1,229 @@
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/list.h"
+#include "util/string.h"
+
+#include "proc/proc.h"
+
+#include "mm/mm.h"
+#include "mm/mman.h"
+#include "mm/page.h"
+#include "mm/mmobj.h"
+#include "mm/pframe.h"
+#include "mm/pframe_ext.h"
+#include "mm/pagetable.h"
+#include "mm/readahead.h"
+#include "mm/fileobj.h"
+#include "mm/tlbgather.h"
+
+#include "vm/vmmap.h"
+#include "vm/swap.h"
+#include "vm/hugepage.h"
+#include "vm/madvise.h"
+#include "vm/mlock.h"
+#include "vm/vmarea_ext.h"
+
+/*
+ * Returns the access pattern given for vma: MADV_NORMAL, MADV_RANDOM
+ * or MADV_SEQUENTIAL.
+ */
+int
+madvise_advice(vmarea_t *vma)
+{
+        return vmarea_ext(vma)->vx_advice;
+}
+
+/*
+ * Start the fills of the file pages behind [vfn, end) of vma. Anonymous
+ * memory has nothing to read, short of swap, which is left alone.
+ */
+static void
+madvise_willneed(vmarea_t *vma, uint32_t vfn, uint32_t end)
+{
+        mmobj_t *bottom = mmobj_bottom_obj(vma->vma_obj);
+        uint32_t pn = vfn - vma->vma_start + vma->vma_off;
+
+        readahead_range(bottom, pn, MIN(pn + (end - vfn), mmobj_file_npages(bottom)));
+}
+
+/*
+ * Whether a shadow object below the top object o of a chain holds page
+ * pn, resident or in swap: a copy written before a fork, which the
+ * process would see again if its own copy were simply dropped. The
+ * bottom object is not looked at.
+ */
+static int
+madvise_inherited(mmobj_t *o, uint32_t pn)
+{
+        for (o = o->mmo_shadowed; NULL != o->mmo_shadowed; o = o->mmo_shadowed) {
+                if (NULL != pframe_get_resident(o, pn) || swap_has(o, pn))
+                        return 1;
+        }
+        return 0;
+}
+
+/*
+ * Drop the pages [pn, end) of the anon or shadow object o, or with lazy
+ * set, hand the resident ones to pframe_lazyfree(). Copies in swap go at
+ * once either way, and so do pages with an inherited copy below them
+ * (see madvise_zero()). Busy pages are waited for. The range must have
+ * no large mappings left, so the pin pframe_adopt_run() took is dropped.
+ * Returns 0, or -EINVAL if a page is pinned by anyone but its fill.
+ */
+static int
+madvise_drop(mmobj_t *o, uint32_t pn, uint32_t end, int lazy)
+{
+        pframe_t *pf;
+
+        while (pn < end) {
+                swap_discard(o, pn);
+                if (1 != pframe_gang_lookup(o, pn, pn, &pf, 1)) {
+                        ++pn;
+                        continue;
+                }
+                if (pframe_is_busy(pf)) {
+                        /* look again: it may be gone when we wake up */
+                        pframe_wait_busy(pf);
+                        continue;
+                }
+                pframe_unadopt(pf);
+                if (pf->pf_pincount != swap_fill_pins())
+                        return -EINVAL;
+                if (pframe_is_pinned(pf))
+                        pframe_unpin(pf);
+                if (lazy && !madvise_inherited(o, pn))
+                        pframe_lazyfree(pf);
+                else
+                        pframe_free(pf);        /* may block */
+                ++pn;
+        }
+        return 0;
+}
+
+/*
+ * After madvise_drop() of the pages [pn, end) of the top shadow object o
+ * of a private anonymous mapping: give every page that is gone from o
+ * but has an inherited copy below it a zero-filled page in o, so that the
+ * discarded range reads as zeros rather than as it was at fork time.
+ */
+static int
+madvise_zero(mmobj_t *o, uint32_t pn, uint32_t end)
+{
+        pframe_t *pf;
+        int ret;
+
+        for (; pn < end; ++pn) {
+                if (NULL != pframe_get_resident(o, pn) || swap_has(o, pn)
+                    || !madvise_inherited(o, pn))
+                        continue;
+                if (0 > (ret = pframe_get(o, pn, &pf)))
+                        return ret;
+                memset(pf->pf_addr, 0, PAGE_SIZE);
+                if (0 > (ret = pframe_dirty(pf)))
+                        return ret;
+        }
+        return 0;
+}
+
+/* MADV_DONTNEED and MADV_FREE of [vfn, end) of vma */
+static int
+madvise_discard(vmarea_t *vma, uint32_t vfn, uint32_t end, int lazy, tlb_gather_t *tg)
+{
+        pagedir_t *pd = curproc->p_pagedir;
+        int private = (MAP_PRIVATE == (vma->vma_flags & MAP_TYPE));
+        int anon = anon_is_anon(mmobj_bottom_obj(vma->vma_obj));
+        uint32_t pn = vfn - vma->vma_start + vma->vma_off;
+        int ret;
+
+        if (lazy && (!private || !anon))
+                return -EINVAL;
+        /* locked memory stays as it is, as on Linux */
+        if (mlock_is_locked(vma, vfn, end))
+                return -EINVAL;
+
+        hugepage_unmap_range(pd, (uintptr_t) PN_TO_ADDR(vfn), (uintptr_t) PN_TO_ADDR(end));
+        pframe_harvest_unmap(curproc->p_vmmap, vfn, end);
+        pt_unmap_range(pd, (uintptr_t) PN_TO_ADDR(vfn), (uintptr_t) PN_TO_ADDR(end));
+        tlb_gather_range(tg, pd, (uintptr_t) PN_TO_ADDR(vfn), (uintptr_t) PN_TO_ADDR(end));
+
+        /* a private mapping's own pages are in the shadow object at the
+         * top of its chain; shared memory stays as it is */
+        if (!private || NULL == vma->vma_obj->mmo_shadowed)
+                return 0;
+        if (0 > (ret = madvise_drop(vma->vma_obj, pn, pn + (end - vfn), lazy)))
+                return ret;
+        if (anon)
+                return madvise_zero(vma->vma_obj, pn, pn + (end - vfn));
+        return 0;
+}
+
+/*
+ * This function implements the madvise(2) syscall (see vm/madvise.h).
+ * Returns 0, -EINVAL for a bad range or advice (or MADV_FREE of memory
+ * other than private anonymous memory, or a discard of locked memory),
+ * or -ENOMEM if part of the range is not mapped; the advice is still
+ * applied to the rest.
+ */
+int
+do_madvise(void *addr, size_t len, int advice)
+{
+        uint32_t lopage, hipage, vfn, end, covered = 0;
+        vmarea_t *vma;
+        tlb_gather_t tg;
+        int err = 0, ret;
+
+        switch (advice) {
+                case MADV_NORMAL:
+                case MADV_RANDOM:
+                case MADV_SEQUENTIAL:
+                case MADV_WILLNEED:
+                case MADV_DONTNEED:
+                case MADV_FREE:
+                        break;
+                default:
+                        return -EINVAL;
+        }
+        if (!PAGE_ALIGNED(addr) || (uint32_t) addr < USER_MEM_LOW
+            || USER_MEM_HIGH - (uint32_t) addr < len)
+                return -EINVAL;
+        if (0 == len)
+                return 0;
+
+        lopage = ADDR_TO_PN(addr);
+        hipage = ADDR_TO_PN(PAGE_ALIGN_UP((uint32_t) addr + len));
+
+        tlb_gather_init(&tg);
+        list_iterate_begin(&curproc->p_vmmap->vmm_list, vma, vmarea_t, vma_plink) {
+                if (vma->vma_end <= lopage || vma->vma_start >= hipage)
+                        continue;
+                vfn = MAX(lopage, vma->vma_start);
+                end = MIN(hipage, vma->vma_end);
+                covered += end - vfn;
+
+                ret = 0;
+                switch (advice) {
+                        case MADV_WILLNEED:
+                                madvise_willneed(vma, vfn, end);
+                                break;
+                        case MADV_DONTNEED:
+                                ret = madvise_discard(vma, vfn, end, 0, &tg);
+                                break;
+                        case MADV_FREE:
+                                ret = madvise_discard(vma, vfn, end, 1, &tg);
+                                break;
+                        default:
+                                vmarea_ext(vma)->vx_advice = advice;
+                                break;
+                }
+                if (ret < 0)
+                        err = ret;
+        } list_iterate_end();
+        tlb_gather_finish(&tg);
+
+        if (0 == err && covered < hipage - lopage)
+                err = -ENOMEM;
+        return err;
+}
@@ -0,0 +1,379 @@
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/list.h"
+#include "util/printf.h"
+#include "util/string.h"
+#include "util/parse.h"
+
+#include "proc/proc.h"
+
+#include "mm/slab.h"
+#include "mm/page.h"
+#include "mm/pframe_ext.h"
+
+#include "vm/vmmap.h"
+#include "vm/memlimit.h"
+
+#include "test/kshell/kshell.h"
+#include "test/kshell/io.h"
+
+/*
+ * Accounting record for one process. Records are hashed by pid so that
+ * pframe_free() can uncharge a frame without holding on to a pointer to
+ * a process that may already have been reaped.
+ */
+typedef struct memlimit {
+        pid_t           ml_pid;
+        uint32_t        ml_rss;         /* frames currently charged */
+        uint32_t        ml_rss_peak;
+        uint32_t        ml_rss_max;     /* resident limit in pages, 0 = none */
+        uint32_t        ml_vsize_max;   /* address-space limit in pages, 0 = none */
+        uint32_t        ml_reclaimed;   /* frames taken back at fault time */
+        uint32_t        ml_locked;      /* frames pinned by mlock(2) */
+        uint32_t        ml_locked_max;  /* locked-memory limit in pages, 0 = none */
+        int             ml_lockall;     /* mlockall(2) flags still in effect */
+        list_link_t     ml_link;
+} memlimit_t;
+
+#define MEMLIMIT_HASH_SIZE 32
+#define memlimit_hash(pid) ((uint32_t)(pid) % MEMLIMIT_HASH_SIZE)
+
+static list_t memlimit_hash[MEMLIMIT_HASH_SIZE];
+static slab_allocator_t *memlimit_allocator = NULL;
+
+/* Limits given to processes that have no parent to inherit from */
+static uint32_t memlimit_default_rss = 0;
+static uint32_t memlimit_default_vsize = 0;
+static uint32_t memlimit_default_locked = MEMLIMIT_DEFAULT_LOCKED;
+
+/*
+ * Called from proc_init(), before the idle process is created, so that
+ * every process (including idle and init) gets an accounting record.
+ */
+void
+memlimit_init(void)
+{
+        int i;
+        for (i = 0; i < MEMLIMIT_HASH_SIZE; ++i)
+                list_init(&memlimit_hash[i]);
+
+        memlimit_allocator = slab_allocator_create("memlimit", sizeof(memlimit_t));
+        KASSERT(NULL != memlimit_allocator);
+}
+
+static memlimit_t *
+memlimit_lookup(pid_t pid)
+{
+        memlimit_t *ml;
+        list_iterate_begin(&memlimit_hash[memlimit_hash(pid)], ml, memlimit_t, ml_link) {
+                if (ml->ml_pid == pid)
+                        return ml;
+        } list_iterate_end();
+        return NULL;
+}
+
+/*
+ * Create the accounting record for a new process. Limits are inherited
+ * from the creating process, like rlimits.
+ */
+void
+memlimit_proc_init(proc_t *p)
+{
+        memlimit_t *ml, *parent;
+
+        KASSERT(NULL == memlimit_lookup(p->p_pid));
+
+        ml = slab_obj_alloc(memlimit_allocator);
+        KASSERT(NULL != ml);
+
+        ml->ml_pid = p->p_pid;
+        ml->ml_rss = 0;
+        ml->ml_rss_peak = 0;
+        ml->ml_reclaimed = 0;
+        ml->ml_locked = 0;
+        ml->ml_lockall = 0;     /* locks are not inherited, only the limit */
+        ml->ml_rss_max = memlimit_default_rss;
+        ml->ml_vsize_max = memlimit_default_vsize;
+        ml->ml_locked_max = memlimit_default_locked;
+        if (NULL != curproc && NULL != (parent = memlimit_lookup(curproc->p_pid))) {
+                ml->ml_rss_max = parent->ml_rss_max;
+                ml->ml_vsize_max = parent->ml_vsize_max;
+                ml->ml_locked_max = parent->ml_locked_max;
+        }
+
+        list_link_init(&ml->ml_link);
+        list_insert_head(&memlimit_hash[memlimit_hash(p->p_pid)], &ml->ml_link);
+}
+
+/*
+ * Tear down the record of an exiting process. Frames that are still
+ * charged to it (typically file pages, which outlive the mappings that
+ * faulted them in) are handed back to nobody.
+ */
+void
+memlimit_proc_exit(proc_t *p)
+{
+        memlimit_t *ml = memlimit_lookup(p->p_pid);
+        if (NULL == ml)
+                return;
+
+        pframe_disown(p->p_pid);
+
+        list_remove(&ml->ml_link);
+        slab_obj_free(memlimit_allocator, ml);
+}
+
+void
+memlimit_charge(pid_t pid)
+{
+        memlimit_t *ml = memlimit_lookup(pid);
+        if (NULL != ml) {
+                ml->ml_rss++;
+                if (ml->ml_rss > ml->ml_rss_peak)
+                        ml->ml_rss_peak = ml->ml_rss;
+        }
+}
+
+void
+memlimit_uncharge(pid_t pid)
+{
+        memlimit_t *ml = memlimit_lookup(pid);
+        if (NULL != ml) {
+                KASSERT(0 < ml->ml_rss);
+                ml->ml_rss--;
+        }
+}
+
+void
+memlimit_reclaimed(pid_t pid, uint32_t npages)
+{
+        memlimit_t *ml = memlimit_lookup(pid);
+        if (NULL != ml)
+                ml->ml_reclaimed += npages;
+}
+
+/*
+ * Returns nonzero if charging one more frame to the process would put it
+ * over its resident limit.
+ */
+int
+memlimit_rss_exceeded(pid_t pid)
+{
+        memlimit_t *ml = memlimit_lookup(pid);
+        return (NULL != ml) && (0 != ml->ml_rss_max) && (ml->ml_rss >= ml->ml_rss_max);
+}
+
+/*
+ * Returns nonzero if the process is at its resident limit even without
+ * counting the npinned frames charged to it that it cannot give back.
+ */
+int
+memlimit_rss_unpinned_exceeded(pid_t pid, uint32_t npinned)
+{
+        memlimit_t *ml = memlimit_lookup(pid);
+        return (NULL != ml) && (0 != ml->ml_rss_max)
+               && (ml->ml_rss >= npinned) && (ml->ml_rss - npinned >= ml->ml_rss_max);
+}
+
+/*
+ * Returns nonzero if npages more frames can be charged to the process
+ * without going over its resident limit.
+ */
+int
+memlimit_rss_room(pid_t pid, uint32_t npages)
+{
+        memlimit_t *ml = memlimit_lookup(pid);
+        return (NULL == ml) || (0 == ml->ml_rss_max) || (ml->ml_rss + npages <= ml->ml_rss_max);
+}
+
+/*
+ * Charge npages frames locked by mlock(2) to the process. Returns 0, or
+ * -ENOMEM (and charges nothing) if that would put it over its
+ * locked-memory limit.
+ */
+int
+memlimit_locked_charge(pid_t pid, uint32_t npages)
+{
+        memlimit_t *ml = memlimit_lookup(pid);
+
+        if (NULL == ml)
+                return 0;
+        if (0 != ml->ml_locked_max && ml->ml_locked + npages > ml->ml_locked_max) {
+                dbg(DBG_VMMAP, "pid %d: locked-memory limit of %u pages reached\n",
+                    pid, ml->ml_locked_max);
+                return -ENOMEM;
+        }
+        ml->ml_locked += npages;
+        return 0;
+}
+
+void
+memlimit_locked_uncharge(pid_t pid, uint32_t npages)
+{
+        memlimit_t *ml = memlimit_lookup(pid);
+        if (NULL != ml) {
+                KASSERT(ml->ml_locked >= npages);
+                ml->ml_locked -= npages;
+        }
+}
+
+/* The mlockall(2) flags in effect for the process (MCL_FUTURE or 0). */
+int
+memlimit_lockall(pid_t pid)
+{
+        memlimit_t *ml = memlimit_lookup(pid);
+        return (NULL != ml) ? ml->ml_lockall : 0;
+}
+
+void
+memlimit_set_lockall(pid_t pid, int flags)
+{
+        memlimit_t *ml = memlimit_lookup(pid);
+        if (NULL != ml)
+                ml->ml_lockall = flags;
+}
+
+/* Number of pages covered by the vmareas of the given address space. */
+uint32_t
+memlimit_vsize(vmmap_t *map)
+{
+        uint32_t npages = 0;
+        vmarea_t *vma;
+        list_iterate_begin(&map->vmm_list, vma, vmarea_t, vma_plink) {
+                npages += vma->vma_end - vma->vma_start;
+        } list_iterate_end();
+        return npages;
+}
+
+/*
+ * Check whether the process may grow its address space by npages.
+ * Returns 0 if it may, -ENOMEM otherwise.
+ */
+int
+memlimit_vsize_check(proc_t *p, uint32_t npages)
+{
+        memlimit_t *ml;
+
+        if (NULL == p || NULL == (ml = memlimit_lookup(p->p_pid)))
+                return 0;
+        if (0 == ml->ml_vsize_max)
+                return 0;
+        if (memlimit_vsize(p->p_vmmap) + npages > ml->ml_vsize_max) {
+                dbg(DBG_VMMAP, "pid %d: address-space limit of %u pages reached\n",
+                    p->p_pid, ml->ml_vsize_max);
+                return -ENOMEM;
+        }
+        return 0;
+}
+
+/*
+ * Set the limits of a process. A pid of -1 sets the defaults used by
+ * processes that have no parent record to inherit from.
+ */
+int
+memlimit_set(pid_t pid, uint32_t rss_max, uint32_t vsize_max, uint32_t locked_max)
+{
+        memlimit_t *ml;
+
+        if (-1 == pid) {
+                memlimit_default_rss = rss_max;
+                memlimit_default_vsize = vsize_max;
+                memlimit_default_locked = locked_max;
+                return 0;
+        }
+        if (NULL == (ml = memlimit_lookup(pid)))
+                return -ESRCH;
+        ml->ml_rss_max = rss_max;
+        ml->ml_vsize_max = vsize_max;
+        ml->ml_locked_max = locked_max;
+        return 0;
+}
+
+/* Appends the memory usage of the process to a proc_info() dump. */
+void
+memlimit_info(const proc_t *p, char **buf, size_t *size)
+{
+        memlimit_t *ml = memlimit_lookup(p->p_pid);
+        if (NULL == ml)
+                return;
+
+        iprintf(buf, size, "rss:          %u pages (peak %u, limit %u)\n",
+                ml->ml_rss, ml->ml_rss_peak, ml->ml_rss_max);
+        iprintf(buf, size, "vsize:        %u pages (limit %u)\n",
+                (NULL != p->p_vmmap) ? memlimit_vsize(p->p_vmmap) : 0,
+                ml->ml_vsize_max);
+        iprintf(buf, size, "locked:       %u pages (limit %u)\n",
+                ml->ml_locked, ml->ml_locked_max);
+        iprintf(buf, size, "reclaimed:    %u pages\n", ml->ml_reclaimed);
+}
+
+#ifdef __DRIVERS__
+
+/*
+ * memlimit                                  - show usage and limits of every process
+ * memlimit <pid> <rss> <vsize> [<locked>]   - set limits (in pages, 0 = none)
+ * memlimit default <rss> <vsize> [<locked>] - set the limits given to new processes
+ *
+ * The locked-memory limit is left as it is if not given.
+ */
+static int
+memlimit_kshell(kshell_t *ksh, int argc, char **argv)
+{
+        uint32_t pid, rss, vsize, locked = 0;
+        memlimit_t *ml;
+        proc_t *p;
+        int err;
+
+        if (1 == argc) {
+                kprintf(ksh, "%5s %8s %8s %8s %8s %8s %8s %8s\n",
+                        "PID", "RSS", "PEAK", "RSSMAX", "VSIZE", "VSIZEMAX",
+                        "LOCKED", "LOCKMAX");
+                list_iterate_begin(proc_list(), p, proc_t, p_list_link) {
+                        if (NULL == (ml = memlimit_lookup(p->p_pid)))
+                                continue;
+                        kprintf(ksh, "%5d %8u %8u %8u %8u %8u %8u %8u\n", p->p_pid,
+                                ml->ml_rss, ml->ml_rss_peak, ml->ml_rss_max,
+                                (NULL != p->p_vmmap) ? memlimit_vsize(p->p_vmmap) : 0,
+                                ml->ml_vsize_max, ml->ml_locked, ml->ml_locked_max);
+                } list_iterate_end();
+                return 0;
+        }
+
+        if ((4 != argc && 5 != argc) || parse_uint(argv[2], &rss)
+            || parse_uint(argv[3], &vsize) || (5 == argc && parse_uint(argv[4], &locked))) {
+                kprintf(ksh, "usage: memlimit [<pid>|default <rss pages> <vsize pages> "
+                        "[<locked pages>]]\n");
+                return 0;
+        }
+        if (0 == strcmp(argv[1], "default")) {
+                pid = (uint32_t) -1;
+        } else if (parse_uint(argv[1], &pid)) {
+                kprintf(ksh, "memlimit: bad pid %s\n", argv[1]);
+                return 0;
+        }
+
+        if (4 == argc) {
+                if (-1 == (pid_t) pid)
+                        locked = memlimit_default_locked;
+                else if (NULL != (ml = memlimit_lookup((pid_t) pid)))
+                        locked = ml->ml_locked_max;
+        }
+        if ((err = memlimit_set((pid_t) pid, rss, vsize, locked)) < 0)
+                kprintf(ksh, "memlimit: %s\n", strerror(-err));
+        return 0;
+}
+
+static __attribute__((unused)) void
+memlimit_kshell_init(void)
+{
+        kshell_add_command("memlimit", memlimit_kshell,
+                           "show or set per-process memory limits");
+}
+init_func(memlimit_kshell_init);
+init_depends(kshell_init);
+
+#endif /* __DRIVERS__ */
@@ -0,0 +1,508 @@
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/list.h"
+#include "util/radix.h"
+#include "util/string.h"
+#include "util/parse.h"
+
+#include "proc/proc.h"
+
+#include "mm/mm.h"
+#include "mm/mman.h"
+#include "mm/page.h"
+#include "mm/mmobj.h"
+#include "mm/pframe.h"
+#include "mm/pagetable.h"
+#include "mm/tlbgather.h"
+
+#include "vm/vmmap.h"
+#include "vm/memlimit.h"
+#include "vm/hugepage.h"
+#include "vm/mlock.h"
+#include "vm/vmarea_ext.h"
+
+#include "test/kshell/kshell.h"
+#include "test/kshell/io.h"
+
+/* Locked pages looked up at a time */
+#define MLOCK_BATCH     16
+
+static uint32_t mlock_nlocked;          /* frames pinned by all processes */
+static uint32_t mlock_max;              /* limit on mlock_nlocked */
+static uint32_t mlock_nrefused;         /* faults that found no room to lock */
+
+static __attribute__((unused)) void
+mlock_init(void)
+{
+        mlock_max = page_free_count() / 4;
+}
+init_func(mlock_init);
+
+/*
+ * The lock state of vma (see vm/vmarea_ext.h), with pins to come charged
+ * to pid if the area has none yet.
+ */
+static vmarea_ext_t *
+mk_get(const vmarea_t *vma, pid_t pid)
+{
+        vmarea_ext_t *mk = vmarea_ext(vma);
+
+        if (0 == mk->vx_nlocked)
+                mk->vx_lock_pid = pid;
+        return mk;
+}
+
+/*
+ * Take the charge for npages more locked frames. Returns 0, -EAGAIN if
+ * the system-wide limit is reached or -ENOMEM if the process's is.
+ */
+static int
+mlock_charge(pid_t pid, uint32_t npages)
+{
+        int err;
+
+        if (mlock_nlocked + npages > mlock_max)
+                return -EAGAIN;
+        if (0 > (err = memlimit_locked_charge(pid, npages)))
+                return err;
+        mlock_nlocked += npages;
+        return 0;
+}
+
+static void
+mlock_uncharge(pid_t pid, uint32_t npages)
+{
+        KASSERT(mlock_nlocked >= npages);
+        mlock_nlocked -= npages;
+        memlimit_locked_uncharge(pid, npages);
+}
+
+/*
+ * Make pf the locked frame of page pn of the area, in place of the one
+ * locked there before, if any; the charge for the old frame covers the
+ * new one. Otherwise the page is charged, unless the caller has taken
+ * the charge already. Returns 1 if the page was not locked before, 0 if
+ * it was, or -errno.
+ */
+static int
+mk_pin(vmarea_ext_t *mk, uint32_t pn, pframe_t *pf, int charged)
+{
+        pframe_t *old = radix_lookup(&mk->vx_locked, pn);
+        int err;
+
+        if (old == pf)
+                return 0;
+        if (NULL != old) {
+                radix_delete(&mk->vx_locked, pn);
+                pframe_unpin(old);
+                if (0 > (err = radix_insert(&mk->vx_locked, pn, pf))) {
+                        mk->vx_nlocked--;
+                        mlock_uncharge(mk->vx_lock_pid, 1);
+                        return err;
+                }
+                pframe_pin(pf);
+                return 0;
+        }
+
+        if (!charged && 0 > (err = mlock_charge(mk->vx_lock_pid, 1)))
+                return err;
+        if (0 > (err = radix_insert(&mk->vx_locked, pn, pf))) {
+                if (!charged)
+                        mlock_uncharge(mk->vx_lock_pid, 1);
+                return err;
+        }
+        pframe_pin(pf);
+        mk->vx_nlocked++;
+        return 1;
+}
+
+/* Number of pages in [first, last] of the area that are locked. */
+static uint32_t
+mk_count(vmarea_ext_t *mk, uint32_t first, uint32_t last)
+{
+        void *pfs[MLOCK_BATCH];
+        uint32_t idx[MLOCK_BATCH], n, count = 0;
+
+        while (0 != (n = radix_gang_lookup_index(&mk->vx_locked, first, last,
+                                                 pfs, idx, MLOCK_BATCH))) {
+                count += n;
+                if (idx[n - 1] == last)
+                        break;
+                first = idx[n - 1] + 1;
+        }
+        return count;
+}
+
+/*
+ * Returns nonzero if any page of [vfn, end) of vma is locked, or if the
+ * whole area is, so that pages faulted in later would be.
+ */
+int
+mlock_is_locked(vmarea_t *vma, uint32_t vfn, uint32_t end)
+{
+        vmarea_ext_t *mk = vmarea_ext(vma);
+        uint32_t first = vfn - vma->vma_start + vma->vma_off;
+
+        return mk->vx_lock_all || 0 != mk_count(mk, first, first + (end - vfn) - 1);
+}
+
+/* Unlock the pages [first, last] of the area. */
+static void
+mk_unpin_range(vmarea_ext_t *mk, uint32_t first, uint32_t last)
+{
+        pframe_t *pfs[MLOCK_BATCH];
+        uint32_t idx[MLOCK_BATCH], n, i;
+
+        /* every page found is deleted, so each lookup starts over */
+        while (0 != (n = radix_gang_lookup_index(&mk->vx_locked, first, last,
+                                                 (void **) pfs, idx, MLOCK_BATCH))) {
+                for (i = 0; i < n; ++i) {
+                        radix_delete(&mk->vx_locked, idx[i]);
+                        pframe_unpin(pfs[i]);
+                }
+                mk->vx_nlocked -= n;
+                mlock_uncharge(mk->vx_lock_pid, n);
+        }
+}
+
+/*
+ * Fault in, map and lock the pages [vfn, end) of vma, as
+ * handle_pagefault() would fault them in for a write if the area is
+ * writable and for a read otherwise. The charge for all of the pages is
+ * taken up front. Returns 0 or -errno; pages locked before an error stay
+ * locked.
+ */
+static int
+mlock_range(vmarea_t *vma, uint32_t vfn, uint32_t end, tlb_gather_t *tg)
+{
+        int forwrite = (vma->vma_prot & PROT_WRITE) ? 1 : 0;
+        pagedir_t *pd = curproc->p_pagedir;
+        uint32_t ptflags = PT_PRESENT | PT_USER;
+        uint32_t pdflags = PD_PRESENT | PD_USER;
+        uint32_t pn = vfn - vma->vma_start + vma->vma_off;
+        uint32_t need;
+        uintptr_t vaddr;
+        vmarea_ext_t *mk;
+        pframe_t *pf;
+        int mapped, ret, err = 0;
+
+        /* memory that cannot be read is never faulted in */
+        if (!(vma->vma_prot & PROT_READ) || vfn >= end)
+                return 0;
+        if (forwrite) {
+                ptflags |= PT_WRITE;
+                pdflags |= PD_WRITE;
+        }
+        mk = mk_get(vma, curproc->p_pid);
+
+        need = (end - vfn) - mk_count(mk, pn, pn + (end - vfn) - 1);
+        if (0 > (err = mlock_charge(mk->vx_lock_pid, need)))
+                return err;
+
+        for (; vfn < end; ++vfn, ++pn) {
+                vaddr = (uintptr_t) PN_TO_ADDR(vfn);
+
+                if (memlimit_rss_exceeded(curproc->p_pid)) {
+                        err = -ENOMEM;
+                        break;
+                }
+                if (0 > (err = pframe_lookup(vma->vma_obj, pn, forwrite, &pf)))
+                        break;
+                if (forwrite && 0 > (err = pframe_dirty(pf)))
+                        break;
+
+                /* a large page maps the frame already; a small one may be
+                 * a read-only copy-on-write mapping of another frame */
+                mapped = hugepage_is_mapped(pd, vaddr);
+                if (HUGEPAGE_MAPPED_LARGE != mapped) {
+                        pt_map(pd, vaddr, pt_virt_to_phys((uintptr_t) pf->pf_addr),
+                               pdflags, ptflags);
+                        if (mapped)
+                                tlb_gather_page(tg, pd, vaddr);
+                }
+
+                if (0 > (ret = mk_pin(mk, pn, pf, 1))) {
+                        err = ret;
+                        break;
+                }
+                need -= ret;
+        }
+
+        mlock_uncharge(mk->vx_lock_pid, need);
+        return err;
+}
+
+/*
+ * Check the range of an mlock() or munlock() call and find its pages.
+ * Returns 0, -EINVAL if the range is bad or -ENOMEM if part of it is not
+ * mapped.
+ */
+static int
+mlock_check(void *addr, size_t len, uint32_t *lopage, uint32_t *hipage)
+{
+        uint32_t covered = 0;
+        vmarea_t *vma;
+
+        if (!PAGE_ALIGNED(addr) || (uint32_t) addr < USER_MEM_LOW
+            || USER_MEM_HIGH - (uint32_t) addr < len)
+                return -EINVAL;
+
+        *lopage = ADDR_TO_PN(addr);
+        *hipage = ADDR_TO_PN(PAGE_ALIGN_UP((uint32_t) addr + len));
+
+        list_iterate_begin(&curproc->p_vmmap->vmm_list, vma, vmarea_t, vma_plink) {
+                if (vma->vma_end <= *lopage || vma->vma_start >= *hipage)
+                        continue;
+                covered += MIN(*hipage, vma->vma_end) - MAX(*lopage, vma->vma_start);
+        } list_iterate_end();
+
+        return (covered < *hipage - *lopage) ? -ENOMEM : 0;
+}
+
+/*
+ * This function implements the mlock(2) syscall (see vm/mlock.h).
+ * Returns 0, -EINVAL for a bad range, -ENOMEM if part of it is not mapped
+ * or the process's locked-memory limit would be exceeded, or -EAGAIN if
+ * the system-wide one would.
+ */
+int
+do_mlock(void *addr, size_t len)
+{
+        uint32_t lopage, hipage, vfn, end;
+        vmarea_t *vma;
+        tlb_gather_t tg;
+        int err;
+
+        if (0 > (err = mlock_check(addr, len, &lopage, &hipage)))
+                return err;
+
+        tlb_gather_init(&tg);
+        list_iterate_begin(&curproc->p_vmmap->vmm_list, vma, vmarea_t, vma_plink) {
+                if (0 != err || vma->vma_end <= lopage || vma->vma_start >= hipage)
+                        continue;
+                vfn = MAX(lopage, vma->vma_start);
+                end = MIN(hipage, vma->vma_end);
+
+                /* locking all of an area locks what it grows by too */
+                if (vfn == vma->vma_start && end == vma->vma_end)
+                        mk_get(vma, curproc->p_pid)->vx_lock_all = 1;
+                err = mlock_range(vma, vfn, end, &tg);
+        } list_iterate_end();
+        tlb_gather_finish(&tg);
+        return err;
+}
+
+/*
+ * This function implements the munlock(2) syscall. Returns 0, -EINVAL
+ * for a bad range or -ENOMEM if part of it is not mapped.
+ */
+int
+do_munlock(void *addr, size_t len)
+{
+        uint32_t lopage, hipage, vfn, end, pn;
+        vmarea_ext_t *mk;
+        vmarea_t *vma;
+        int err;
+
+        if (0 > (err = mlock_check(addr, len, &lopage, &hipage)))
+                return err;
+
+        list_iterate_begin(&curproc->p_vmmap->vmm_list, vma, vmarea_t, vma_plink) {
+                if (vma->vma_end <= lopage || vma->vma_start >= hipage)
+                        continue;
+                mk = vmarea_ext(vma);
+                vfn = MAX(lopage, vma->vma_start);
+                end = MIN(hipage, vma->vma_end);
+                pn = vfn - vma->vma_start + vma->vma_off;
+
+                mk->vx_lock_all = 0;
+                mk_unpin_range(mk, pn, pn + (end - vfn) - 1);
+        } list_iterate_end();
+        return 0;
+}
+
+/*
+ * This function implements the mlockall(2) syscall. Returns 0, -EINVAL
+ * for bad flags, or the first error of locking an area; the other areas
+ * are locked all the same.
+ */
+int
+do_mlockall(int flags)
+{
+        vmarea_t *vma;
+        tlb_gather_t tg;
+        int err = 0, ret;
+
+        if (0 == flags || 0 != (flags & ~(MCL_CURRENT | MCL_FUTURE)))
+                return -EINVAL;
+
+        memlimit_set_lockall(curproc->p_pid, flags & MCL_FUTURE);
+        if (!(flags & MCL_CURRENT))
+                return 0;
+
+        tlb_gather_init(&tg);
+        list_iterate_begin(&curproc->p_vmmap->vmm_list, vma, vmarea_t, vma_plink) {
+                mk_get(vma, curproc->p_pid)->vx_lock_all = 1;
+                ret = mlock_range(vma, vma->vma_start, vma->vma_end, &tg);
+                if (0 == err)
+                        err = ret;
+        } list_iterate_end();
+        tlb_gather_finish(&tg);
+        return err;
+}
+
+/* This function implements the munlockall(2) syscall. */
+int
+do_munlockall(void)
+{
+        vmarea_t *vma;
+
+        memlimit_set_lockall(curproc->p_pid, 0);
+        list_iterate_begin(&curproc->p_vmmap->vmm_list, vma, vmarea_t, vma_plink) {
+                mlock_forget(vma);
+        } list_iterate_end();
+        return 0;
+}
+
+/*
+ * Called on an area the current process has just mapped or grown: if it
+ * did mlockall(MCL_FUTURE), lock all of the area. Returns 0 or -errno.
+ */
+int
+mlock_future(vmarea_t *vma)
+{
+        tlb_gather_t tg;
+        int err;
+
+        if (!(memlimit_lockall(curproc->p_pid) & MCL_FUTURE))
+                return 0;
+        mk_get(vma, curproc->p_pid)->vx_lock_all = 1;
+
+        tlb_gather_init(&tg);
+        err = mlock_range(vma, vma->vma_start, vma->vma_end, &tg);
+        tlb_gather_finish(&tg);
+        return err;
+}
+
+/*
+ * Called by handle_pagefault() once it has mapped pf at page pagenum of
+ * vma's object. If the page is locked, pf is locked in place of the frame
+ * it had before; if the whole area is, pf is locked, room permitting.
+ */
+void
+mlock_fault(vmarea_t *vma, uint32_t pagenum, pframe_t *pf)
+{
+        vmarea_ext_t *mk = vmarea_ext(vma);
+
+        if (!mk->vx_lock_all && NULL == radix_lookup(&mk->vx_locked, pagenum))
+                return;
+        if (0 > mk_pin(mk, pagenum, pf, 0))
+                mlock_nrefused++;
+}
+
+/*
+ * Unlock the pages [lopage, lopage + npages) of the address space, which
+ * vmmap_remove() is about to unmap.
+ */
+void
+mlock_unmap(vmmap_t *map, uint32_t lopage, uint32_t npages)
+{
+        uint32_t hipage = lopage + npages, vfn, end, pn;
+        vmarea_ext_t *mk;
+        vmarea_t *vma;
+
+        list_iterate_begin(&map->vmm_list, vma, vmarea_t, vma_plink) {
+                if (vma->vma_end <= lopage || vma->vma_start >= hipage)
+                        continue;
+                mk = vmarea_ext(vma);
+                vfn = MAX(lopage, vma->vma_start);
+                end = MIN(hipage, vma->vma_end);
+                pn = vfn - vma->vma_start + vma->vma_off;
+                mk_unpin_range(mk, pn, pn + (end - vfn) - 1);
+        } list_iterate_end();
+}
+
+/*
+ * newvma has been split off vma and maps part of the same object pages:
+ * hand it the locks of those pages. A page whose lock cannot be moved
+ * for want of memory is unlocked.
+ */
+void
+mlock_split(vmarea_t *vma, vmarea_t *newvma)
+{
+        uint32_t first = newvma->vma_off;
+        uint32_t last = newvma->vma_off + (newvma->vma_end - newvma->vma_start) - 1;
+        pframe_t *pfs[MLOCK_BATCH];
+        uint32_t idx[MLOCK_BATCH], n, i;
+        vmarea_ext_t *mk = vmarea_ext(vma), *nk;
+
+        if (0 == mk->vx_nlocked && !mk->vx_lock_all)
+                return;
+        nk = mk_get(newvma, mk->vx_lock_pid);
+        nk->vx_lock_all = mk->vx_lock_all;
+
+        while (0 != (n = radix_gang_lookup_index(&mk->vx_locked, first, last,
+                                                 (void **) pfs, idx, MLOCK_BATCH))) {
+                for (i = 0; i < n; ++i) {
+                        radix_delete(&mk->vx_locked, idx[i]);
+                        mk->vx_nlocked--;
+                        if (0 > radix_insert(&nk->vx_locked, idx[i], pfs[i])) {
+                                pframe_unpin(pfs[i]);
+                                mlock_uncharge(mk->vx_lock_pid, 1);
+                        } else {
+                                nk->vx_nlocked++;
+                        }
+                }
+        }
+}
+
+/* Unlock every page of vma, including those faulted in later. */
+void
+mlock_forget(vmarea_t *vma)
+{
+        vmarea_ext_t *mk = vmarea_ext(vma);
+
+        mk->vx_lock_all = 0;
+        mk_unpin_range(mk, 0, (uint32_t) -1);
+}
+
+#ifdef __DRIVERS__
+
+/*
+ * mlock              - show statistics
+ * mlock max <pages>  - set the number of frames all processes may lock
+ */
+static int
+mlock_kshell(kshell_t *ksh, int argc, char **argv)
+{
+        uint32_t max;
+
+        if (3 == argc && 0 == strcmp(argv[1], "max")) {
+                if (parse_uint(argv[2], &max))
+                        kprintf(ksh, "mlock: bad number %s\n", argv[2]);
+                else
+                        mlock_max = max;
+                return 0;
+        } else if (1 != argc) {
+                kprintf(ksh, "usage: mlock [max <pages>]\n");
+                return 0;
+        }
+
+        kprintf(ksh, "locked:   %u pages (limit %u)\n", mlock_nlocked, mlock_max);
+        kprintf(ksh, "refused:  %u faults\n", mlock_nrefused);
+        return 0;
+}
+
+static __attribute__((unused)) void
+mlock_kshell_init(void)
+{
+        kshell_add_command("mlock", mlock_kshell, "show or limit memory locked by mlock(2)");
+}
+init_func(mlock_kshell_init);
+init_depends(kshell_init);
+
+#endif /* __DRIVERS__ */
@@ -4,6 +4,7 @@
 
 #include "mm/mm.h"
 #include "mm/tlb.h"
+#include "mm/tlbgather.h"
 #include "mm/mman.h"
 #include "mm/page.h"
 
@@ -18,6 +19,11 @@
 
 #include "vm/vmmap.h"
 #include "vm/mmap.h"
+#include "vm/hugepage.h"
+#include "vm/populate.h"
+#include "vm/mlock.h"
+
+#include "api/syscall_ext.h"
 
 /*
  * This function implements the mmap(2) syscall, but only
@@ -89,6 +95,15 @@ do_mmap(void *addr, size_t len, int prot, int flags,
                 dbg(DBG_PRINT, "(GRADING3A)\n");
         }
 
+        /* MAP_HUGE: place an anonymous mapping on a 4 MB boundary so that
+         * it can be backed by large pages. File pages are cached one
+         * frame at a time, so file mappings just get the usual placement. */
+        if ((flags & MAP_HUGE) && (flags & MAP_ANON) && 0 == lopage) {
+                int vfn = hugepage_align_range(curproc->p_vmmap, (len - 1) / PAGE_SIZE + 1);
+                if (vfn >= 0)
+                        lopage = vfn;
+        }
+
         if((retval = vmmap_map(curproc->p_vmmap, node, lopage, (len - 1) / PAGE_SIZE + 1,
                                prot, flags, off, VMMAP_DIR_HILO, &mmap)) < 0){
                 dbg(DBG_PRINT, "(GRADING3D 2)\n");
@@ -99,7 +114,26 @@ do_mmap(void *addr, size_t len, int prot, int flags,
         dbg(DBG_PRINT, "(GRADING3A)\n");
 
         *ret = PN_TO_ADDR(mmap->vma_start);
-        tlb_flush_all();
+
+        /* Only a MAP_FIXED mapping can have replaced anything, and only
+         * inside its own range */
+        tlb_gather_t tg;
+        tlb_gather_init(&tg);
+        tlb_gather_range(&tg, curproc->p_pagedir, (uintptr_t) PN_TO_ADDR(mmap->vma_start),
+                         (uintptr_t) PN_TO_ADDR(mmap->vma_end));
+        tlb_gather_finish(&tg);
+
+        /* MAP_POPULATE: take the faults now. Running out of memory here
+         * does not fail the mmap, the rest is faulted in later. */
+        if (flags & MAP_POPULATE)
+                populate_range(mmap->vma_start, mmap->vma_end - mmap->vma_start);
+
+        /* after mlockall(MCL_FUTURE), a mapping that cannot be locked is
+         * not made */
+        if ((retval = mlock_future(mmap)) < 0) {
+                do_munmap(*ret, len);
+                return retval;
+        }
         dbg(DBG_PRINT, "(GRADING3A)\n");
         return retval;
 }
@@ -141,7 +175,12 @@ do_munmap(void *addr, size_t len)
         }
 
         vmmap_remove(curproc->p_vmmap, ADDR_TO_PN(addr), npages);
-        tlb_flush_all();
+
+        tlb_gather_t tg;
+        tlb_gather_init(&tg);
+        tlb_gather_range(&tg, curproc->p_pagedir, (uintptr_t) addr,
+                         (uintptr_t) addr + npages * PAGE_SIZE);
+        tlb_gather_finish(&tg);
         dbg(DBG_PRINT, "(GRADING3D 1)\n");
 
         return 0;
@@ -0,0 +1,62 @@
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/debug.h"
+
+#include "proc/proc.h"
+
+#include "mm/mm.h"
+#include "mm/mman.h"
+#include "mm/page.h"
+#include "mm/mmobj.h"
+#include "mm/pframe_ext.h"
+#include "mm/fileobj.h"
+
+#include "vm/vmmap.h"
+#include "vm/msync.h"
+
+/*
+ * This function implements the msync(2) syscall (see vm/msync.h).
+ * Returns 0, -EINVAL for a bad range or bad flags, -ENOMEM if part of the
+ * range is not mapped (the rest is written back all the same), or the
+ * error of a page that failed to write.
+ */
+int
+do_msync(void *addr, size_t len, int flags)
+{
+        uint32_t vfn, hipage, end, pn;
+        mmobj_t *bottom;
+        vmarea_t *vma;
+        int err = 0, ret;
+
+        if (0 != (flags & ~(MS_ASYNC | MS_INVALIDATE | MS_SYNC))
+            || (MS_ASYNC | MS_SYNC) == (flags & (MS_ASYNC | MS_SYNC)))
+                return -EINVAL;
+        if (!PAGE_ALIGNED(addr) || (uint32_t) addr < USER_MEM_LOW
+            || USER_MEM_HIGH - (uint32_t) addr < len)
+                return -EINVAL;
+
+        vfn = ADDR_TO_PN(addr);
+        hipage = ADDR_TO_PN(PAGE_ALIGN_UP((uint32_t) addr + len));
+
+        while (vfn < hipage) {
+                if (NULL == (vma = vmmap_lookup(curproc->p_vmmap, vfn))) {
+                        err = -ENOMEM;
+                        vfn++;
+                        continue;
+                }
+                end = MIN(hipage, vma->vma_end);
+
+                bottom = mmobj_bottom_obj(vma->vma_obj);
+                if (MAP_SHARED == (vma->vma_flags & MAP_TYPE) && !anon_is_anon(bottom)) {
+                        pn = vfn - vma->vma_start + vma->vma_off;
+                        ret = pframe_sync_range(bottom, pn, pn + (end - vfn) - 1,
+                                                flags & MS_ASYNC);
+                        if (ret < 0 && 0 == err)
+                                err = ret;
+                }
+                vfn = end;
+        }
+        return err;
+}
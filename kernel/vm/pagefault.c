@@ -12,10 +12,22 @@
 #include "mm/page.h"
 #include "mm/mmobj.h"
 #include "mm/pframe.h"
+#include "mm/pframe_ext.h"
 #include "mm/pagetable.h"
+#include "mm/readahead.h"
+#include "mm/fileobj.h"
 
 #include "vm/pagefault.h"
 #include "vm/vmmap.h"
+#include "vm/memlimit.h"
+#include "vm/hugepage.h"
+#include "vm/zeropage.h"
+#include "vm/faultaround.h"
+#include "vm/madvise.h"
+#include "vm/mlock.h"
+
+/* Pages a process at its resident limit gives back per fault */
+#define PAGEFAULT_RECLAIM_BATCH 8
 
 /*
  * This gets called by _pt_fault_handler in mm/pagetable.c The
@@ -69,6 +81,31 @@ handle_pagefault(uintptr_t vaddr, uint32_t cause)
 //             do_exit(EFAULT);
 //     }
 
+    // A process at its resident limit reclaims its own pages before it
+    // may fault in another one; if it has nothing left to give back, the
+    // limit is hard and the process is killed. Pinned pages (locked ones,
+    // and anonymous memory with no swap) could never be given back, so
+    // they alone do not get a process killed.
+    if (memlimit_rss_exceeded(curproc->p_pid)) {
+            pframe_reclaim_owner(curproc->p_pid, PAGEFAULT_RECLAIM_BATCH);
+            if (memlimit_rss_exceeded(curproc->p_pid)
+                && memlimit_rss_unpinned_exceeded(curproc->p_pid,
+                                                  pframe_owner_pinned(curproc->p_pid))) {
+                    dbg(DBG_VMMAP, "pid %d: over resident limit, killing\n", curproc->p_pid);
+                    do_exit(ENOMEM);
+            }
+    }
+
+    // A fault in a 4 MB-aligned stretch of anonymous memory that the area
+    // covers entirely is served with one large page, memory permitting.
+    if (hugepage_fault(vma, vaddr))
+            return;
+
+    // Reading anonymous memory that was never written maps the shared
+    // zero page; a page is only allocated once it is written.
+    if (!(cause & FAULT_WRITE) && zeropage_fault(vma, vaddr))
+            return;
+
     pframe_t *pf;
     int forwrite = 0;
     uint32_t pdflags = PD_PRESENT | PD_USER;
@@ -83,6 +120,13 @@ handle_pagefault(uintptr_t vaddr, uint32_t cause)
     }
 
     uint32_t pn = vfn - vma->vma_start + vma->vma_off;
+    int advice = madvise_advice(vma);
+
+    // Whether read-ahead brought the file page in before it was wanted
+    // can only be told before the lookup below brings it in itself.
+    mmobj_t *bottom = mmobj_bottom_obj(vma->vma_obj);
+    int resident = (NULL != pframe_hash_find(bottom, pn));
+
     if(pframe_lookup(vma->vma_obj, pn, forwrite, &pf) < 0){
             dbg(DBG_PRINT, "(GRADING3D 2)\n");
             do_exit(EFAULT);
@@ -101,7 +145,36 @@ handle_pagefault(uintptr_t vaddr, uint32_t cause)
     KASSERT(pf->pf_addr);
     dbg(DBG_PRINT, "(GRADING3A 5.a)\n");
 
+    // A page mapped writable may be changed behind the kernel's back, so
+    // it counts as dirty from now on; with swap, this is what makes
+    // pageoutd write anonymous memory out before reusing its frame.
+    if (forwrite && pframe_dirty(pf) < 0) {
+            do_exit(EFAULT);
+    }
+
     // Finally call pt_map to have the new mapping placed into the appropriate page table.
     pt_map(curproc->p_pagedir, (uintptr_t)PAGE_ALIGN_DOWN(vaddr), pt_virt_to_phys((uintptr_t)pf->pf_addr), pdflags, ptflags);
+
+    // In locked memory, the page is pinned (in place of the one it
+    // replaces, after copy-on-write).
+    mlock_fault(vma, pn, pf);
+
+    // File mappings read ahead when they are faulted on sequentially, or
+    // always if madvise(2) said so, and never if it said access is random.
+    // The pages are read into the file itself (the bottom object), never
+    // into the shadow objects of a private mapping. The page that faulted
+    // comes first: the fills of the window are only started here, once
+    // it is mapped.
+    uint32_t limit = MIN(vma->vma_off + (vma->vma_end - vma->vma_start),
+                         mmobj_file_npages(bottom));
+    if (pn < limit && MADV_SEQUENTIAL == advice)
+            readahead_sequential(bottom, pn, limit);
+    else if (pn < limit && MADV_RANDOM != advice)
+            readahead_access(vma, bottom, pn, 1, limit, resident);
+
+    // Map the resident pages around it as well, so that reading them
+    // costs no fault of its own.
+    if (!forwrite && MADV_RANDOM != advice)
+            faultaround(vma, vaddr);
     dbg(DBG_PRINT, "(GRADING3A)\n");
 }
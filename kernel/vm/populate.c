@@ -0,0 +1,144 @@
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/debug.h"
+
+#include "proc/proc.h"
+
+#include "mm/mm.h"
+#include "mm/mman.h"
+#include "mm/page.h"
+#include "mm/mmobj.h"
+#include "mm/pframe.h"
+#include "mm/pframe_ext.h"
+#include "mm/pagetable.h"
+#include "mm/tlbgather.h"
+#include "mm/fileobj.h"
+
+#include "vm/vmmap.h"
+#include "vm/memlimit.h"
+#include "vm/hugepage.h"
+#include "vm/zeropage.h"
+#include "vm/populate.h"
+
+/* Pages whose fills are queued together before any of them is mapped */
+#define POPULATE_BATCH          64
+
+/*
+ * Queue fills for the file pages behind [vfn, end) of vma that are not
+ * resident yet, so that the disk has all of them to work on while the
+ * first one is waited for. Pages past the end of the file are left to
+ * the usual fill. Stops early if memory is short.
+ */
+static void
+populate_prefetch(vmarea_t *vma, uint32_t vfn, uint32_t end)
+{
+        mmobj_t *bottom = mmobj_bottom_obj(vma->vma_obj);
+        uint32_t pn = vfn - vma->vma_start + vma->vma_off;
+        uint32_t last = MIN(pn + (end - vfn), mmobj_file_npages(bottom));
+        pframe_t *pf;
+
+        for (; pn < last; ++pn) {
+                if (NULL != pframe_get_resident(bottom, pn))
+                        continue;
+                if (0 > pframe_get_async(bottom, pn, &pf))
+                        break;
+        }
+}
+
+/*
+ * Fault in and map the pages [vfn, end) of vma, as handle_pagefault()
+ * would for a write if the area is writable and private, and for a read
+ * otherwise. Returns the number of pages mapped, or -errno if it had to
+ * stop.
+ */
+static int
+populate_area(vmarea_t *vma, uint32_t vfn, uint32_t end, tlb_gather_t *tg)
+{
+        int forwrite = (vma->vma_prot & PROT_WRITE)
+                       && MAP_PRIVATE == (vma->vma_flags & MAP_TYPE);
+        pagedir_t *pd = curproc->p_pagedir;
+        uint32_t ptflags = PT_PRESENT | PT_USER;
+        uint32_t pdflags = PD_PRESENT | PD_USER;
+        uintptr_t vaddr;
+        pframe_t *pf;
+        int mapped, n = 0, err;
+
+        if (!(vma->vma_prot & PROT_READ))
+                return 0;
+        if (forwrite) {
+                ptflags |= PT_WRITE;
+                pdflags |= PD_WRITE;
+        }
+
+        for (; vfn < end; ++vfn) {
+                vaddr = (uintptr_t) PN_TO_ADDR(vfn);
+
+                if (memlimit_rss_exceeded(curproc->p_pid))
+                        return -ENOMEM;
+
+                /* a large page is always writable if the area is; a small
+                 * one may be a read-only copy-on-write mapping */
+                mapped = hugepage_is_mapped(pd, vaddr);
+                if (HUGEPAGE_MAPPED_LARGE == mapped || (mapped && !forwrite))
+                        continue;
+
+                if (!mapped && hugepage_fault(vma, vaddr)) {
+                        n++;
+                        continue;
+                }
+                if (!forwrite && zeropage_fault(vma, vaddr)) {
+                        n++;
+                        continue;
+                }
+
+                if (0 > (err = pframe_lookup(vma->vma_obj, vfn - vma->vma_start + vma->vma_off,
+                                             forwrite, &pf)))
+                        return err;
+                if (forwrite && 0 > (err = pframe_dirty(pf)))
+                        return err;
+
+                pt_map(pd, vaddr, pt_virt_to_phys((uintptr_t) pf->pf_addr), pdflags, ptflags);
+                /* the page may have replaced a read-only mapping */
+                if (mapped)
+                        tlb_gather_page(tg, pd, vaddr);
+                n++;
+        }
+        return n;
+}
+
+/*
+ * Populate the pages [lopage, lopage + npages) of the current process
+ * (see vm/populate.h). Pages that no vmarea covers are skipped. Returns
+ * the number of pages mapped, or -errno if population stopped early.
+ */
+int
+populate_range(uint32_t lopage, uint32_t npages)
+{
+        uint32_t vfn = lopage, end = lopage + npages, stop;
+        vmarea_t *vma;
+        tlb_gather_t tg;
+        int ret, n = 0;
+
+        tlb_gather_init(&tg);
+        while (vfn < end) {
+                if (NULL == (vma = vmmap_lookup(curproc->p_vmmap, vfn))) {
+                        vfn++;
+                        continue;
+                }
+                stop = MIN(MIN(end, vma->vma_end), vfn + POPULATE_BATCH);
+
+                populate_prefetch(vma, vfn, stop);
+                if (0 > (ret = populate_area(vma, vfn, stop, &tg))) {
+                        dbg(DBG_VM, "pid %d: population stopped at page %u: %d\n",
+                            curproc->p_pid, vfn, ret);
+                        n = ret;
+                        break;
+                }
+                n += ret;
+                vfn = stop;
+        }
+        tlb_gather_finish(&tg);
+        return n;
+}
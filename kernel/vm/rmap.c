@@ -0,0 +1,351 @@
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/list.h"
+
+#include "mm/mm.h"
+#include "mm/mmobj.h"
+#include "mm/slab.h"
+
+#include "vm/vmmap.h"
+#include "vm/rmap.h"
+
+/*
+ * The interval trees are treaps: binary search trees on (first page,
+ * vmarea) that are also heaps on a random priority, which keeps them
+ * balanced in expectation without any rebalancing bookkeeping. Every node
+ * also records the largest end of any interval below it, so a search for
+ * the intervals containing a page can skip whole subtrees that end too
+ * early.
+ */
+typedef struct rmap_node {
+        vmarea_t                *rn_vma;
+        uint32_t                rn_start;       /* first object page mapped */
+        uint32_t                rn_end;         /* one past the last */
+        uint32_t                rn_maxend;      /* largest rn_end in this subtree */
+        uint32_t                rn_prio;
+        struct rmap_node        *rn_left;
+        struct rmap_node        *rn_right;
+        struct rmap_tree        *rn_tree;
+        list_link_t             rn_vlink;       /* on rmap_vmas, by vmarea */
+} rmap_node_t;
+
+typedef struct rmap_tree {
+        mmobj_t                 *rt_obj;        /* the bottom object */
+        rmap_node_t             *rt_root;
+        uint32_t                rt_count;
+        list_link_t             rt_hlink;       /* on rmap_trees, by object,
+                                                   or on rmap_spare */
+} rmap_tree_t;
+
+/*
+ * Nothing is allocated once an area exists: rmap_prepare() allocates
+ * the node of a new area together with a tree, which is kept on
+ * rmap_spare until some object needs it. There are never more trees in
+ * use than areas in them, so rmap_enter() always finds a spare tree when
+ * it needs one.
+ */
+
+#define RMAP_OBJ_HASH_SIZE      64
+#define RMAP_VMA_HASH_SIZE      256
+#define rmap_obj_hash(o)        (((uintptr_t)(o) >> 5) % RMAP_OBJ_HASH_SIZE)
+#define rmap_vma_hash(vma)      (((uintptr_t)(vma) >> 5) % RMAP_VMA_HASH_SIZE)
+
+static list_t rmap_trees[RMAP_OBJ_HASH_SIZE];
+static list_t rmap_vmas[RMAP_VMA_HASH_SIZE];
+static list_t rmap_spare;
+static slab_allocator_t *rmap_node_allocator = NULL;
+static slab_allocator_t *rmap_tree_allocator = NULL;
+static uint32_t rmap_seed = 1;
+
+static __attribute__((unused)) void
+rmap_init(void)
+{
+        uint32_t i;
+
+        for (i = 0; i < RMAP_OBJ_HASH_SIZE; ++i)
+                list_init(&rmap_trees[i]);
+        for (i = 0; i < RMAP_VMA_HASH_SIZE; ++i)
+                list_init(&rmap_vmas[i]);
+        list_init(&rmap_spare);
+        rmap_node_allocator = slab_allocator_create("rmap_node", sizeof(rmap_node_t));
+        KASSERT(NULL != rmap_node_allocator);
+        rmap_tree_allocator = slab_allocator_create("rmap_tree", sizeof(rmap_tree_t));
+        KASSERT(NULL != rmap_tree_allocator);
+}
+init_func(rmap_init);
+
+static uint32_t
+rmap_random(void)
+{
+        rmap_seed = rmap_seed * 1103515245 + 12345;
+        return rmap_seed >> 1;
+}
+
+/* Order of the search tree: by first page, ties broken by vmarea */
+static int
+rmap_before(rmap_node_t *a, rmap_node_t *b)
+{
+        if (a->rn_start != b->rn_start)
+                return a->rn_start < b->rn_start;
+        return (uintptr_t) a->rn_vma < (uintptr_t) b->rn_vma;
+}
+
+static void
+rmap_fix(rmap_node_t *n)
+{
+        n->rn_maxend = n->rn_end;
+        if (NULL != n->rn_left && n->rn_left->rn_maxend > n->rn_maxend)
+                n->rn_maxend = n->rn_left->rn_maxend;
+        if (NULL != n->rn_right && n->rn_right->rn_maxend > n->rn_maxend)
+                n->rn_maxend = n->rn_right->rn_maxend;
+}
+
+static rmap_node_t *
+rmap_rotate_right(rmap_node_t *n)
+{
+        rmap_node_t *l = n->rn_left;
+        n->rn_left = l->rn_right;
+        l->rn_right = n;
+        rmap_fix(n);
+        rmap_fix(l);
+        return l;
+}
+
+static rmap_node_t *
+rmap_rotate_left(rmap_node_t *n)
+{
+        rmap_node_t *r = n->rn_right;
+        n->rn_right = r->rn_left;
+        r->rn_left = n;
+        rmap_fix(n);
+        rmap_fix(r);
+        return r;
+}
+
+static rmap_node_t *
+rmap_insert(rmap_node_t *root, rmap_node_t *n)
+{
+        if (NULL == root)
+                return n;
+        if (rmap_before(n, root)) {
+                root->rn_left = rmap_insert(root->rn_left, n);
+                if (root->rn_left->rn_prio > root->rn_prio)
+                        return rmap_rotate_right(root);
+        } else {
+                root->rn_right = rmap_insert(root->rn_right, n);
+                if (root->rn_right->rn_prio > root->rn_prio)
+                        return rmap_rotate_left(root);
+        }
+        rmap_fix(root);
+        return root;
+}
+
+/* Rotate n down until it is a leaf, then drop it */
+static rmap_node_t *
+rmap_delete(rmap_node_t *root, rmap_node_t *n)
+{
+        KASSERT(NULL != root && "node not in its tree");
+        if (root == n) {
+                if (NULL == n->rn_left)
+                        return n->rn_right;
+                if (NULL == n->rn_right)
+                        return n->rn_left;
+                if (n->rn_left->rn_prio > n->rn_right->rn_prio) {
+                        root = rmap_rotate_right(n);
+                        root->rn_right = rmap_delete(n, n);
+                } else {
+                        root = rmap_rotate_left(n);
+                        root->rn_left = rmap_delete(n, n);
+                }
+        } else if (rmap_before(n, root)) {
+                root->rn_left = rmap_delete(root->rn_left, n);
+        } else {
+                root->rn_right = rmap_delete(root->rn_right, n);
+        }
+        rmap_fix(root);
+        return root;
+}
+
+static rmap_tree_t *
+rmap_tree_lookup(mmobj_t *bottom)
+{
+        rmap_tree_t *tree;
+        list_iterate_begin(&rmap_trees[rmap_obj_hash(bottom)], tree, rmap_tree_t, rt_hlink) {
+                if (tree->rt_obj == bottom)
+                        return tree;
+        } list_iterate_end();
+        return NULL;
+}
+
+static rmap_node_t *
+rmap_node_lookup(vmarea_t *vma)
+{
+        rmap_node_t *n;
+        list_iterate_begin(&rmap_vmas[rmap_vma_hash(vma)], n, rmap_node_t, rn_vlink) {
+                if (n->rn_vma == vma)
+                        return n;
+        } list_iterate_end();
+        return NULL;
+}
+
+/* Put n, which is in no tree, into the tree of vma's bottom object under
+ * the area's current range */
+static void
+rmap_enter(rmap_node_t *n)
+{
+        vmarea_t *vma = n->rn_vma;
+        mmobj_t *bottom = mmobj_bottom_obj(vma->vma_obj);
+        rmap_tree_t *tree;
+
+        if (NULL == (tree = rmap_tree_lookup(bottom))) {
+                KASSERT(!list_empty(&rmap_spare));
+                tree = list_head(&rmap_spare, rmap_tree_t, rt_hlink);
+                list_remove(&tree->rt_hlink);
+                tree->rt_obj = bottom;
+                tree->rt_root = NULL;
+                tree->rt_count = 0;
+                list_insert_head(&rmap_trees[rmap_obj_hash(bottom)], &tree->rt_hlink);
+        }
+
+        n->rn_start = vma->vma_off;
+        n->rn_end = vma->vma_off + (vma->vma_end - vma->vma_start);
+        n->rn_maxend = n->rn_end;
+        n->rn_prio = rmap_random();
+        n->rn_left = n->rn_right = NULL;
+        n->rn_tree = tree;
+
+        tree->rt_root = rmap_insert(tree->rt_root, n);
+        tree->rt_count++;
+}
+
+static void
+rmap_leave(rmap_node_t *n)
+{
+        rmap_tree_t *tree = n->rn_tree;
+
+        tree->rt_root = rmap_delete(tree->rt_root, n);
+        n->rn_tree = NULL;
+        if (0 == --tree->rt_count) {
+                KASSERT(NULL == tree->rt_root);
+                list_remove(&tree->rt_hlink);
+                list_insert_head(&rmap_spare, &tree->rt_hlink);
+        }
+}
+
+/*
+ * Called by vmarea_alloc() on a new area: allocate what indexing it will
+ * take. Returns 0 or -ENOMEM.
+ */
+int
+rmap_prepare(vmarea_t *vma)
+{
+        rmap_tree_t *tree;
+        rmap_node_t *n;
+
+        if (NULL == (n = slab_obj_alloc(rmap_node_allocator)))
+                return -ENOMEM;
+        if (NULL == (tree = slab_obj_alloc(rmap_tree_allocator))) {
+                slab_obj_free(rmap_node_allocator, n);
+                return -ENOMEM;
+        }
+        n->rn_vma = vma;
+        n->rn_tree = NULL;
+        list_insert_head(&rmap_vmas[rmap_vma_hash(vma)], &n->rn_vlink);
+        list_insert_head(&rmap_spare, &tree->rt_hlink);
+        return 0;
+}
+
+/* Called by vmarea_free(): take vma out of the index and free its node. */
+void
+rmap_release(vmarea_t *vma)
+{
+        rmap_node_t *n = rmap_node_lookup(vma);
+        rmap_tree_t *tree;
+
+        KASSERT(NULL != n && "area was not prepared for the reverse map");
+        if (NULL != n->rn_tree)
+                rmap_leave(n);
+        list_remove(&n->rn_vlink);
+        slab_obj_free(rmap_node_allocator, n);
+
+        KASSERT(!list_empty(&rmap_spare));
+        tree = list_head(&rmap_spare, rmap_tree_t, rt_hlink);
+        list_remove(&tree->rt_hlink);
+        slab_obj_free(rmap_tree_allocator, tree);
+}
+
+/*
+ * Index vma under its bottom object. If it is already indexed, its entry
+ * is moved to the area's current object and range.
+ */
+void
+rmap_add(vmarea_t *vma)
+{
+        rmap_node_t *n = rmap_node_lookup(vma);
+
+        KASSERT(NULL != n && "area was not prepared for the reverse map");
+        if (NULL != n->rn_tree)
+                rmap_leave(n);
+        rmap_enter(n);
+}
+
+/*
+ * Called after the range of vma (vma_start, vma_end or vma_off) changed.
+ * Areas that are not indexed are left alone.
+ */
+void
+rmap_update(vmarea_t *vma)
+{
+        rmap_node_t *n;
+
+        if (NULL != (n = rmap_node_lookup(vma)) && NULL != n->rn_tree) {
+                rmap_leave(n);
+                rmap_enter(n);
+        }
+}
+
+void
+rmap_remove(vmarea_t *vma)
+{
+        rmap_node_t *n;
+
+        if (NULL != (n = rmap_node_lookup(vma)) && NULL != n->rn_tree)
+                rmap_leave(n);
+}
+
+static uint32_t
+rmap_stab(rmap_node_t *n, uint32_t pagenum, rmap_func_t func, void *arg)
+{
+        uint32_t count = 0;
+
+        while (NULL != n && n->rn_maxend > pagenum) {
+                count += rmap_stab(n->rn_left, pagenum, func, arg);
+                /* everything from here on starts after pagenum */
+                if (n->rn_start > pagenum)
+                        break;
+                if (pagenum < n->rn_end) {
+                        func(n->rn_vma, pagenum, arg);
+                        count++;
+                }
+                n = n->rn_right;
+        }
+        return count;
+}
+
+/*
+ * Call func on every vmarea that maps page pagenum of o's bottom object.
+ * func must not add or remove areas. Returns the number of calls.
+ */
+uint32_t
+rmap_foreach(mmobj_t *o, uint32_t pagenum, rmap_func_t func, void *arg)
+{
+        rmap_tree_t *tree;
+
+        if (NULL == (tree = rmap_tree_lookup(mmobj_bottom_obj(o))))
+                return 0;
+        return rmap_stab(tree->rt_root, pagenum, func, arg);
+}
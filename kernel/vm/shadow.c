@@ -6,6 +6,7 @@
 
 #include "mm/mmobj.h"
 #include "mm/pframe.h"
+#include "mm/pframe_ext.h"
 #include "mm/mm.h"
 #include "mm/page.h"
 #include "mm/slab.h"
@@ -14,6 +15,7 @@
 #include "vm/vmmap.h"
 #include "vm/shadow.h"
 #include "vm/shadowd.h"
+#include "vm/swap.h"
 
 #define SHADOW_SINGLETON_THRESHOLD 5
 
@@ -114,10 +116,14 @@ shadow_put(mmobj_t *o)
     {
             list_iterate_begin(&o->mmo_respages, pf, pframe_t, pf_olink)
             {
-                    pframe_unpin(pf);
+                    pframe_unadopt(pf);
+                    /* with swap, pages are only pinned while in use */
+                    if (pframe_is_pinned(pf))
+                            pframe_unpin(pf);
                     pframe_free(pf);
                     dbg(DBG_PRINT, "(GRADING3A)\n");
             } list_iterate_end();
+            swap_release_obj(o);
 
             o->mmo_shadowed->mmo_ops->put(o->mmo_shadowed);
             slab_obj_free(shadow_allocator, o);
@@ -147,20 +153,27 @@ shadow_lookuppage(mmobj_t *o, uint32_t pagenum, int forwrite, pframe_t **pf)
             return pframe_get(o, pagenum, pf);
     }
 
-    while (curr_obj->mmo_shadowed != NULL && curr_pf == NULL)
+    /* a page that was swapped out is still the object's page */
+    while (curr_obj->mmo_shadowed != NULL)
     {
-            curr_pf = pframe_get_resident(curr_obj, pagenum);
+            if (NULL != (curr_pf = pframe_get_resident(curr_obj, pagenum))
+                || swap_has(curr_obj, pagenum))
+                    break;
             curr_obj = curr_obj->mmo_shadowed;
             dbg(DBG_PRINT, "(GRADING3A)\n");
     }
 
-    if (!curr_pf)
+    if (curr_obj->mmo_shadowed == NULL)
     {
             dbg(DBG_PRINT, "(GRADING3A)\n");
             return pframe_lookup(curr_obj, pagenum, forwrite, pf);
     }
 
-    *pf = curr_pf;
+    /* reads it back from swap, or waits for it if it is being swapped
+     * out right now */
+    int retval;
+    if ((retval = pframe_get(curr_obj, pagenum, pf)) < 0)
+            return retval;
 
     KASSERT(NULL != (*pf)); /* on return, (*pf) must be non-NULL */
     dbg(DBG_PRINT, "(GRADING3A 6.d)\n");
@@ -194,23 +207,43 @@ shadow_fillpage(mmobj_t *o, pframe_t *pf)
     pframe_t *curr_pf = NULL;
     mmobj_t *curr_obj = o->mmo_shadowed;
 
-    while (curr_pf == NULL && o->mmo_un.mmo_bottom_obj != curr_obj)
-    {
-            curr_pf = pframe_get_resident(curr_obj, pf->pf_pagenum);
-            curr_obj = curr_obj->mmo_shadowed;
-            dbg(DBG_PRINT, "(GRADING3A)\n");
-    }
+    /* this object's own copy, if it was swapped out */
+    if ((retval = swap_in(o, pf)) < 0)
+            return retval;
 
-    if (curr_pf == NULL)
+    if (retval == 0)
     {
-            if((retval = pframe_lookup(curr_obj, pf->pf_pagenum, 1, &curr_pf) < 0)){
-                    dbg(DBG_PRINT, "(GRADING3D 2)\n");
+            while (o->mmo_un.mmo_bottom_obj != curr_obj)
+            {
+                    if (NULL != pframe_get_resident(curr_obj, pf->pf_pagenum)
+                        || swap_has(curr_obj, pf->pf_pagenum))
+                            break;
+                    curr_obj = curr_obj->mmo_shadowed;
+                    dbg(DBG_PRINT, "(GRADING3A)\n");
+            }
+
+            if (o->mmo_un.mmo_bottom_obj == curr_obj)
+            {
+                    if((retval = pframe_lookup(curr_obj, pf->pf_pagenum, 1, &curr_pf)) < 0){
+                            dbg(DBG_PRINT, "(GRADING3D 2)\n");
+                            return retval;
+                    }
+                    dbg(DBG_PRINT, "(GRADING3A)\n");
+            }
+            else if ((retval = pframe_get(curr_obj, pf->pf_pagenum, &curr_pf)) < 0)
+            {
+                    /* pframe_get() waits for a page that is still being
+                     * swapped in; this one was swapped out further up
+                     * the chain and could not be read back */
                     return retval;
             }
-            dbg(DBG_PRINT, "(GRADING3A)\n");
+            memcpy(pf->pf_addr, curr_pf->pf_addr, PAGE_SIZE);
     }
-    pframe_pin(pf);
-    memcpy(pf->pf_addr, curr_pf->pf_addr, PAGE_SIZE);
+
+    /* without swap there is nowhere to write the page to, so it must
+     * stay resident */
+    if (!swap_enabled())
+            pframe_pin(pf);
     dbg(DBG_PRINT, "(GRADING3A)\n");
     return 0;
 }
@@ -220,6 +253,8 @@ shadow_fillpage(mmobj_t *o, pframe_t *pf)
 static int
 shadow_dirtypage(mmobj_t *o, pframe_t *pf)
 {
+    /* the copy in swap, if any, is about to become stale */
+    swap_discard(o, pf->pf_pagenum);
     pframe_set_dirty(pf);
     dbg(DBG_PRINT, "(GRADING3A)\n");
     return 0;
@@ -228,6 +263,5 @@ shadow_dirtypage(mmobj_t *o, pframe_t *pf)
 static int
 shadow_cleanpage(mmobj_t *o, pframe_t *pf)
 {
-        NOT_YET_IMPLEMENTED("VM: shadow_cleanpage");
-        return -1;
+        return swap_out(o, pf);
 }
@@ -0,0 +1,476 @@
+#include "kernel.h"
+#include "globals.h"
+#include "config.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/list.h"
+#include "util/string.h"
+#include "util/radix.h"
+
+#include "mm/mm.h"
+#include "mm/mmobj.h"
+#include "mm/pframe.h"
+#include "mm/pframe_ext.h"
+#include "mm/slab.h"
+
+#include "drivers/dev.h"
+#include "drivers/blockdev.h"
+
+#include "vm/swap.h"
+#include "vm/zram.h"
+#include "vm/ksm.h"
+
+#include "test/kshell/kshell.h"
+#include "test/kshell/io.h"
+
+/* Number of slots on the swap disk, which must be at least this big */
+#ifdef __SWAP_BLOCKS__
+#define SWAP_NSLOTS             __SWAP_BLOCKS__
+#else
+#define SWAP_NSLOTS             4096
+#endif
+
+#define SWAP_MAP_WORDS          ((SWAP_NSLOTS + 31) / 32)
+
+/*
+ * Where a swapped-out page is: a pointer to its compressed copy in zram,
+ * a disk slot stored as (slot << 2) | 1, or the frame it was merged into
+ * by ksmd, stored as a pointer to its ksm_page_t with bit 1 set. Both
+ * kinds of record are aligned slab objects, so the low two bits tell the
+ * three apart, and slot 0 is not a NULL item.
+ */
+#define swap_item_disk(slot)    ((void *)(((uintptr_t)(slot) << 2) | 1))
+#define swap_item_is_disk(item) ((uintptr_t)(item) & 1)
+#define swap_item_slot(item)    ((uint32_t)((uintptr_t)(item) >> 2))
+#define swap_item_ksm(kp)       ((void *)((uintptr_t)(kp) | 2))
+#define swap_item_is_ksm(item)  ((uintptr_t)(item) & 2)
+#define swap_item_kp(item)      ((ksm_page_t *)((uintptr_t)(item) & ~3))
+
+/*
+ * The swapped-out pages of one object, indexed by page number.
+ */
+typedef struct swap_obj {
+        mmobj_t         *so_obj;
+        uint32_t        so_nslots;
+        radix_tree_t    so_slots;
+        list_link_t     so_hlink;
+} swap_obj_t;
+
+#define SWAP_HASH_SIZE          64
+#define swap_hash(o)            (((uintptr_t)(o) >> 5) % SWAP_HASH_SIZE)
+
+/* Pages looked up at once when an object gives all of its slots back */
+#define SWAP_BATCH              32
+
+static list_t swap_objs[SWAP_HASH_SIZE];
+static slab_allocator_t *swap_obj_allocator = NULL;
+
+static blockdev_t *swap_bd = NULL;
+
+/* One bit per slot, set if the slot is in use */
+static uint32_t swap_map[SWAP_MAP_WORDS];
+static uint32_t swap_nfree;
+static uint32_t swap_hint;              /* word to start the next search at */
+
+/* statistics */
+static uint32_t swap_nouts;             /* pages written to the disk */
+static uint32_t swap_nins;              /* pages read back from it */
+static uint32_t swap_nfailed;           /* pages that found no room and stay pinned */
+static uint32_t swap_nerrors;           /* read or write errors */
+
+static __attribute__((unused)) void
+swap_init(void)
+{
+        uint32_t i;
+
+        for (i = 0; i < SWAP_HASH_SIZE; ++i)
+                list_init(&swap_objs[i]);
+        swap_obj_allocator = slab_allocator_create("swap_obj", sizeof(swap_obj_t));
+        KASSERT(NULL != swap_obj_allocator);
+
+        /* the bits past the last slot are never free */
+        memset(swap_map, 0, sizeof(swap_map));
+        for (i = SWAP_NSLOTS; i < SWAP_MAP_WORDS * 32; ++i)
+                swap_map[i / 32] |= 1U << (i % 32);
+        swap_nfree = SWAP_NSLOTS;
+        swap_hint = 0;
+}
+init_func(swap_init);
+
+/*
+ * Returns nonzero if there is a swap disk. The disk is looked up on first
+ * use rather than at init time, after the disk drivers have come up.
+ */
+static int
+swap_disk_enabled(void)
+{
+#if defined(__NDISKS__) && __NDISKS__ > 1
+        if (NULL == swap_bd) {
+                KASSERT(BLOCK_SIZE == PAGE_SIZE);
+                swap_bd = blockdev_lookup(MKDEVID(DISK_MAJOR, __NDISKS__ - 1));
+        }
+#endif
+        return NULL != swap_bd;
+}
+
+/*
+ * Returns nonzero if anonymous pages can be swapped out at all.
+ */
+int
+swap_enabled(void)
+{
+        return swap_disk_enabled() || zram_enabled();
+}
+
+/*
+ * Returns the number of pins a fill leaves on a page of an anon or shadow
+ * object: without anywhere to swap to, such pages stay pinned for as long
+ * as they live. A page with more pins than that is in use.
+ */
+int
+swap_fill_pins(void)
+{
+        return swap_enabled() ? 0 : 1;
+}
+
+static int
+swap_slot_alloc(void)
+{
+        uint32_t i, w, bit;
+
+        if (0 == swap_nfree)
+                return -1;
+        for (i = 0; i < SWAP_MAP_WORDS; ++i) {
+                w = (swap_hint + i) % SWAP_MAP_WORDS;
+                if (0xffffffff == swap_map[w])
+                        continue;
+                for (bit = 0; swap_map[w] & (1U << bit); ++bit)
+                        ;
+                swap_map[w] |= 1U << bit;
+                swap_nfree--;
+                swap_hint = w;
+                return w * 32 + bit;
+        }
+        panic("swap_nfree is %u but no slot is free\n", swap_nfree);
+        return -1;
+}
+
+static void
+swap_slot_free(uint32_t slot)
+{
+        KASSERT(slot < SWAP_NSLOTS);
+        KASSERT(swap_map[slot / 32] & (1U << (slot % 32)));
+
+        swap_map[slot / 32] &= ~(1U << (slot % 32));
+        swap_nfree++;
+}
+
+static swap_obj_t *
+swap_obj_lookup(mmobj_t *o)
+{
+        swap_obj_t *so;
+
+        list_iterate_begin(&swap_objs[swap_hash(o)], so, swap_obj_t, so_hlink) {
+                if (so->so_obj == o)
+                        return so;
+        } list_iterate_end();
+        return NULL;
+}
+
+static swap_obj_t *
+swap_obj_get(mmobj_t *o)
+{
+        swap_obj_t *so;
+
+        if (NULL != (so = swap_obj_lookup(o)))
+                return so;
+        if (NULL == (so = slab_obj_alloc(swap_obj_allocator)))
+                return NULL;
+        so->so_obj = o;
+        so->so_nslots = 0;
+        radix_tree_init(&so->so_slots);
+        list_insert_head(&swap_objs[swap_hash(o)], &so->so_hlink);
+        return so;
+}
+
+static void
+swap_obj_put(swap_obj_t *so)
+{
+        if (0 != so->so_nslots)
+                return;
+        list_remove(&so->so_hlink);
+        slab_obj_free(swap_obj_allocator, so);
+}
+
+static void
+swap_item_free(void *item)
+{
+        if (swap_item_is_disk(item))
+                swap_slot_free(swap_item_slot(item));
+        else if (swap_item_is_ksm(item))
+                ksm_put(swap_item_kp(item));
+        else
+                zram_free(item);
+}
+
+/*
+ * Returns where page pagenum of o was swapped out to, or NULL.
+ */
+static void *
+swap_item_find(mmobj_t *o, uint32_t pagenum)
+{
+        swap_obj_t *so;
+
+        if (NULL == (so = swap_obj_lookup(o)))
+                return NULL;
+        return radix_lookup(&so->so_slots, pagenum);
+}
+
+/*
+ * Swap out pf, a busy page of o. This is the cleanpage operation of
+ * anon and shadow objects. The page is compressed into zram if it can
+ * be, and written to the swap disk otherwise. It keeps its copy until it
+ * is dirtied, so a clean page that still has one is simply dropped by
+ * pageoutd, without being swapped out again.
+ *
+ * If the page cannot be swapped out it is pinned, so that pageoutd stops
+ * picking it; it stays resident until its object goes away.
+ *
+ * @return 0 on success, -errno on failure
+ */
+int
+swap_out(mmobj_t *o, pframe_t *pf)
+{
+        swap_obj_t *so;
+        void *item = NULL;
+        int slot, ret = -ENOSPC;
+
+        KASSERT(pframe_is_busy(pf));
+
+        swap_discard(o, pf->pf_pagenum);
+
+        /* the page is entered in the object's tree before the disk write
+         * blocks, so that the record is not freed meanwhile */
+        if (NULL == (so = swap_obj_get(o))) {
+                ret = -ENOMEM;
+        } else {
+                if (NULL != (item = zram_store(pf->pf_addr, pf->pf_pagenum))) {
+                        ret = 0;
+                } else if (swap_disk_enabled() && 0 <= (slot = swap_slot_alloc())) {
+                        item = swap_item_disk(slot);
+                        ret = 0;
+                }
+                if (0 == ret && 0 > (ret = radix_insert(&so->so_slots, pf->pf_pagenum, item)))
+                        swap_item_free(item);
+                if (0 == ret)
+                        so->so_nslots++;
+                else
+                        swap_obj_put(so);
+        }
+
+        if (0 == ret && swap_item_is_disk(item)) {
+                dbg(DBG_PFRAME, "swapping out page %d of obj %p to slot %d\n",
+                    pf->pf_pagenum, o, swap_item_slot(item));
+                if (0 > (ret = swap_bd->bd_ops->write_block(swap_bd, pf->pf_addr,
+                                                            swap_item_slot(item), 1))) {
+                        swap_nerrors++;
+                        swap_discard(o, pf->pf_pagenum);
+                } else {
+                        swap_nouts++;
+                }
+        }
+
+        if (0 == ret)
+                return 0;
+        swap_nfailed++;
+        pframe_pin(pf);
+        return ret;
+}
+
+/*
+ * Fill pf, a busy page of o, from swap if it was swapped out.
+ *
+ * @return 1 if the page was read, 0 if it has no copy, -errno on failure
+ */
+int
+swap_in(mmobj_t *o, pframe_t *pf)
+{
+        void *item;
+        int ret;
+
+        KASSERT(pframe_is_busy(pf));
+
+        if (NULL == (item = swap_item_find(o, pf->pf_pagenum)))
+                return 0;
+
+        if (swap_item_is_ksm(item)) {
+                memcpy(pf->pf_addr, swap_item_kp(item)->kp_addr, PAGE_SIZE);
+                return 1;
+        }
+        if (!swap_item_is_disk(item)) {
+                if (0 > (ret = zram_load(item, pf->pf_addr)))
+                        swap_nerrors++;
+                return (0 > ret) ? ret : 1;
+        }
+
+        dbg(DBG_PFRAME, "swapping in page %d of obj %p from slot %d\n",
+            pf->pf_pagenum, o, swap_item_slot(item));
+        if (0 > (ret = swap_bd->bd_ops->read_block(swap_bd, pf->pf_addr,
+                                                   swap_item_slot(item), 1))) {
+                swap_nerrors++;
+                return ret;
+        }
+        swap_nins++;
+        return 1;
+}
+
+/*
+ * Record that page pagenum of o, which the caller is about to free, is a
+ * copy of the shared frame kp, and take a reference on kp.
+ *
+ * @return 0 on success, -ENOMEM if there is no memory to record it
+ */
+int
+swap_merge(mmobj_t *o, uint32_t pagenum, ksm_page_t *kp)
+{
+        swap_obj_t *so;
+        int ret;
+
+        swap_discard(o, pagenum);
+        if (NULL == (so = swap_obj_get(o)))
+                return -ENOMEM;
+        if (0 > (ret = radix_insert(&so->so_slots, pagenum, swap_item_ksm(kp)))) {
+                swap_obj_put(so);
+                return ret;
+        }
+        so->so_nslots++;
+        ksm_get(kp);
+        return 0;
+}
+
+/*
+ * Returns the shared frame that page pagenum of o was merged into, or
+ * NULL if it was not.
+ */
+void *
+swap_merged_page(mmobj_t *o, uint32_t pagenum)
+{
+        void *item = swap_item_find(o, pagenum);
+
+        if (NULL == item || !swap_item_is_ksm(item))
+                return NULL;
+        return swap_item_kp(item)->kp_addr;
+}
+
+/*
+ * Returns nonzero if page pagenum of o was swapped out.
+ */
+int
+swap_has(mmobj_t *o, uint32_t pagenum)
+{
+        return NULL != swap_item_find(o, pagenum);
+}
+
+/*
+ * Returns nonzero if any of the pages [first, last] of o was swapped out
+ * (or merged).
+ */
+int
+swap_has_range(mmobj_t *o, uint32_t first, uint32_t last)
+{
+        swap_obj_t *so;
+        void *item;
+
+        if (NULL == (so = swap_obj_lookup(o)))
+                return 0;
+        return 0 != radix_gang_lookup(&so->so_slots, first, last, &item, 1);
+}
+
+/*
+ * Drop the swapped-out copy of page pagenum of o, if it has one, because
+ * the resident copy is about to change.
+ */
+void
+swap_discard(mmobj_t *o, uint32_t pagenum)
+{
+        swap_obj_t *so;
+        void *item;
+
+        if (NULL == (so = swap_obj_lookup(o)))
+                return;
+        if (NULL == (item = radix_delete(&so->so_slots, pagenum)))
+                return;
+        /* processes may map a shared frame directly; they must not keep
+         * it once it may be freed */
+        if (swap_item_is_ksm(item))
+                pframe_unmap_page(o, pagenum);
+        swap_item_free(item);
+        so->so_nslots--;
+        swap_obj_put(so);
+}
+
+/*
+ * Drop every swapped-out page of o, which is being destroyed.
+ */
+void
+swap_release_obj(mmobj_t *o)
+{
+        swap_obj_t *so;
+        void *items[SWAP_BATCH];
+        uint32_t pagenums[SWAP_BATCH];
+        uint32_t first = 0, n, i;
+
+        if (NULL == (so = swap_obj_lookup(o)))
+                return;
+
+        while (0 != so->so_nslots) {
+                n = radix_gang_lookup_index(&so->so_slots, first, (uint32_t) -1,
+                                            items, pagenums, SWAP_BATCH);
+                KASSERT(0 < n);
+                for (i = 0; i < n; ++i) {
+                        first = pagenums[i];
+                        radix_delete(&so->so_slots, first);
+                        swap_item_free(items[i]);
+                        so->so_nslots--;
+                }
+                first++;
+        }
+        swap_obj_put(so);
+}
+
+#ifdef __DRIVERS__
+
+/*
+ * swap - show swap space usage and paging counters
+ */
+static int
+swap_kshell(kshell_t *ksh, int argc, char **argv)
+{
+        if (1 != argc) {
+                kprintf(ksh, "usage: swap\n");
+                return 0;
+        }
+
+        if (!swap_disk_enabled())
+                kprintf(ksh, "no swap disk (NDISKS must be at least 2)\n");
+        else
+                kprintf(ksh, "slots used:  %u of %u\n", SWAP_NSLOTS - swap_nfree, SWAP_NSLOTS);
+        kprintf(ksh, "swapped out: %u\n", swap_nouts);
+        kprintf(ksh, "swapped in:  %u\n", swap_nins);
+        kprintf(ksh, "kept pinned: %u\n", swap_nfailed);
+        kprintf(ksh, "I/O errors:  %u\n", swap_nerrors);
+        kprintf(ksh, "(see 'zram' for compressed pages)\n");
+        return 0;
+}
+
+static __attribute__((unused)) void
+swap_kshell_init(void)
+{
+        kshell_add_command("swap", swap_kshell, "show swap space usage and paging counters");
+}
+init_func(swap_kshell_init);
+init_depends(kshell_init);
+
+#endif /* __DRIVERS__ */
@@ -0,0 +1,84 @@
+#include "kernel.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/list.h"
+#include "util/radix.h"
+
+#include "mm/slab.h"
+
+#include "vm/vmmap.h"
+#include "vm/mlock.h"
+#include "vm/vmarea_ext.h"
+
+#include "api/syscall_ext.h"
+
+#define VX_HASH_SIZE    64
+#define vx_hash(vma)    ((((uint32_t)(vma)) >> 5) % VX_HASH_SIZE)
+
+static list_t vx_records[VX_HASH_SIZE];
+static slab_allocator_t *vx_allocator = NULL;
+
+static __attribute__((unused)) void
+vmarea_ext_init(void)
+{
+        int i;
+
+        for (i = 0; i < VX_HASH_SIZE; ++i)
+                list_init(&vx_records[i]);
+        vx_allocator = slab_allocator_create("vmarea_ext", sizeof(vmarea_ext_t));
+        KASSERT(NULL != vx_allocator);
+}
+init_func(vmarea_ext_init);
+
+/*
+ * Make the record of vma, which has just been allocated. Returns 0 or
+ * -ENOMEM.
+ */
+int
+vmarea_ext_create(vmarea_t *vma)
+{
+        vmarea_ext_t *vx;
+
+        if (NULL == (vx = slab_obj_alloc(vx_allocator)))
+                return -ENOMEM;
+        vx->vx_vma = vma;
+        vx->vx_advice = MADV_NORMAL;
+        vx->vx_fa_window = VMAREA_FA_DEFAULT;
+        vx->vx_lock_pid = 0;
+        vx->vx_lock_all = 0;
+        vx->vx_nlocked = 0;
+        radix_tree_init(&vx->vx_locked);
+        list_insert_head(&vx_records[vx_hash(vma)], &vx->vx_hlink);
+        return 0;
+}
+
+/* Returns the record of vma. */
+vmarea_ext_t *
+vmarea_ext(const vmarea_t *vma)
+{
+        vmarea_ext_t *vx;
+        list_iterate_begin(&vx_records[vx_hash(vma)], vx, vmarea_ext_t, vx_hlink) {
+                if (vx->vx_vma == vma)
+                        return vx;
+        } list_iterate_end();
+        panic("vmarea %p has no extension record\n", vma);
+        return NULL;
+}
+
+/*
+ * Unlock the pages of vma and drop its record. The pins must be gone by
+ * the time the area's object is put, since the object frees its pages
+ * with them.
+ */
+void
+vmarea_ext_destroy(vmarea_t *vma)
+{
+        vmarea_ext_t *vx = vmarea_ext(vma);
+
+        mlock_forget(vma);
+        KASSERT(0 == vx->vx_nlocked);
+        list_remove(&vx->vx_hlink);
+        slab_obj_free(vx_allocator, vx);
+}
@@ -5,6 +5,11 @@
 #include "vm/vmmap.h"
 #include "vm/shadow.h"
 #include "vm/anon.h"
+#include "vm/memlimit.h"
+#include "vm/hugepage.h"
+#include "vm/rmap.h"
+#include "vm/mlock.h"
+#include "vm/vmarea_ext.h"
 
 #include "proc/proc.h"
 
@@ -23,6 +28,8 @@
 #include "mm/mm.h"
 #include "mm/mman.h"
 #include "mm/mmobj.h"
+#include "mm/readahead.h"
+#include "mm/pframe_ext.h"
 
 static slab_allocator_t *vmmap_allocator;
 static slab_allocator_t *vmarea_allocator;
@@ -42,6 +49,15 @@ vmarea_alloc(void)
         vmarea_t *newvma = (vmarea_t *) slab_obj_alloc(vmarea_allocator);
         if (newvma) {
                 newvma->vma_vmmap = NULL;
+                if (0 > vmarea_ext_create(newvma)) {
+                        slab_obj_free(vmarea_allocator, newvma);
+                        return NULL;
+                }
+                if (0 > rmap_prepare(newvma)) {
+                        vmarea_ext_destroy(newvma);
+                        slab_obj_free(vmarea_allocator, newvma);
+                        return NULL;
+                }
         }
         return newvma;
 }
@@ -50,6 +66,9 @@ void
 vmarea_free(vmarea_t *vma)
 {
         KASSERT(NULL != vma);
+        rmap_release(vma);
+        vmarea_ext_destroy(vma);
+        readahead_forget(vma);
         slab_obj_free(vmarea_allocator, vma);
 }
 
@@ -126,6 +145,16 @@ vmmap_destroy(vmmap_t *map)
     KASSERT(NULL != map);
     dbg(DBG_PRINT, "(GRADING3A 3.a)\n");
 
+    // The page directory outlives the map; it must not be left with
+    // large mappings that pt_unmap_range() and pt_destroy_pagedir() do
+    // not know about.
+    if (NULL != map->vmm_proc)
+            hugepage_unmap_range(map->vmm_proc->p_pagedir, USER_MEM_LOW, USER_MEM_HIGH);
+
+    // Writes to shared file pages the MMU has seen but the page cache
+    // has not yet are not lost with the mappings.
+    pframe_harvest_unmap(map, ADDR_TO_PN(USER_MEM_LOW), ADDR_TO_PN(USER_MEM_HIGH));
+
     // Check if list is empty
     if (!list_empty(&map->vmm_list))
     {
@@ -133,6 +162,10 @@ vmmap_destroy(vmmap_t *map)
         vmarea_t *vma = NULL;
         list_iterate_begin(&map->vmm_list, vma, vmarea_t, vma_plink)
         {
+            // locked pages are unpinned first, or the object could not
+            // free them
+            mlock_forget(vma);
+
             // put operation on the mmobj in the vma
             mmobj_t *mmobj = vma->vma_obj;
             mmobj->mmo_ops->put(mmobj);
@@ -141,6 +174,7 @@ vmmap_destroy(vmmap_t *map)
             if (list_link_is_linked(&vma->vma_olink))
             {   
                 list_remove(&vma->vma_olink);
+                rmap_remove(vma);
                 dbg(DBG_PRINT, "(GRADING3A)\n");
             }
 
@@ -350,6 +384,22 @@ vmmap_clone(vmmap_t *map)
     return clone_vmm;
 }
 
+/* Returns the number of pages of [lopage, lopage + npages) that map
+ * already maps. */
+static uint32_t
+vmmap_count_mapped(vmmap_t *map, uint32_t lopage, uint32_t npages)
+{
+        uint32_t hipage = lopage + npages, count = 0;
+        vmarea_t *vma;
+
+        list_iterate_begin(&map->vmm_list, vma, vmarea_t, vma_plink) {
+                if (vma->vma_end <= lopage || vma->vma_start >= hipage)
+                        continue;
+                count += MIN(hipage, vma->vma_end) - MAX(lopage, vma->vma_start);
+        } list_iterate_end();
+        return count;
+}
+
 /* Insert a mapping into the map starting at lopage for npages pages.
  * If lopage is zero, we will find a range of virtual addresses in the
  * process that is big enough, by using vmmap_find_range with the same
@@ -398,8 +448,25 @@ vmmap_map(vmmap_t *map, vnode_t *file, uint32_t lopage, uint32_t npages,
     KASSERT(PAGE_ALIGNED(off));
     dbg(DBG_PRINT, "(GRADING3A 3.d)\n");
 
+    // A fixed mapping replaces whatever it overlaps, so only the pages
+    // not mapped yet make the address space grow.
+    int retval;
+    uint32_t grow = npages;
+    if (lopage != 0)
+    {
+        grow -= vmmap_count_mapped(map, lopage, npages);
+    }
+    if ((retval = memlimit_vsize_check(map->vmm_proc, grow)) < 0)
+    {
+        return retval;
+    }
+
     uint32_t addr_s = 0;
     vmarea_t *vma = vmarea_alloc();
+    if (NULL == vma)
+    {
+        return -ENOMEM;
+    }
     if (lopage == 0)
     {
         int avail_space_start = vmmap_find_range(map, npages, dir);
@@ -447,6 +514,7 @@ vmmap_map(vmmap_t *map, vnode_t *file, uint32_t lopage, uint32_t npages,
     }
 
     list_insert_tail(mmobj_bottom_vmas(vma->vma_obj), &vma->vma_olink);
+    rmap_add(vma);
 
     // shadow case
     if ((flags & MAP_PRIVATE) == MAP_PRIVATE)
@@ -507,6 +575,20 @@ vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages)
     // init
     uint32_t start_vfn = lopage;
     uint32_t end_vfn = lopage + npages;
+
+    // Large pages reaching into the range are torn down whole; what is
+    // left of them outside the range faults back in.
+    if (NULL != map->vmm_proc)
+            hugepage_unmap_range(map->vmm_proc->p_pagedir, (uintptr_t)PN_TO_ADDR(start_vfn),
+                                 (uintptr_t)PN_TO_ADDR(end_vfn));
+
+    // Pages locked in the range are unlocked before the objects that
+    // hold them may be put.
+    mlock_unmap(map, start_vfn, npages);
+
+    // Shared file pages written through the range are dirtied before
+    // their mappings go.
+    pframe_harvest_unmap(map, start_vfn, end_vfn);
     
     // iterate theough the list
     list_iterate_begin(&map->vmm_list, vma_curr, vmarea_t, vma_plink)
@@ -538,6 +620,7 @@ vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages)
             
             vma_curr->vma_off = vma_curr->vma_off + end_vfn - vma_curr->vma_start;
             vma_curr->vma_start = end_vfn;
+            rmap_update(vma_curr);
 
             if (split_vma->vma_start == split_vma->vma_end)
             {
@@ -550,6 +633,11 @@ vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages)
             else
             {
                 list_insert_before(&vma_curr->vma_plink, &split_vma->vma_plink);
+                /* the lower part maps the same object pages as before, so
+                 * it has to be found when they are unmapped */
+                list_insert_tail(mmobj_bottom_vmas(split_vma->vma_obj), &split_vma->vma_olink);
+                rmap_add(split_vma);
+                mlock_split(vma_curr, split_vma);
                 dbg(DBG_PRINT, "(GRADING3D 2)\n");
             }
 
@@ -559,6 +647,7 @@ vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages)
                 if (list_link_is_linked(&vma_curr->vma_olink))
                 {
                     list_remove(&vma_curr->vma_olink);
+                    rmap_remove(vma_curr);
                     dbg(DBG_PRINT, "(GRADING3A)\n");
                 }
 
@@ -579,6 +668,7 @@ vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages)
         else if (vma_curr->vma_end < end_vfn  && vma_curr->vma_start <= start_vfn && !flg_overlap)
         {
             vma_curr->vma_end = lopage;
+            rmap_update(vma_curr);
 
             if (vma_curr->vma_start == vma_curr->vma_end)
             {
@@ -586,6 +676,7 @@ vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages)
                 if (list_link_is_linked(&vma_curr->vma_olink))
                 {
                     list_remove(&vma_curr->vma_olink);
+                    rmap_remove(vma_curr);
                     dbg(DBG_PRINT, "(GRADING3A)\n");
                 }
                 if (list_link_is_linked(&vma_curr->vma_plink))
@@ -604,6 +695,7 @@ vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages)
         {
             vma_curr->vma_off = vma_curr->vma_off + end_vfn - vma_curr->vma_start;
             vma_curr->vma_start = end_vfn;
+            rmap_update(vma_curr);
 
             if (vma_curr->vma_start == vma_curr->vma_end)
             {
@@ -611,6 +703,7 @@ vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages)
                 if (list_link_is_linked(&vma_curr->vma_olink))
                 {
                     list_remove(&vma_curr->vma_olink);
+                    rmap_remove(vma_curr);
                     dbg(DBG_PRINT, "(GRADING3D 2)\n");
                 }
                 if (list_link_is_linked(&vma_curr->vma_plink))
@@ -636,6 +729,7 @@ vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages)
             if (list_link_is_linked(&vma_curr->vma_olink))
             {
                 list_remove(&vma_curr->vma_olink);
+                rmap_remove(vma_curr);
                 dbg(DBG_PRINT, "(GRADING3D 2)\n");
             }
             if (list_link_is_linked(&vma_curr->vma_plink))
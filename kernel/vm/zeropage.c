@@ -0,0 +1,110 @@
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/string.h"
+
+#include "proc/proc.h"
+
+#include "mm/mm.h"
+#include "mm/page.h"
+#include "mm/mmobj.h"
+#include "mm/pframe.h"
+#include "mm/pagetable.h"
+#include "mm/fileobj.h"
+
+#include "vm/vmmap.h"
+#include "vm/swap.h"
+#include "vm/zeropage.h"
+
+#include "test/kshell/kshell.h"
+#include "test/kshell/io.h"
+
+static void *zeropage = NULL;
+
+/* statistics */
+static uint32_t zeropage_nmapped;       /* read faults served */
+static uint32_t zeropage_nmerged;       /* of those, by frames ksmd merged */
+
+static __attribute__((unused)) void
+zeropage_init(void)
+{
+        zeropage = page_alloc();
+        KASSERT(NULL != zeropage);
+        memset(zeropage, 0, PAGE_SIZE);
+}
+init_func(zeropage_init);
+
+/*
+ * Returns the zero page.
+ */
+void *
+zeropage_page(void)
+{
+        return zeropage;
+}
+
+/*
+ * Try to serve a read fault at vaddr in vma with the zero page, or with
+ * the frame ksmd merged the page into. Returns 1 if a frame is now
+ * mapped there, 0 if the caller should look the page up.
+ */
+int
+zeropage_fault(vmarea_t *vma, uintptr_t vaddr)
+{
+        uint32_t pn = ADDR_TO_PN(vaddr) - vma->vma_start + vma->vma_off;
+        void *page = zeropage;
+        mmobj_t *o;
+
+        for (o = vma->vma_obj; NULL != o; o = o->mmo_shadowed) {
+                if (NULL != pframe_get_resident(o, pn))
+                        return 0;
+                if (swap_has(o, pn)) {
+                        /* a swapped-out page must be read back */
+                        if (NULL == (page = swap_merged_page(o, pn)))
+                                return 0;
+                        zeropage_nmerged++;
+                        break;
+                }
+                /* file pages are never all zeros by default */
+                if (NULL == o->mmo_shadowed && !anon_is_anon(o))
+                        return 0;
+        }
+        if (zeropage == page)
+                zeropage_nmapped++;
+
+        pt_map(curproc->p_pagedir, (uintptr_t) PAGE_ALIGN_DOWN(vaddr),
+               pt_virt_to_phys((uintptr_t) page),
+               PD_PRESENT | PD_USER, PT_PRESENT | PT_USER);
+        return 1;
+}
+
+#ifdef __DRIVERS__
+
+/*
+ * zeropage - show how many read faults the zero page served
+ */
+static int
+zeropage_kshell(kshell_t *ksh, int argc, char **argv)
+{
+        if (1 != argc) {
+                kprintf(ksh, "usage: zeropage\n");
+                return 0;
+        }
+        kprintf(ksh, "read faults served: %u\n", zeropage_nmapped + zeropage_nmerged);
+        kprintf(ksh, "  by merged frames: %u\n", zeropage_nmerged);
+        return 0;
+}
+
+static __attribute__((unused)) void
+zeropage_kshell_init(void)
+{
+        kshell_add_command("zeropage", zeropage_kshell,
+                           "show how many read faults the zero page served");
+}
+init_func(zeropage_kshell_init);
+init_depends(kshell_init);
+
+#endif /* __DRIVERS__ */
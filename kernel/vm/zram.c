@@ -0,0 +1,193 @@
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/string.h"
+#include "util/lz.h"
+#include "util/parse.h"
+
+#include "mm/mm.h"
+#include "mm/slab.h"
+
+#include "vm/zram.h"
+
+#include "test/kshell/kshell.h"
+#include "test/kshell/io.h"
+
+/*
+ * Object sizes (header included) that compressed pages are rounded up
+ * to. A page whose compressed form does not fit in the largest class
+ * saves too little to be worth keeping in memory.
+ */
+static const uint32_t zram_class_size[] = {
+        64, 128, 256, 384, 512, 768, 1024, 1280, 1536, 2048, 2560, 3072
+};
+static const char *zram_class_name[] = {
+        "zram64", "zram128", "zram256", "zram384", "zram512", "zram768",
+        "zram1024", "zram1280", "zram1536", "zram2048", "zram2560", "zram3072"
+};
+#define ZRAM_NCLASSES   (sizeof(zram_class_size) / sizeof(zram_class_size[0]))
+#define ZRAM_MAX_SIZE   (zram_class_size[ZRAM_NCLASSES - 1])
+
+static slab_allocator_t *zram_allocators[ZRAM_NCLASSES];
+
+/* compression output; nothing blocks while it is in use */
+static uint8_t zram_buf[PAGE_SIZE];
+
+/* off unless configured (ZRAM in Config.mk) or turned on with 'zram on':
+ * while zram is on, anonymous memory is no longer pinned */
+#ifdef __ZRAM__
+static int zram_on = 1;
+#else
+static int zram_on = 0;
+#endif
+static uint32_t zram_limit = 4096;      /* pages of memory zram may use */
+
+/* statistics */
+static uint32_t zram_nstored;           /* pages held right now */
+static uint32_t zram_nbytes;            /* their compressed length */
+static uint32_t zram_nallocated;        /* size of their slab objects */
+static uint32_t zram_nstores;
+static uint32_t zram_nloads;
+static uint32_t zram_nrejected;         /* pages that did not compress */
+static uint32_t zram_nfull;             /* pages refused at the limit or for lack of memory */
+
+static __attribute__((unused)) void
+zram_init(void)
+{
+        uint32_t i;
+
+        for (i = 0; i < ZRAM_NCLASSES; ++i) {
+                zram_allocators[i] = slab_allocator_create(zram_class_name[i], zram_class_size[i]);
+                KASSERT(NULL != zram_allocators[i]);
+        }
+}
+init_func(zram_init);
+
+int
+zram_enabled(void)
+{
+        return zram_on;
+}
+
+/*
+ * Compress page into a new entry, or return NULL if zram is off or full
+ * or the page does not compress well enough.
+ */
+zram_entry_t *
+zram_store(const void *page, uint32_t pagenum)
+{
+        zram_entry_t *ze;
+        uint32_t len, c;
+
+        if (!zram_on)
+                return NULL;
+
+        len = lz_compress(page, PAGE_SIZE, zram_buf, ZRAM_MAX_SIZE - sizeof(zram_entry_t));
+        if (0 == len) {
+                zram_nrejected++;
+                return NULL;
+        }
+        for (c = 0; zram_class_size[c] < len + sizeof(zram_entry_t); ++c)
+                ;
+
+        if (zram_nallocated + zram_class_size[c] > zram_limit * PAGE_SIZE
+            || NULL == (ze = slab_obj_alloc(zram_allocators[c]))) {
+                zram_nfull++;
+                return NULL;
+        }
+        ze->ze_pagenum = pagenum;
+        ze->ze_len = len;
+        ze->ze_class = c;
+        memcpy(ze->ze_data, zram_buf, len);
+
+        zram_nstored++;
+        zram_nbytes += len;
+        zram_nallocated += zram_class_size[c];
+        zram_nstores++;
+        return ze;
+}
+
+/*
+ * Decompress ze into page. ze stays allocated.
+ *
+ * @return 0 on success, -EIO if the entry is corrupt
+ */
+int
+zram_load(zram_entry_t *ze, void *page)
+{
+        if (PAGE_SIZE != lz_decompress(ze->ze_data, ze->ze_len, page, PAGE_SIZE)) {
+                dbg(DBG_PFRAME, "zram: corrupt entry for page %u\n", ze->ze_pagenum);
+                return -EIO;
+        }
+        zram_nloads++;
+        return 0;
+}
+
+void
+zram_free(zram_entry_t *ze)
+{
+        KASSERT(ze->ze_class < ZRAM_NCLASSES);
+
+        zram_nstored--;
+        zram_nbytes -= ze->ze_len;
+        zram_nallocated -= zram_class_size[ze->ze_class];
+        slab_obj_free(zram_allocators[ze->ze_class], ze);
+}
+
+#ifdef __DRIVERS__
+
+/*
+ * zram                - show compressed store statistics
+ * zram on|off         - start or stop storing pages (stored pages stay)
+ * zram limit <pages>  - memory zram may use
+ */
+static int
+zram_kshell(kshell_t *ksh, int argc, char **argv)
+{
+        uint32_t saved, ratio;
+
+        if (2 == argc && 0 == strcmp(argv[1], "on")) {
+                zram_on = 1;
+                return 0;
+        } else if (2 == argc && 0 == strcmp(argv[1], "off")) {
+                zram_on = 0;
+                return 0;
+        } else if (3 == argc && 0 == strcmp(argv[1], "limit")) {
+                if (parse_uint(argv[2], &zram_limit))
+                        kprintf(ksh, "zram: bad limit '%s'\n", argv[2]);
+                return 0;
+        } else if (1 != argc) {
+                kprintf(ksh, "usage: zram [on|off|limit <pages>]\n");
+                return 0;
+        }
+
+        /* pages held, less the pages their slab objects take up */
+        saved = zram_nstored - (zram_nallocated + PAGE_SIZE - 1) / PAGE_SIZE;
+        /* in hundredths */
+        ratio = zram_nbytes ? (uint32_t)((uint64_t) zram_nstored * PAGE_SIZE * 100 / zram_nbytes) : 0;
+
+        kprintf(ksh, "zram:              %s, limit %u pages\n", zram_on ? "on" : "off", zram_limit);
+        kprintf(ksh, "pages stored:      %u\n", zram_nstored);
+        kprintf(ksh, "pages saved:       %u\n", saved);
+        kprintf(ksh, "compressed bytes:  %u (%u allocated)\n", zram_nbytes, zram_nallocated);
+        kprintf(ksh, "compression ratio: %u.%02u\n", ratio / 100, ratio % 100);
+        kprintf(ksh, "stores:            %u\n", zram_nstores);
+        kprintf(ksh, "loads:             %u\n", zram_nloads);
+        kprintf(ksh, "incompressible:    %u\n", zram_nrejected);
+        kprintf(ksh, "refused, full:     %u\n", zram_nfull);
+        return 0;
+}
+
+static __attribute__((unused)) void
+zram_kshell_init(void)
+{
+        kshell_add_command("zram", zram_kshell,
+                           "show compressed swap statistics, or set it up");
+}
+init_func(zram_kshell_init);
+init_depends(kshell_init);
+
+#endif /* __DRIVERS__ */
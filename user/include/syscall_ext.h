@@ -0,0 +1,19 @@
+#pragma once
+
+#include "sys/types.h"
+#include "weenix/syscall_ext.h"
+
+/*
+ * Library calls for the system calls in weenix/syscall_ext.h. Each
+ * returns -1 and sets errno on failure.
+ */
+
+int fsync(int fd);
+int fdatasync(int fd);
+void *brk_populate(void *addr);
+int madvise(void *addr, size_t len, int advice);
+int mlock(const void *addr, size_t len);
+int munlock(const void *addr, size_t len);
+int mlockall(int flags);
+int munlockall(void);
+int msync(void *addr, size_t len, int flags);
@@ -0,0 +1 @@
+../../../kernel/include/api/syscall_ext.h
\ No newline at end of file
@@ -0,0 +1,75 @@
+#include "sys/types.h"
+#include "weenix/trap.h"
+#include "syscall_ext.h"
+
+int
+fsync(int fd)
+{
+        return trap(SYS_fsync, (uint32_t) fd);
+}
+
+int
+fdatasync(int fd)
+{
+        return trap(SYS_fdatasync, (uint32_t) fd);
+}
+
+void *
+brk_populate(void *addr)
+{
+        return (void *) trap(SYS_brk_populate, (uint32_t) addr);
+}
+
+int
+madvise(void *addr, size_t len, int advice)
+{
+        madvise_args_t args;
+
+        args.addr = addr;
+        args.len = len;
+        args.advice = advice;
+        return trap(SYS_madvise, (uint32_t) &args);
+}
+
+int
+mlock(const void *addr, size_t len)
+{
+        mlock_args_t args;
+
+        args.addr = (void *) addr;
+        args.len = len;
+        return trap(SYS_mlock, (uint32_t) &args);
+}
+
+int
+munlock(const void *addr, size_t len)
+{
+        mlock_args_t args;
+
+        args.addr = (void *) addr;
+        args.len = len;
+        return trap(SYS_munlock, (uint32_t) &args);
+}
+
+int
+mlockall(int flags)
+{
+        return trap(SYS_mlockall, (uint32_t) flags);
+}
+
+int
+munlockall(void)
+{
+        return trap(SYS_munlockall, 0);
+}
+
+int
+msync(void *addr, size_t len, int flags)
+{
+        msync_args_t args;
+
+        args.addr = addr;
+        args.len = len;
+        args.flags = flags;
+        return trap(SYS_msync, (uint32_t) &args);
+}
@@ -0,0 +1,216 @@
+/*
+ * Tests for the system calls in weenix/syscall_ext.h: fsync, fdatasync,
+ * brk_populate, madvise, mlock, munlock, mlockall, munlockall and msync,
+ * and for its mmap(2) flags.
+ */
+
+#include "errno.h"
+#include "fcntl.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include "sys/mman.h"
+#include "sys/types.h"
+
+#include "syscall_ext.h"
+#include "test/test.h"
+
+#define EXTCALL_FILE    "/extcalltest"
+#define EXTCALL_PAGE    4096
+#define EXTCALL_HUGE    (4096 * 1024)
+
+static char extcall_buf[EXTCALL_PAGE];
+
+static int
+extcall_make_file(void)
+{
+        int fd;
+
+        memset(extcall_buf, 'a', sizeof(extcall_buf));
+        test_assert(0 <= (fd = open(EXTCALL_FILE, O_RDWR | O_CREAT, 0)),
+                    "open failed: %s", strerror(errno));
+        test_assert(EXTCALL_PAGE == write(fd, extcall_buf, EXTCALL_PAGE),
+                    "write failed: %s", strerror(errno));
+        return fd;
+}
+
+static void
+test_fsync(void)
+{
+        int fd = extcall_make_file();
+
+        syscall_success(fsync(fd));
+        syscall_success(fdatasync(fd));
+        syscall_success(close(fd));
+        syscall_fail(fsync(fd), EBADF);
+        syscall_fail(fdatasync(-1), EBADF);
+        syscall_success(unlink(EXTCALL_FILE));
+}
+
+static void
+test_brk_populate(void)
+{
+        char *cur = sbrk(0), *p;
+        void *ret;
+
+        ret = brk_populate(cur + 2 * EXTCALL_PAGE);
+        test_assert((void *) -1 != ret, "brk_populate failed: %s", strerror(errno));
+        for (p = cur; p < cur + 2 * EXTCALL_PAGE; p += EXTCALL_PAGE)
+                test_assert(0 == *p, "populated heap is not zero filled");
+        syscall_success(brk(cur));
+}
+
+static void
+test_map_huge(void)
+{
+        char *p;
+        int fd;
+
+        p = mmap(NULL, EXTCALL_HUGE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANON | MAP_HUGE, -1, 0);
+        test_assert(MAP_FAILED != p, "mmap failed: %s", strerror(errno));
+        test_assert(0 == (unsigned long) p % EXTCALL_HUGE,
+                    "MAP_HUGE mapping is not on a 4 MB boundary");
+        p[0] = 'x';
+        p[EXTCALL_HUGE - 1] = 'y';
+        test_assert('x' == p[0] && 'y' == p[EXTCALL_HUGE - 1],
+                    "MAP_HUGE mapping lost a write");
+        syscall_success(munmap(p, EXTCALL_HUGE));
+
+        /* file mappings take the flag, and are placed as usual */
+        fd = extcall_make_file();
+        p = mmap(NULL, EXTCALL_PAGE, PROT_READ, MAP_SHARED | MAP_HUGE, fd, 0);
+        test_assert(MAP_FAILED != p, "mmap failed: %s", strerror(errno));
+        test_assert('a' == p[0], "MAP_HUGE file mapping does not show the file");
+        syscall_success(munmap(p, EXTCALL_PAGE));
+        syscall_success(close(fd));
+        syscall_success(unlink(EXTCALL_FILE));
+}
+
+static void
+test_madvise(void)
+{
+        char *p;
+
+        p = mmap(NULL, 2 * EXTCALL_PAGE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANON, -1, 0);
+        test_assert(MAP_FAILED != p, "mmap failed: %s", strerror(errno));
+
+        syscall_success(madvise(p, 2 * EXTCALL_PAGE, MADV_SEQUENTIAL));
+        syscall_success(madvise(p, 2 * EXTCALL_PAGE, MADV_RANDOM));
+        syscall_success(madvise(p, 2 * EXTCALL_PAGE, MADV_WILLNEED));
+        syscall_success(madvise(p, 2 * EXTCALL_PAGE, MADV_NORMAL));
+        syscall_fail(madvise(p + 1, EXTCALL_PAGE, MADV_NORMAL), EINVAL);
+        syscall_fail(madvise(p, EXTCALL_PAGE, 5), EINVAL);
+
+        p[0] = 'x';
+        p[EXTCALL_PAGE] = 'y';
+        syscall_success(madvise(p, EXTCALL_PAGE, MADV_DONTNEED));
+        test_assert(0 == p[0], "MADV_DONTNEED page is not zero filled");
+        test_assert('y' == p[EXTCALL_PAGE], "MADV_DONTNEED dropped too much");
+
+        syscall_success(madvise(p + EXTCALL_PAGE, EXTCALL_PAGE, MADV_FREE));
+        test_assert(0 == p[EXTCALL_PAGE] || 'y' == p[EXTCALL_PAGE],
+                    "MADV_FREE page has neither its old contents nor zeros");
+        p[EXTCALL_PAGE] = 'z';
+        test_assert('z' == p[EXTCALL_PAGE], "write after MADV_FREE was lost");
+
+        syscall_success(munmap(p, 2 * EXTCALL_PAGE));
+}
+
+/* MADV_DONTNEED of memory inherited over fork() reads back as zeros */
+static void
+test_madvise_fork(void)
+{
+        int status;
+        pid_t pid;
+        char *p;
+
+        p = mmap(NULL, 2 * EXTCALL_PAGE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANON, -1, 0);
+        test_assert(MAP_FAILED != p, "mmap failed: %s", strerror(errno));
+        p[0] = 'x';
+        p[EXTCALL_PAGE] = 'y';
+
+        if (0 == (pid = fork())) {
+                if (0 != madvise(p, EXTCALL_PAGE, MADV_DONTNEED)
+                    || 0 != madvise(p + EXTCALL_PAGE, EXTCALL_PAGE, MADV_FREE))
+                        exit(1);
+                exit((0 == p[0] && 0 == p[EXTCALL_PAGE]) ? 0 : 2);
+        }
+        test_assert(0 < pid, "fork failed: %s", strerror(errno));
+        test_assert(pid == waitpid(pid, 0, &status), "waitpid failed: %s", strerror(errno));
+        test_assert(0 == status, "child saw the memory it inherited after discarding it");
+        test_assert('x' == p[0] && 'y' == p[EXTCALL_PAGE],
+                    "the child's discard changed the parent's memory");
+
+        syscall_success(munmap(p, 2 * EXTCALL_PAGE));
+}
+
+static void
+test_mlock(void)
+{
+        char *p;
+
+        p = mmap(NULL, 2 * EXTCALL_PAGE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANON, -1, 0);
+        test_assert(MAP_FAILED != p, "mmap failed: %s", strerror(errno));
+
+        syscall_success(mlock(p, 2 * EXTCALL_PAGE));
+        test_assert(0 == p[0] && 0 == p[EXTCALL_PAGE], "locked memory is not zero filled");
+        p[0] = 'x';
+        syscall_success(munlock(p, 2 * EXTCALL_PAGE));
+        test_assert('x' == p[0], "munlock lost the contents");
+        syscall_fail(mlock(p + 1, EXTCALL_PAGE), EINVAL);
+
+        syscall_success(munmap(p + EXTCALL_PAGE, EXTCALL_PAGE));
+        syscall_fail(mlock(p, 2 * EXTCALL_PAGE), ENOMEM);
+
+        syscall_success(mlockall(MCL_CURRENT | MCL_FUTURE));
+        syscall_success(munlockall());
+        syscall_fail(mlockall(0), EINVAL);
+
+        syscall_success(munmap(p, EXTCALL_PAGE));
+}
+
+static void
+test_msync(void)
+{
+        int fd = extcall_make_file();
+        char *p;
+
+        p = mmap(NULL, EXTCALL_PAGE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        test_assert(MAP_FAILED != p, "mmap failed: %s", strerror(errno));
+
+        p[0] = 'b';
+        syscall_success(msync(p, EXTCALL_PAGE, MS_SYNC));
+        syscall_success(msync(p, EXTCALL_PAGE, MS_ASYNC | MS_INVALIDATE));
+        syscall_fail(msync(p, EXTCALL_PAGE, MS_SYNC | MS_ASYNC), EINVAL);
+        syscall_fail(msync(p + 1, EXTCALL_PAGE, MS_SYNC), EINVAL);
+
+        test_assert(0 == lseek(fd, 0, SEEK_SET), "lseek failed: %s", strerror(errno));
+        test_assert(1 == read(fd, extcall_buf, 1), "read failed: %s", strerror(errno));
+        test_assert('b' == extcall_buf[0], "msync did not reach the file");
+
+        syscall_success(munmap(p, EXTCALL_PAGE));
+        syscall_success(close(fd));
+        syscall_success(unlink(EXTCALL_FILE));
+}
+
+int
+main(int argc, char **argv)
+{
+        test_init();
+
+        test_fsync();
+        test_brk_populate();
+        test_map_huge();
+        test_madvise();
+        test_madvise_fork();
+        test_mlock();
+        test_msync();
+
+        test_fini();
+        return 0;
+}